@@ -98,12 +98,9 @@ Decl *new_decl(DeclKind kind, SrcPos pos, const char *name) {
     return d;
 }
 
-Note *get_decl_note(Decl *decl, const char *name) {
-    if (!decl) {
-        return NULL;
-    }
-    for (size_t i = 0; i < decl->notes.num_notes; i++) {
-        Note *note = decl->notes.notes + i;
+Note *get_note(Notes notes, const char *name) {
+    for (size_t i = 0; i < notes.num_notes; i++) {
+        Note *note = notes.notes + i;
         if (note->name == name) {
             return note;
         }
@@ -111,6 +108,13 @@ Note *get_decl_note(Decl *decl, const char *name) {
     return NULL;
 }
 
+Note *get_decl_note(Decl *decl, const char *name) {
+    if (!decl) {
+        return NULL;
+    }
+    return get_note(decl->notes, name);
+}
+
 bool is_decl_threadlocal(Decl *decl) {
     return decl && get_decl_note(decl, str_intern("threadlocal")) != NULL;
 }
@@ -64,6 +64,7 @@ typedef struct FuncParam {
     SrcPos pos;
     const char *name;
     Typespec *type;
+    Notes notes;
 } FuncParam;
 
 typedef enum AggregateItemKind {
@@ -77,6 +78,7 @@ struct Aggregate;
 typedef struct AggregateItem {
     SrcPos pos;
     AggregateItemKind kind;
+    Notes notes;
     union {
         struct {
             const char **names;
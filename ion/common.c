@@ -8,7 +8,13 @@
 #define ALIGN_DOWN_PTR(p, a) ((void *)ALIGN_DOWN((uintptr_t)(p), (a)))
 #define ALIGN_UP_PTR(p, a) ((void *)ALIGN_UP((uintptr_t)(p), (a)))
 
-void fatal(const char *fmt, ...) {
+#if _MSC_VER
+#define NORETURN __declspec(noreturn)
+#else
+#define NORETURN __attribute__((noreturn))
+#endif
+
+NORETURN void fatal(const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
     fprintf(stderr, "FATAL: ");
@@ -0,0 +1,279 @@
+// Stable diagnostic codes, printed as E<code> by -jsondiag. Each entry pairs a code with the
+// format string of the diagnostic it identifies, so rewording a message means editing its entry,
+// which keeps the code. New diagnostics take the next free code in their phase's range. Codes are
+// never reused.
+
+typedef struct DiagCode {
+    int code;
+    const char *fmt;
+} DiagCode;
+
+DiagCode diag_codes[] = {
+    // Lexer
+    {1001, "Digit '%c' out of range for base %d"},
+    {1002, "Integer literal overflow"},
+    {1003, "Expected base %d digit, got '%c'"},
+    {1004, "Expected digit after float literal exponent, found '%c'."},
+    {1005, "Float literal overflow"},
+    {1006, "\\x needs at least 1 hex digit"},
+    {1007, "\\x argument out of range"},
+    {1008, "Char literal cannot be empty"},
+    {1009, "Char literal cannot contain newline"},
+    {1010, "Invalid char literal escape '\\%c'"},
+    {1011, "Expected closing char quote, got '%c'"},
+    {1012, "Unexpected end of file within multi-line string literal"},
+    {1013, "String literal cannot contain newline"},
+    {1014, "Invalid string literal escape '\\%c'"},
+    {1015, "Unexpected end of file within string literal"},
+    {1016, "Invalid '%c' token, skipping"},
+    {1017, "Expected token %s, got %s"},
+
+    // Parser
+    {2001, "Colons in parameters of func types must be preceded by names."},
+    {2002, "Multiple ellipsis instances in function type"},
+    {2003, "Ellipsis must be last parameter in function type"},
+    {2004, "Unexpected token %s in type"},
+    {2005, "Named initializer in compound literal must be preceded by field name"},
+    {2006, "Unexpected token %s in expression"},
+    {2007, "Expected 'while' after 'do' block"},
+    {2008, ":= must be preceded by a name"},
+    {2009, ": must be preceded by a name"},
+    {2010, "Init statements not allowed in for-statement's next clause"},
+    {2011, "Use comma-separated expressions to match multiple values with one case label"},
+    {2012, "Duplicate default labels in same switch clause"},
+    {2013, "Expected : or = after var, got %s"},
+    {2014, "Multiple ellipsis in function declaration"},
+    {2015, "Ellipsis must be last parameter in function declaration"},
+    {2016, "Left operand of = in note argument must be a name"},
+    {2017, "Only one import assignment is allowed"},
+    {2018, "Expected declaration keyword, got %s"},
+
+    // Resolver
+    {3001, "@foreign takes 0 or 1 argument"},
+    {3002, "@foreign argument 1 must be a string literal"},
+    {3003, "Previous definition of '%s'"},
+    {3004, "Duplicate definition of symbol '%s'."},
+    {3005, "Conflicting import of symbol %s into %s from %s and %s."},
+    {3006, "Cannot use @soa array %s as a pointer"},
+    {3007, "Unresolved package '%s'"},
+    {3008, "%s must denote a package"},
+    {3009, "Unresolved type name '%s'"},
+    {3010, "%s must denote a type"},
+    {3011, "Array size constant expression must have integer type"},
+    {3012, "Non-positive array size"},
+    {3013, "Function parameter type cannot be void"},
+    {3014, "Function return type cannot be array"},
+    {3015, "Tuple element types cannot be void"},
+    {3016, "Type completion cycle: %s"},
+    {3017, "Trying to use incomplete type as complete type"},
+    {3018, "@soa struct cannot have nested aggregates"},
+    {3019, "@soa struct field %s cannot have @soa struct type"},
+    {3020, "No fields"},
+    {3021, "Duplicate fields"},
+    {3022, "@%s cannot be combined with @%s"},
+    {3023, "@%s can only be used on %s"},
+    {3024, "@%s takes %zu argument%s"},
+    {3025, "@align argument must have integer type"},
+    {3026, "@align argument must be a power of two"},
+    {3027, "@align(%lld) is less than the alignment %zu of %s"},
+    {3028, "Field type of size 0 is not allowed"},
+    {3029, "Cannot use undef initializer without declared type"},
+    {3030, "Invalid type in initialization. Expected %s"},
+    {3031, "Cannot declare variable of size 0"},
+    {3032, "Base type of enum must be integer type"},
+    {3033, "Const declarations must have scalar type"},
+    {3034, "Invalid type in constant declaration. Expected %s, got %s"},
+    {3035, "@printf expects a single name parameter."},
+    {3036, "@printf expects the name of the format parameter, %s could not be found."},
+    {3037, "@restrict parameter %s must have pointer type"},
+    {3038, "Function parameter %s must be (:char*) since it's expected to be a printf format string."},
+    {3039, "@pure function must return a value"},
+    {3040, "Integer varargs type must have same or higher rank than int"},
+    {3041, "Floating varargs type must be double, not float"},
+    {3042, "Too many labels"},
+    {3043, "Multiple definitions of label '%s'"},
+    {3044, "Label '%s' referenced but not defined"},
+    {3045, "Label '%s' defined but not referenced"},
+    {3046, "Conditional expression must have scalar type"},
+    {3047, "Cannot assign to non-lvalue"},
+    {3048, "Cannot assign to array"},
+    {3049, "Left-hand side of assignment has non-modifiable type"},
+    {3050, "Invalid operand types for %s"},
+    {3051, "Invalid type in assignment. Expected %s, got %s"},
+    {3052, "Shadowed definition of local symbol"},
+    {3053, "#static_assert takes 1 argument"},
+    {3054, "#static_assert failed"},
+    {3055, "Invalid type in return expression. Expected %s, got %s"},
+    {3056, "Empty return expression for function with non-void return type"},
+    {3057, "Illegal break"},
+    {3058, "Illegal continue"},
+    {3059, "#assert takes 1 argument"},
+    {3060, "Unknown statement #directive '%s'"},
+    {3061, "Switch expression must have integer type"},
+    {3062, "Invalid type in switch case expression. Expected %s, got %s"},
+    {3063, "Case range end value cannot be less thn start value"},
+    {3064, "Switch statement has multiple default clauses"},
+    {3065, "Case blocks already end with an implicit break"},
+    {3066, "Not all control paths return values"},
+    {3067, "Cyclic dependency: %s"},
+    {3068, "Can only access fields on aggregates or pointers to aggregates"},
+    {3069, "No field named '%s' in %s '%s'"},
+    {3070, "Unresolved name '%s'"},
+    {3071, "%s must be a var or const"},
+    {3072, "Cannot use unary %s with %s"},
+    {3073, "Cannot deref non-ptr type"},
+    {3074, "Can only use unary %s with arithmetic types"},
+    {3075, "Can only use ~ with integer types"},
+    {3076, " Can only use ! with scalar types"},
+    {3077, "Vector operands of %s must have the same type, got %s and %s"},
+    {3078, "Operands of %s must be vectors, or a vector and an arithmetic scalar"},
+    {3079, "Operands of %s must be integer vectors"},
+    {3080, "Operator %s cannot be used with vector types"},
+    {3081, "Left operand of %s must have arithmetic type"},
+    {3082, "Right operand of %s must have arithmetic type"},
+    {3083, "Left operand of %% must have integer type"},
+    {3084, "Right operand of %% must have integer type"},
+    {3085, "Cannot do pointer arithmetic with size 0 base type"},
+    {3086, "Operands of + must both have arithmetic type, or pointer and integer type"},
+    {3087, "Cannot subtract pointers to different types"},
+    {3088, "Operands of - must both have arithmetic type, pointer and integer type, or compatible pointer types"},
+    {3089, "Operands of %s must both have integer type"},
+    {3090, "Cannot compare pointers to different types"},
+    {3091, "Operands of %s must be arithmetic types or compatible pointer types"},
+    {3092, "Operands of %s must have arithmetic types"},
+    {3093, "Operands of %s must have scalar types"},
+    {3094, "Implicitly typed compound literals used in context without expected type"},
+    {3095, "Index field initializer not allowed for struct/union compound literal"},
+    {3096, "Named field '%s' in compound literal does not exist"},
+    {3097, "Field initializer in struct/union compound literal out of range"},
+    {3098, "Invalid type in compound literal initializer for aggregate type. Expected %s."},
+    {3099, "@soa array compound literal must have an explicit size"},
+    {3100, "@soa array compound literal must be empty"},
+    {3101, "Named field initializer not allowed for array compound literals"},
+    {3102, "Field initializer index expression must have type int"},
+    {3103, "Invalid type in field initializer index. Expected integer type"},
+    {3104, "Field initializer index cannot be negative"},
+    {3105, "Field initializer in array compound literal out of range"},
+    {3106, "Invalid type in compound literal initializer for array type. Expected %s"},
+    {3107, "Too many initializers in vector compound literal"},
+    {3108, "Designated initializers not allowed for vector compound literals"},
+    {3109, "Invalid type in compound literal initializer for vector type. Expected %s"},
+    {3110, "Anonymous compound literal in context expecting void type"},
+    {3111, "Compound literal where %s is expected"},
+    {3112, "Compound literal for scalar type cannot have more than one operand"},
+    {3113, "Invalid type in compound literal initializer. Expected %s, got %s"},
+    {3114, "Invalid type in function call argument. Expected %s, got %s"},
+    {3115, "Argument 1 of va_arg must be lvalue"},
+    {3116, "Argument 2 of va_arg must be lvalue"},
+    {3117, "Argument 1 of %s must have pointer type"},
+    {3118, "Argument 1 of %s must be lvalue"},
+    {3119, "Argument 1 of %s must have non-void base type"},
+    {3120, "Argument 1 of %s must have aggregate base type with 2 fields"},
+    {3121, "Key type of %s must contain no padding"},
+    {3122, "Argument 2 of %s not convertible to argument 1's key type"},
+    {3123, "Argument 3 of %s not convertible to argument 1's value type"},
+    {3124, "Base type of %s must contain no padding"},
+    {3125, "Argument 2 of %s not convertible to argument 1 base type"},
+    {3126, "Argument 2 of %s not convertible to argument 1's value type"},
+    {3127, "Argument 3 of %s not convertible to usize"},
+    {3128, "Argument 1 of acat must be lvalue"},
+    {3129, "Argument 2 of %s must have pointer type"},
+    {3130, "Argument 2 of %s must have non-void base type"},
+    {3131, "Argument 1 and 2 of acat don't have identical base types"},
+    {3132, "Argument 1 and 2 of acatn don't have identical base types"},
+    {3133, "Argument 3 of acatn not convertible to usize"},
+    {3134, "Argument 1 of %s must have type Allocator*"},
+    {3135, "anew can only be used when its inferred type is array or pointer type"},
+    {3136, "anew base type cannot be incomplete or have size 0"},
+    {3137, "Argument 2 of %s must point to argument 1 base type"},
+    {3138, "Argument %d of %s must have pointer type"},
+    {3139, "Argument %d of %s must point to non-const type"},
+    {3140, "Argument %d of %s must point to integer or pointer type"},
+    {3141, "Argument %d of %s not convertible to argument 1 base type"},
+    {3142, "Argument %d of %s must be a MemoryOrder"},
+    {3143, "Invalid memory order for %s"},
+    {3144, "Memory order not allowed for %s"},
+    {3145, "Argument 2 of %s must have the same type as argument 1"},
+    {3146, "Argument 1 of %s must point to non-bool integer type"},
+    {3147, "%s can only be used when its inferred type is a vector type"},
+    {3148, "Argument %d of %s must have vector type"},
+    {3149, "Argument %d of %s must have type %s"},
+    {3150, "Argument 1 of %s must be a non-const pointer"},
+    {3151, "%s with %s operands takes %zu lane indices"},
+    {3152, "Lane index of %s must have integer type"},
+    {3153, "Lane index of %s out of range"},
+    {3154, "Cannot convert %s to %s with a different number of lanes"},
+    {3155, "Unknown intrinsic '%s'"},
+    {3156, "Type conversion operator takes 1 argument"},
+    {3157, "Invalid type cast from %s to %s"},
+    {3158, "Cannot call non-function value"},
+    {3159, "Function call with too few arguments"},
+    {3160, "Function call with too many arguments"},
+    {3161, "Ternary conditional must have scalar type"},
+    {3162, "Left and right operands of ternary expression must have arithmetic types or identical types"},
+    {3163, "Index must have integer type"},
+    {3164, "Aggregate field index must be an integer constant"},
+    {3165, "Aggregate field index out of range"},
+    {3166, "Vector lane index out of range"},
+    {3167, "@soa array index out of range"},
+    {3168, "Can only index aggregates, arrays and pointers"},
+    {3169, "Cannot modify non-lvalue"},
+    {3170, "Cannot modify non-modifiable type"},
+    {3171, "%s only valid for integer and pointer types"},
+    {3172, "Allocator of new must have type Allocator* or be pointer to struct with leading field of type Allocator"},
+    {3173, "Length argument of new must have integer type"},
+    {3174, "New with void argument must have expected pointer type"},
+    {3175, "Argument to new[] must have pointer type"},
+    {3176, "Argument to new must be lvalue"},
+    {3177, "Type of argument to new has zero size"},
+    {3178, "Cannot take address of non-lvalue"},
+    {3179, "Cannot take address of @soa array element"},
+    {3180, "offsetof can only be used with struct/union types"},
+    {3181, "No field '%s' in type"},
+    {3182, "Expected constant expression"},
+    {3183, "#declare_note takes 1 argument"},
+    {3184, "#declare_note argument must be name"},
+    {3185, "Unknown declaration #directive '%s'"},
+    {3186, "Symbol '%s' does not exist in package '%s'"},
+    {3187, "Import name must be lower case: '%s'"},
+    {3188, "Failed to import package '%s'"},
+    {3189, "Failed to read source file"},
+    {3190, "Failure memory order of %s can't be stronger than its success order"},
+    {3191, "Switch case %s overlaps an earlier case"},
+
+    // Compile-time evaluation
+    {4001, "%s is not supported in compile-time evaluation"},
+    {4002, "Function too large for compile-time evaluation"},
+    {4003, "Out of memory for compile-time evaluation"},
+    {4004, "Cannot evaluate '%s' at compile time from inside its own body"},
+    {4005, "Cannot evaluate '%s' at compile time because it has errors"},
+    {4006, "Invalid memory access during compile-time evaluation"},
+    {4007, "Compile-time evaluation did not finish after %llu steps"},
+    {4008, "Division by zero during compile-time evaluation"},
+    {4009, "Assertion failed during compile-time evaluation"},
+    {4010, "Stack overflow during compile-time evaluation"},
+    {4011, "Compile-time evaluation needs a target with the host's pointer size"},
+    {4012, "Compile-time evaluated initializer cannot contain non-null pointers"},
+    {4013, "Compile-time evaluated initializer cannot contain non-zero unions"},
+    {4014, "Compile-time evaluated initializer must have the variable's type"},
+
+    // C backend
+    {5001, "Call to unimplemented intrinsic %s"},
+    {5002, "#foreign argument must be a string"},
+    {5003, "Unknown #foreign named argument '%s'"},
+
+    // Native backend
+    {6001, "%s is not supported by the native backend (use the C backend)"},
+};
+
+Map diag_code_map;
+
+// Returns 0 for a format string missing from diag_codes.
+int get_diag_code(const char *fmt) {
+    if (!diag_code_map.len) {
+        for (size_t i = 0; i < sizeof(diag_codes)/sizeof(*diag_codes); i++) {
+            map_put(&diag_code_map, str_intern(diag_codes[i].fmt), (void *)(intptr_t)diag_codes[i].code);
+        }
+    }
+    return (int)(intptr_t)map_get(&diag_code_map, str_intern(fmt));
+}
@@ -0,0 +1,1639 @@
+// Compile-time function execution. Calls to ordinary Ion functions inside constant expressions and
+// global variable initializers are compiled on demand to a small register bytecode and run by the
+// interpreter below. Registers hold 64-bit normalized scalars or addresses, aggregates and arrays
+// are represented by their address like in the native backend, and all memory a program can touch
+// lives in one fixed arena so every load and store can be bounds checked. Anything outside the
+// supported subset (floating point, globals, foreign calls, function pointers) is an error.
+
+typedef enum EvalOp {
+    EVAL_MOV,
+    EVAL_CONST,
+    EVAL_FRAME,
+    EVAL_ADD,
+    EVAL_SUB,
+    EVAL_MUL,
+    EVAL_DIVS,
+    EVAL_DIVU,
+    EVAL_MODS,
+    EVAL_MODU,
+    EVAL_AND,
+    EVAL_OR,
+    EVAL_XOR,
+    EVAL_SHL,
+    EVAL_SHRS,
+    EVAL_SHRU,
+    EVAL_EQ,
+    EVAL_NE,
+    EVAL_LTS,
+    EVAL_LTU,
+    EVAL_LES,
+    EVAL_LEU,
+    EVAL_NEG,
+    EVAL_NOT,
+    EVAL_LNOT,
+    EVAL_BOOL,
+    EVAL_SX8,
+    EVAL_SX16,
+    EVAL_SX32,
+    EVAL_ZX8,
+    EVAL_ZX16,
+    EVAL_ZX32,
+    EVAL_LD8S,
+    EVAL_LD8U,
+    EVAL_LD16S,
+    EVAL_LD16U,
+    EVAL_LD32S,
+    EVAL_LD32U,
+    EVAL_LD64,
+    EVAL_ST8,
+    EVAL_ST16,
+    EVAL_ST32,
+    EVAL_ST64,
+    EVAL_COPY,
+    EVAL_ZERO,
+    EVAL_JMP,
+    EVAL_JZ,
+    EVAL_JNZ,
+    EVAL_CALL,
+    EVAL_RET,
+    EVAL_TRAP,
+} EvalOp;
+
+// Three-address instruction. Operands are register numbers except where an op takes a constant
+// pool index (CONST, FRAME, COPY, ZERO) or a jump target, which is split across b and c.
+typedef struct EvalInstr {
+    uint16_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+} EvalInstr;
+
+typedef struct EvalFunc {
+    Sym *sym;
+    bool compiled;
+    EvalInstr *code;
+    SrcPos *code_pos;
+    int64_t *consts;
+    size_t num_regs;
+    size_t frame_size;
+} EvalFunc;
+
+typedef struct EvalLocal {
+    const char *name;
+    Type *type;
+    bool in_memory;
+    uint32_t loc;
+} EvalLocal;
+
+typedef struct EvalFixup {
+    size_t at;
+    int label;
+} EvalFixup;
+
+typedef struct EvalGotoLabel {
+    const char *name;
+    int label;
+} EvalGotoLabel;
+
+enum {
+    EVAL_MAX_REGS = UINT16_MAX,
+    EVAL_MEM_SIZE = 64 * 1024 * 1024,
+    EVAL_REG_STACK_SIZE = 1024 * 1024,
+    EVAL_MAX_CALL_DEPTH = 10000,
+};
+
+#define EVAL_MAX_STEPS (1ull << 28)
+
+Map eval_func_map;
+EvalFunc **eval_funcs;
+Map eval_init_map;
+
+// Compiler state for the function being compiled.
+EvalFunc *eval_func;
+EvalLocal *eval_locals;
+size_t eval_num_regs;
+size_t *eval_labels;
+EvalFixup *eval_fixups;
+EvalGotoLabel *eval_goto_labels;
+int eval_break_label = -1;
+int eval_continue_label = -1;
+Type *eval_ret_type;
+uint16_t eval_ret_ptr_reg;
+const char **eval_addr_taken;
+bool eval_recompile;
+
+// Interpreter state. The arena holds call frames growing up from the bottom and string literals
+// growing down from the top.
+uint8_t *eval_mem;
+size_t eval_mem_used;
+size_t eval_mem_static = EVAL_MEM_SIZE;
+Map eval_str_map;
+int64_t *eval_reg_stack;
+int64_t *eval_reg_top;
+int eval_call_depth;
+uint64_t eval_steps;
+
+NORETURN void fatal_eval_unsupported(SrcPos pos, const char *what) {
+    fatal_error(pos, "%s is not supported in compile-time evaluation", what);
+}
+
+long long eval_normalize_const(long long val, Type *type) {
+    type = unqualify_type(type);
+    if (type->kind == TYPE_ENUM) {
+        type = unqualify_type(type->base);
+    }
+    if (type->kind == TYPE_BOOL) {
+        return val != 0;
+    }
+    if (!is_integer_type(type) || type_sizeof(type) == 8) {
+        return val;
+    }
+    int bits = (int)type_sizeof(type) * 8;
+    unsigned long long mask = (1ull << bits) - 1;
+    unsigned long long u = (unsigned long long)val & mask;
+    if (is_signed_type(type) && (u >> (bits - 1))) {
+        u |= ~mask;
+    }
+    return (long long)u;
+}
+
+Type *eval_scalar_type(Type *type) {
+    type = unqualify_type(type);
+    if (type->kind == TYPE_ENUM) {
+        type = unqualify_type(type->base);
+    }
+    return type;
+}
+
+bool is_eval_memory_type(Type *type) {
+    type = unqualify_type(type);
+    return is_aggregate_type(type) || type->kind == TYPE_ARRAY;
+}
+
+Type *eval_expr_type(Expr *expr) {
+    Type *type = get_resolved_type(expr);
+    assert(type);
+    return type;
+}
+
+size_t eval_alignof(Type *type) {
+    type = unqualify_type(type);
+    while (type->kind == TYPE_ARRAY && !type->align) {
+        type = unqualify_type(type->base);
+    }
+    return CLAMP_MIN(type_alignof(type), 1);
+}
+
+size_t eval_elem_size(Type *ptr_type) {
+    Type *base = unqualify_type(ptr_type->base);
+    return base->kind == TYPE_VOID ? 1 : type_sizeof(base);
+}
+
+EvalFunc *get_eval_func(Sym *sym, uint16_t *index) {
+    uint64_t entry = map_get_uint64(&eval_func_map, sym);
+    if (!entry) {
+        EvalFunc *func = xcalloc(1, sizeof(EvalFunc));
+        func->sym = sym;
+        buf_push(eval_funcs, func);
+        entry = buf_len(eval_funcs);
+        map_put_uint64(&eval_func_map, sym, entry);
+    }
+    if (index) {
+        *index = (uint16_t)(entry - 1);
+    }
+    return eval_funcs[entry - 1];
+}
+
+// Code emission
+
+size_t eval_pos(void) {
+    return buf_len(eval_func->code);
+}
+
+void eval_emit(SrcPos pos, EvalOp op, size_t a, size_t b, size_t c) {
+    buf_push(eval_func->code, (EvalInstr){(uint16_t)op, (uint16_t)a, (uint16_t)b, (uint16_t)c});
+    buf_push(eval_func->code_pos, pos);
+}
+
+uint16_t eval_new_reg(SrcPos pos) {
+    if (eval_num_regs == EVAL_MAX_REGS) {
+        fatal_error(pos, "Function too large for compile-time evaluation");
+    }
+    eval_func->num_regs = MAX(eval_func->num_regs, eval_num_regs + 1);
+    return (uint16_t)eval_num_regs++;
+}
+
+uint16_t eval_add_const(SrcPos pos, int64_t val) {
+    for (size_t i = 0; i < buf_len(eval_func->consts); i++) {
+        if (eval_func->consts[i] == val) {
+            return (uint16_t)i;
+        }
+    }
+    if (buf_len(eval_func->consts) == UINT16_MAX) {
+        fatal_error(pos, "Function too large for compile-time evaluation");
+    }
+    buf_push(eval_func->consts, val);
+    return (uint16_t)(buf_len(eval_func->consts) - 1);
+}
+
+uint16_t eval_const(SrcPos pos, int64_t val) {
+    uint16_t reg = eval_new_reg(pos);
+    eval_emit(pos, EVAL_CONST, reg, eval_add_const(pos, val), 0);
+    return reg;
+}
+
+uint16_t eval_op(SrcPos pos, EvalOp op, uint16_t left, uint16_t right) {
+    uint16_t reg = eval_new_reg(pos);
+    eval_emit(pos, op, reg, left, right);
+    return reg;
+}
+
+uint32_t eval_alloc_frame(size_t size, size_t align) {
+    if (align > 16) {
+        align = 16;
+    }
+    eval_func->frame_size = ALIGN_UP(eval_func->frame_size, align);
+    uint32_t offset = (uint32_t)eval_func->frame_size;
+    eval_func->frame_size += size;
+    return offset;
+}
+
+uint16_t eval_frame_addr(SrcPos pos, uint32_t offset) {
+    uint16_t reg = eval_new_reg(pos);
+    eval_emit(pos, EVAL_FRAME, reg, eval_add_const(pos, offset), 0);
+    return reg;
+}
+
+int eval_new_label(void) {
+    buf_push(eval_labels, SIZE_MAX);
+    return (int)buf_len(eval_labels) - 1;
+}
+
+void eval_bind_label(int label) {
+    eval_labels[label] = eval_pos();
+}
+
+void eval_jump(SrcPos pos, EvalOp op, uint16_t cond, int label) {
+    buf_push(eval_fixups, (EvalFixup){eval_pos(), label});
+    eval_emit(pos, op, cond, 0, 0);
+}
+
+void eval_resolve_fixups(void) {
+    for (EvalFixup *it = eval_fixups; it != buf_end(eval_fixups); it++) {
+        size_t target = eval_labels[it->label];
+        assert(target != SIZE_MAX);
+        eval_func->code[it->at].b = (uint16_t)target;
+        eval_func->code[it->at].c = (uint16_t)(target >> 16);
+    }
+}
+
+uint16_t eval_normalize(SrcPos pos, uint16_t reg, Type *type) {
+    type = eval_scalar_type(type);
+    if (type->kind == TYPE_BOOL) {
+        return eval_op(pos, EVAL_BOOL, reg, 0);
+    }
+    if (!is_integer_type(type)) {
+        return reg;
+    }
+    bool sign = is_signed_type(type);
+    switch (type_sizeof(type)) {
+    case 1:
+        return eval_op(pos, sign ? EVAL_SX8 : EVAL_ZX8, reg, 0);
+    case 2:
+        return eval_op(pos, sign ? EVAL_SX16 : EVAL_ZX16, reg, 0);
+    case 4:
+        return eval_op(pos, sign ? EVAL_SX32 : EVAL_ZX32, reg, 0);
+    default:
+        return reg;
+    }
+}
+
+uint16_t eval_convert(SrcPos pos, uint16_t reg, Type *from, Type *to) {
+    from = eval_scalar_type(from);
+    to = eval_scalar_type(to);
+    if (from == to) {
+        return reg;
+    }
+    return eval_normalize(pos, reg, to);
+}
+
+uint16_t eval_load(SrcPos pos, uint16_t addr, Type *type) {
+    if (is_eval_memory_type(type)) {
+        return addr;
+    }
+    type = eval_scalar_type(type);
+    bool sign = is_signed_type(type);
+    EvalOp op;
+    switch (type_sizeof(type)) {
+    case 1:
+        op = sign ? EVAL_LD8S : EVAL_LD8U;
+        break;
+    case 2:
+        op = sign ? EVAL_LD16S : EVAL_LD16U;
+        break;
+    case 4:
+        op = sign ? EVAL_LD32S : EVAL_LD32U;
+        break;
+    default:
+        op = EVAL_LD64;
+        break;
+    }
+    return eval_op(pos, op, addr, 0);
+}
+
+// Stores val to addr. For aggregates and arrays val holds the source address.
+void eval_store(SrcPos pos, uint16_t addr, uint16_t val, Type *type) {
+    if (is_eval_memory_type(type)) {
+        eval_emit(pos, EVAL_COPY, addr, val, eval_add_const(pos, type_sizeof(type)));
+        return;
+    }
+    EvalOp op;
+    switch (type_sizeof(eval_scalar_type(type))) {
+    case 1:
+        op = EVAL_ST8;
+        break;
+    case 2:
+        op = EVAL_ST16;
+        break;
+    case 4:
+        op = EVAL_ST32;
+        break;
+    default:
+        op = EVAL_ST64;
+        break;
+    }
+    eval_emit(pos, op, addr, val, 0);
+}
+
+uint16_t eval_str_addr(SrcPos pos, const char *str) {
+    uint64_t addr = map_get_uint64(&eval_str_map, (void *)str);
+    if (!addr) {
+        size_t len = strlen(str) + 1;
+        if (eval_mem_static < len + eval_mem_used) {
+            fatal_error(pos, "Out of memory for compile-time evaluation");
+        }
+        eval_mem_static -= len;
+        memcpy(eval_mem + eval_mem_static, str, len);
+        addr = (uint64_t)(uintptr_t)(eval_mem + eval_mem_static);
+        map_put_uint64(&eval_str_map, (void *)str, addr);
+    }
+    return eval_const(pos, (int64_t)addr);
+}
+
+// Locals
+
+void eval_push_local(const char *name, Type *type, bool in_memory, uint32_t loc) {
+    buf_push(eval_locals, (EvalLocal){name, type, in_memory, loc});
+}
+
+EvalLocal *eval_get_local(const char *name) {
+    for (EvalLocal *it = buf_end(eval_locals); it != eval_locals; it--) {
+        if (it[-1].name == name) {
+            return it - 1;
+        }
+    }
+    return NULL;
+}
+
+bool is_eval_addr_taken(const char *name) {
+    for (const char **it = eval_addr_taken; it != buf_end(eval_addr_taken); it++) {
+        if (*it == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Scalars live in registers unless their address is taken somewhere in the function, in which case
+// the function is compiled again with them in the frame.
+EvalLocal *eval_new_local(SrcPos pos, const char *name, Type *type) {
+    if (is_eval_memory_type(type) || is_eval_addr_taken(name)) {
+        eval_push_local(name, type, true, eval_alloc_frame(type_sizeof(type), eval_alignof(type)));
+    } else {
+        eval_push_local(name, type, false, eval_new_reg(pos));
+    }
+    return &eval_locals[buf_len(eval_locals) - 1];
+}
+
+// Expressions
+
+uint16_t eval_expr(Expr *expr);
+uint16_t eval_addr(Expr *expr);
+void eval_stmt(Stmt *stmt);
+void eval_init_at(Type *type, Expr *init, uint16_t addr);
+
+long long eval_const_val(Expr *expr) {
+    assert(is_resolved_const(expr));
+    return get_resolved_val(expr).ll;
+}
+
+uint16_t eval_add_offset(SrcPos pos, uint16_t addr, size_t offset) {
+    if (!offset) {
+        return addr;
+    }
+    return eval_op(pos, EVAL_ADD, addr, eval_const(pos, (int64_t)offset));
+}
+
+void eval_compound_fields(Expr *expr, Type *type, uint16_t addr) {
+    type = unqualify_type(type);
+    if (is_aggregate_type(type)) {
+        int index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_NAME) {
+                index = aggregate_item_field_index(type, field.name);
+            }
+            TypeField type_field = type->aggregate.fields[index];
+            size_t mark = eval_num_regs;
+            eval_init_at(type_field.type, field.init, eval_add_offset(field.init->pos, addr, type_field.offset));
+            eval_num_regs = mark;
+            index++;
+        }
+    } else if (type->kind == TYPE_ARRAY) {
+        size_t index = 0;
+        size_t elem_size = type_sizeof(type->base);
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_INDEX) {
+                index = (size_t)eval_const_val(field.index);
+            }
+            size_t mark = eval_num_regs;
+            eval_init_at(type->base, field.init, eval_add_offset(field.init->pos, addr, index * elem_size));
+            eval_num_regs = mark;
+            index++;
+        }
+    } else {
+        fatal_eval_unsupported(expr->pos, "Compound literal of this type");
+    }
+}
+
+void eval_init_at(Type *type, Expr *init, uint16_t addr) {
+    if (init->kind == EXPR_COMPOUND && is_eval_memory_type(eval_expr_type(init))) {
+        eval_compound_fields(init, eval_expr_type(init), addr);
+        return;
+    }
+    uint16_t val = eval_expr(init);
+    if (is_eval_memory_type(type)) {
+        size_t size = type_sizeof(type);
+        if (init->kind == EXPR_STR) {
+            size = MIN(size, strlen(init->str_lit.val) + 1);
+        }
+        eval_emit(init->pos, EVAL_COPY, addr, val, eval_add_const(init->pos, size));
+    } else {
+        val = eval_convert(init->pos, val, type_decay(eval_expr_type(init)), type);
+        eval_store(init->pos, addr, val, type);
+    }
+}
+
+uint16_t eval_compound(Expr *expr) {
+    Type *type = unqualify_type(eval_expr_type(expr));
+    if (!is_eval_memory_type(type)) {
+        if (expr->compound.num_fields == 0) {
+            return eval_const(expr->pos, 0);
+        }
+        Expr *init = expr->compound.fields[0].init;
+        return eval_convert(expr->pos, eval_expr(init), type_decay(eval_expr_type(init)), type);
+    }
+    uint32_t offset = eval_alloc_frame(type_sizeof(type), eval_alignof(type));
+    uint16_t addr = eval_frame_addr(expr->pos, offset);
+    eval_emit(expr->pos, EVAL_ZERO, addr, eval_add_const(expr->pos, type_sizeof(type)), 0);
+    eval_compound_fields(expr, type, addr);
+    return addr;
+}
+
+uint16_t eval_name_addr(SrcPos pos, const char *name, Sym *sym) {
+    if (sym) {
+        if (sym->kind == SYM_VAR) {
+            fatal_eval_unsupported(pos, "Global variable access");
+        }
+        fatal_eval_unsupported(pos, "Address of this symbol");
+    }
+    EvalLocal *local = eval_get_local(name);
+    assert(local);
+    if (!local->in_memory) {
+        buf_push(eval_addr_taken, name);
+        eval_recompile = true;
+        return eval_const(pos, 0);
+    }
+    return eval_frame_addr(pos, local->loc);
+}
+
+uint16_t eval_field_addr(Expr *expr) {
+    Type *type = unqualify_type(eval_expr_type(expr->field.expr));
+    uint16_t addr;
+    if (type->kind == TYPE_PTR) {
+        addr = eval_expr(expr->field.expr);
+        type = unqualify_type(type->base);
+    } else {
+        addr = eval_addr(expr->field.expr);
+    }
+    int index = aggregate_item_field_index(type, expr->field.name);
+    assert(index >= 0);
+    return eval_add_offset(expr->pos, addr, type->aggregate.fields[index].offset);
+}
+
+uint16_t eval_index_addr(Expr *expr) {
+    Type *type = unqualify_type(eval_expr_type(expr->index.expr));
+    if (is_soa_array_type(type)) {
+        fatal_eval_unsupported(expr->pos, "@soa array indexing");
+    }
+    if (is_aggregate_type(type)) {
+        long long index = eval_const_val(expr->index.index);
+        return eval_add_offset(expr->pos, eval_addr(expr->index.expr), type->aggregate.fields[index].offset);
+    }
+    uint16_t base = eval_expr(expr->index.expr);
+    uint16_t index = eval_expr(expr->index.index);
+    size_t elem_size = type_sizeof(type->base);
+    if (elem_size != 1) {
+        index = eval_op(expr->pos, EVAL_MUL, index, eval_const(expr->pos, (int64_t)elem_size));
+    }
+    return eval_op(expr->pos, EVAL_ADD, base, index);
+}
+
+uint16_t eval_addr(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        return eval_addr(expr->paren.expr);
+    case EXPR_NAME:
+        return eval_name_addr(expr->pos, expr->name, get_resolved_sym(expr));
+    case EXPR_FIELD: {
+        Sym *sym = get_resolved_sym(expr);
+        if (sym) {
+            return eval_name_addr(expr->pos, sym->name, sym);
+        }
+        return eval_field_addr(expr);
+    }
+    case EXPR_INDEX:
+        return eval_index_addr(expr);
+    case EXPR_UNARY:
+        if (expr->unary.op != TOKEN_MUL) {
+            fatal_eval_unsupported(expr->pos, "Address of this expression");
+        }
+        return eval_expr(expr->unary.expr);
+    case EXPR_COMPOUND:
+        return eval_compound(expr);
+    case EXPR_STR:
+        return eval_str_addr(expr->pos, expr->str_lit.val);
+    default:
+        fatal_eval_unsupported(expr->pos, "Address of this expression");
+        return 0;
+    }
+}
+
+bool is_eval_func_sym(Sym *sym) {
+    return sym && sym->kind == SYM_FUNC && sym->decl && !is_decl_foreign(sym->decl) && !sym->decl->is_incomplete && !is_intrinsic(sym);
+}
+
+uint16_t eval_call(Expr *expr) {
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    if (sym && sym->kind == SYM_TYPE) {
+        Expr *arg = expr->call.args[0];
+        return eval_convert(expr->pos, eval_expr(arg), type_decay(eval_expr_type(arg)), sym->type);
+    }
+    if (!sym || sym->kind != SYM_FUNC) {
+        fatal_eval_unsupported(expr->pos, "Indirect call");
+    }
+    if (is_intrinsic(sym)) {
+        fatal_eval_unsupported(expr->pos, "Intrinsic call");
+    }
+    if (!is_eval_func_sym(sym)) {
+        fatal_eval_unsupported(expr->pos, "Foreign function call");
+    }
+    Type *func_type = sym->type;
+    if (func_type->func.has_varargs) {
+        fatal_eval_unsupported(expr->pos, "Varargs call");
+    }
+    uint16_t func_index;
+    get_eval_func(sym, &func_index);
+    size_t num_args = expr->call.num_args;
+    bool ret_memory = is_eval_memory_type(func_type->func.ret);
+    uint16_t base = eval_new_reg(expr->pos);
+    for (size_t i = 1; i < num_args + ret_memory; i++) {
+        eval_new_reg(expr->pos);
+    }
+    for (size_t i = 0; i < num_args; i++) {
+        Expr *arg = expr->call.args[i];
+        Type *param_type = type_decay(func_type->func.params[i]);
+        size_t mark = eval_num_regs;
+        uint16_t val = eval_convert(arg->pos, eval_expr(arg), type_decay(eval_expr_type(arg)), param_type);
+        eval_emit(arg->pos, EVAL_MOV, base + i, val, 0);
+        eval_num_regs = mark;
+    }
+    if (ret_memory) {
+        Type *ret_type = func_type->func.ret;
+        uint32_t offset = eval_alloc_frame(type_sizeof(ret_type), eval_alignof(ret_type));
+        size_t mark = eval_num_regs;
+        eval_emit(expr->pos, EVAL_MOV, base + num_args, eval_frame_addr(expr->pos, offset), 0);
+        eval_num_regs = mark;
+    }
+    eval_emit(expr->pos, EVAL_CALL, base, func_index, 0);
+    eval_num_regs = base + 1;
+    return base;
+}
+
+EvalOp eval_binary_opcode(TokenKind op, bool sign) {
+    switch (op) {
+    case TOKEN_ADD: return EVAL_ADD;
+    case TOKEN_SUB: return EVAL_SUB;
+    case TOKEN_MUL: return EVAL_MUL;
+    case TOKEN_DIV: return sign ? EVAL_DIVS : EVAL_DIVU;
+    case TOKEN_MOD: return sign ? EVAL_MODS : EVAL_MODU;
+    case TOKEN_AND: return EVAL_AND;
+    case TOKEN_OR: return EVAL_OR;
+    case TOKEN_XOR: return EVAL_XOR;
+    case TOKEN_LSHIFT: return EVAL_SHL;
+    case TOKEN_RSHIFT: return sign ? EVAL_SHRS : EVAL_SHRU;
+    case TOKEN_EQ: return EVAL_EQ;
+    case TOKEN_NOTEQ: return EVAL_NE;
+    case TOKEN_LT: case TOKEN_GT: return sign ? EVAL_LTS : EVAL_LTU;
+    case TOKEN_LTEQ: case TOKEN_GTEQ: return sign ? EVAL_LES : EVAL_LEU;
+    default:
+        assert(0);
+        return EVAL_ADD;
+    }
+}
+
+uint16_t eval_binary_regs(SrcPos pos, TokenKind op, Type *type, uint16_t left, uint16_t right) {
+    EvalOp eval_op_kind = eval_binary_opcode(op, is_signed_type(eval_scalar_type(type)));
+    // Greater-than comparisons are less-than comparisons with the operands swapped.
+    if (op == TOKEN_GT || op == TOKEN_GTEQ) {
+        return eval_op(pos, eval_op_kind, right, left);
+    }
+    return eval_op(pos, eval_op_kind, left, right);
+}
+
+// Same operation types as the native backend: shifts use the promoted left operand, everything else
+// the usual arithmetic conversions, and pointers compare as unsigned addresses.
+Type *eval_binary_type(TokenKind op, Type *left, Type *right) {
+    left = type_decay(left);
+    right = type_decay(right);
+    if (is_ptr_like_type(left) || is_ptr_like_type(right)) {
+        return type_uintptr;
+    }
+    if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) {
+        Operand operand = operand_rvalue(eval_scalar_type(left));
+        promote_operand(&operand);
+        return operand.type;
+    }
+    Operand left_operand = operand_rvalue(eval_scalar_type(left));
+    Operand right_operand = operand_rvalue(eval_scalar_type(right));
+    unify_arithmetic_operands(&left_operand, &right_operand);
+    return left_operand.type;
+}
+
+Type *eval_pointer_type(Expr *expr) {
+    Type *promo = pointer_promo_type(expr);
+    return promo ? promo : type_decay(eval_expr_type(expr));
+}
+
+uint16_t eval_logical(Expr *expr) {
+    bool is_and = expr->binary.op == TOKEN_AND_AND;
+    uint16_t result = eval_new_reg(expr->pos);
+    int end_label = eval_new_label();
+    eval_emit(expr->pos, EVAL_CONST, result, eval_add_const(expr->pos, is_and ? 0 : 1), 0);
+    uint16_t left = eval_expr(expr->binary.left);
+    eval_jump(expr->pos, is_and ? EVAL_JZ : EVAL_JNZ, left, end_label);
+    uint16_t right = eval_expr(expr->binary.right);
+    eval_emit(expr->pos, EVAL_BOOL, result, right, 0);
+    eval_bind_label(end_label);
+    eval_num_regs = result + 1;
+    return result;
+}
+
+uint16_t eval_binary(Expr *expr) {
+    TokenKind op = expr->binary.op;
+    if (op == TOKEN_AND_AND || op == TOKEN_OR_OR) {
+        return eval_logical(expr);
+    }
+    SrcPos pos = expr->pos;
+    Expr *left = expr->binary.left;
+    Expr *right = expr->binary.right;
+    Type *left_type = eval_pointer_type(left);
+    Type *right_type = eval_pointer_type(right);
+    if ((op == TOKEN_ADD || op == TOKEN_SUB) && (is_ptr_type(left_type) || is_ptr_type(right_type))) {
+        bool both_ptrs = is_ptr_type(left_type) && is_ptr_type(right_type);
+        bool ptr_right = !is_ptr_type(left_type);
+        size_t elem_size = eval_elem_size(ptr_right ? right_type : left_type);
+        uint16_t left_reg = eval_expr(left);
+        uint16_t right_reg = eval_expr(right);
+        if (!both_ptrs && elem_size != 1) {
+            uint16_t size_reg = eval_const(pos, (int64_t)elem_size);
+            if (ptr_right) {
+                left_reg = eval_op(pos, EVAL_MUL, left_reg, size_reg);
+            } else {
+                right_reg = eval_op(pos, EVAL_MUL, right_reg, size_reg);
+            }
+        }
+        uint16_t result = eval_op(pos, op == TOKEN_ADD ? EVAL_ADD : EVAL_SUB, left_reg, right_reg);
+        if (both_ptrs && elem_size != 1) {
+            result = eval_op(pos, EVAL_DIVS, result, eval_const(pos, (int64_t)elem_size));
+        }
+        return result;
+    }
+    Type *type = eval_binary_type(op, left_type, right_type);
+    uint16_t left_reg = eval_convert(pos, eval_expr(left), left_type, type);
+    uint16_t right_reg = eval_expr(right);
+    if (op != TOKEN_LSHIFT && op != TOKEN_RSHIFT) {
+        right_reg = eval_convert(pos, right_reg, right_type, type);
+    }
+    uint16_t result = eval_binary_regs(pos, op, type, left_reg, right_reg);
+    if (TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP) {
+        return result;
+    }
+    return eval_normalize(pos, result, eval_expr_type(expr));
+}
+
+uint16_t eval_unary(Expr *expr) {
+    Expr *operand = expr->unary.expr;
+    Type *type = eval_expr_type(expr);
+    SrcPos pos = expr->pos;
+    switch (expr->unary.op) {
+    case TOKEN_AND:
+        return eval_addr(operand);
+    case TOKEN_MUL:
+        return eval_load(pos, eval_expr(operand), type);
+    case TOKEN_ADD:
+        return eval_convert(pos, eval_expr(operand), type_decay(eval_expr_type(operand)), type);
+    case TOKEN_SUB: {
+        uint16_t val = eval_convert(pos, eval_expr(operand), type_decay(eval_expr_type(operand)), type);
+        return eval_normalize(pos, eval_op(pos, EVAL_NEG, val, 0), type);
+    }
+    case TOKEN_NEG: {
+        uint16_t val = eval_convert(pos, eval_expr(operand), type_decay(eval_expr_type(operand)), type);
+        return eval_normalize(pos, eval_op(pos, EVAL_NOT, val, 0), type);
+    }
+    case TOKEN_NOT:
+        return eval_op(pos, EVAL_LNOT, eval_expr(operand), 0);
+    default:
+        assert(0);
+        return 0;
+    }
+}
+
+uint16_t eval_modify(Expr *expr) {
+    SrcPos pos = expr->pos;
+    Type *type = unqualify_type(eval_expr_type(expr->modify.expr));
+    int64_t delta = is_ptr_type(type) ? (int64_t)eval_elem_size(type) : 1;
+    uint16_t delta_reg = eval_const(pos, expr->modify.op == TOKEN_INC ? delta : -delta);
+    Expr *target = expr->modify.expr;
+    while (target->kind == EXPR_PAREN) {
+        target = target->paren.expr;
+    }
+    EvalLocal *local = target->kind == EXPR_NAME && !get_resolved_sym(target) ? eval_get_local(target->name) : NULL;
+    if (local && !local->in_memory) {
+        uint16_t old_val = eval_op(pos, EVAL_MOV, (uint16_t)local->loc, 0);
+        uint16_t new_val = eval_normalize(pos, eval_op(pos, EVAL_ADD, old_val, delta_reg), type);
+        eval_emit(pos, EVAL_MOV, local->loc, new_val, 0);
+        return expr->modify.post ? old_val : new_val;
+    }
+    uint16_t addr = eval_addr(target);
+    uint16_t old_val = eval_load(pos, addr, type);
+    uint16_t new_val = eval_normalize(pos, eval_op(pos, EVAL_ADD, old_val, delta_reg), type);
+    eval_store(pos, addr, new_val, type);
+    return expr->modify.post ? old_val : new_val;
+}
+
+uint16_t eval_ternary(Expr *expr) {
+    Type *type = eval_expr_type(expr);
+    uint16_t result = eval_new_reg(expr->pos);
+    int else_label = eval_new_label();
+    int end_label = eval_new_label();
+    eval_jump(expr->pos, EVAL_JZ, eval_expr(expr->ternary.cond), else_label);
+    Expr *then_expr = expr->ternary.then_expr;
+    eval_emit(expr->pos, EVAL_MOV, result, eval_convert(expr->pos, eval_expr(then_expr), type_decay(eval_expr_type(then_expr)), type), 0);
+    eval_jump(expr->pos, EVAL_JMP, 0, end_label);
+    eval_bind_label(else_label);
+    Expr *else_expr = expr->ternary.else_expr;
+    eval_emit(expr->pos, EVAL_MOV, result, eval_convert(expr->pos, eval_expr(else_expr), type_decay(eval_expr_type(else_expr)), type), 0);
+    eval_bind_label(end_label);
+    eval_num_regs = result + 1;
+    return result;
+}
+
+uint16_t eval_name(SrcPos pos, const char *name, Sym *sym) {
+    if (sym) {
+        if (sym->kind == SYM_FUNC) {
+            fatal_eval_unsupported(pos, "Function pointer");
+        }
+        return eval_name_addr(pos, name, sym);
+    }
+    EvalLocal *local = eval_get_local(name);
+    assert(local);
+    if (!local->in_memory) {
+        return (uint16_t)local->loc;
+    }
+    return eval_load(pos, eval_frame_addr(pos, local->loc), local->type);
+}
+
+uint16_t eval_expr(Expr *expr) {
+    Type *type = eval_expr_type(expr);
+    if (is_implicit_any(expr)) {
+        fatal_eval_unsupported(expr->pos, "Conversion to any");
+    }
+    if (is_floating_type(unqualify_type(type))) {
+        fatal_eval_unsupported(expr->pos, "Floating point");
+    }
+    if (is_vector_type(unqualify_type(type))) {
+        fatal_eval_unsupported(expr->pos, "Vector type");
+    }
+    if (is_resolved_const(expr)) {
+        return eval_const(expr->pos, eval_normalize_const(eval_const_val(expr), type));
+    }
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        return eval_expr(expr->paren.expr);
+    case EXPR_STR:
+        return eval_str_addr(expr->pos, expr->str_lit.val);
+    case EXPR_NAME:
+        return eval_name(expr->pos, expr->name, get_resolved_sym(expr));
+    case EXPR_CAST:
+        return eval_convert(expr->pos, eval_expr(expr->cast.expr), type_decay(eval_expr_type(expr->cast.expr)), type);
+    case EXPR_CALL:
+        return eval_call(expr);
+    case EXPR_INDEX:
+        return eval_load(expr->pos, eval_index_addr(expr), type);
+    case EXPR_FIELD: {
+        Sym *sym = get_resolved_sym(expr);
+        if (sym) {
+            return eval_name(expr->pos, sym->name, sym);
+        }
+        return eval_load(expr->pos, eval_field_addr(expr), type);
+    }
+    case EXPR_COMPOUND:
+        return eval_compound(expr);
+    case EXPR_UNARY:
+        return eval_unary(expr);
+    case EXPR_BINARY:
+        return eval_binary(expr);
+    case EXPR_TERNARY:
+        return eval_ternary(expr);
+    case EXPR_MODIFY:
+        return eval_modify(expr);
+    case EXPR_NEW:
+        fatal_eval_unsupported(expr->pos, "new");
+        return 0;
+    default:
+        fatal_eval_unsupported(expr->pos, "This expression");
+        return 0;
+    }
+}
+
+// Statements
+
+void eval_stmt_block(StmtList block) {
+    size_t num_locals = buf_len(eval_locals);
+    size_t mark = eval_num_regs;
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        eval_stmt(block.stmts[i]);
+    }
+    if (eval_locals) {
+        buf__hdr(eval_locals)->len = num_locals;
+    }
+    eval_num_regs = mark;
+}
+
+void eval_stmt_init(Stmt *stmt) {
+    Type *type = get_resolved_type(stmt);
+    Expr *expr = stmt->init.expr;
+    EvalLocal local = *eval_new_local(stmt->pos, stmt->init.name, type);
+    // The local is pushed before its initializer is compiled, so hide it until the end.
+    buf__hdr(eval_locals)->len--;
+    size_t mark = eval_num_regs;
+    if (!local.in_memory) {
+        if (expr && !stmt->init.is_undef) {
+            uint16_t val = eval_convert(stmt->pos, eval_expr(expr), type_decay(eval_expr_type(expr)), type);
+            eval_emit(stmt->pos, EVAL_MOV, local.loc, val, 0);
+        } else {
+            eval_emit(stmt->pos, EVAL_CONST, local.loc, eval_add_const(stmt->pos, 0), 0);
+        }
+    } else if (!stmt->init.is_undef) {
+        uint16_t addr = eval_frame_addr(stmt->pos, local.loc);
+        if (!expr || (is_eval_memory_type(type) && (expr->kind == EXPR_STR || expr->kind == EXPR_COMPOUND))) {
+            eval_emit(stmt->pos, EVAL_ZERO, addr, eval_add_const(stmt->pos, type_sizeof(type)), 0);
+        }
+        if (expr) {
+            eval_init_at(type, expr, addr);
+        }
+    }
+    eval_num_regs = mark;
+    buf_push(eval_locals, local);
+}
+
+void eval_stmt_assign(Stmt *stmt) {
+    SrcPos pos = stmt->pos;
+    Expr *left = stmt->assign.left;
+    Expr *right = stmt->assign.right;
+    Type *left_type = unqualify_type(eval_expr_type(left));
+    Type *right_type = type_decay(eval_expr_type(right));
+    Expr *target = left;
+    while (target->kind == EXPR_PAREN) {
+        target = target->paren.expr;
+    }
+    EvalLocal *local = target->kind == EXPR_NAME && !get_resolved_sym(target) ? eval_get_local(target->name) : NULL;
+    bool in_reg = local && !local->in_memory;
+    uint16_t addr = in_reg ? 0 : eval_addr(left);
+    uint16_t val;
+    if (stmt->assign.op == TOKEN_ASSIGN) {
+        val = eval_expr(right);
+        if (!is_eval_memory_type(left_type)) {
+            val = eval_convert(pos, val, right_type, left_type);
+        }
+    } else {
+        TokenKind op = assign_token_to_binary_token[stmt->assign.op];
+        uint16_t old_val = in_reg ? (uint16_t)local->loc : eval_load(pos, addr, left_type);
+        Type *ptr_type = pointer_promo_type(left);
+        if (!ptr_type && is_ptr_type(left_type)) {
+            ptr_type = left_type;
+        }
+        Type *type = ptr_type ? type_uintptr : eval_binary_type(op, left_type, right_type);
+        uint16_t right_reg = eval_expr(right);
+        if (ptr_type) {
+            size_t elem_size = eval_elem_size(ptr_type);
+            if (elem_size != 1) {
+                right_reg = eval_op(pos, EVAL_MUL, right_reg, eval_const(pos, (int64_t)elem_size));
+            }
+        } else if (op != TOKEN_LSHIFT && op != TOKEN_RSHIFT) {
+            right_reg = eval_convert(pos, right_reg, right_type, type);
+        }
+        val = eval_binary_regs(pos, op, type, eval_convert(pos, old_val, left_type, type), right_reg);
+        val = eval_convert(pos, val, type, left_type);
+    }
+    if (in_reg) {
+        eval_emit(pos, EVAL_MOV, local->loc, val, 0);
+    } else {
+        eval_store(pos, addr, val, left_type);
+    }
+}
+
+void eval_simple_stmt(Stmt *stmt) {
+    size_t mark = eval_num_regs;
+    switch (stmt->kind) {
+    case STMT_EXPR:
+        eval_expr(stmt->expr);
+        break;
+    case STMT_INIT:
+        eval_stmt_init(stmt);
+        return;
+    case STMT_ASSIGN:
+        eval_stmt_assign(stmt);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    eval_num_regs = mark;
+}
+
+void eval_cond_jz(Expr *cond, int label) {
+    size_t mark = eval_num_regs;
+    eval_jump(cond->pos, EVAL_JZ, eval_expr(cond), label);
+    eval_num_regs = mark;
+}
+
+void eval_stmt_if(Stmt *stmt) {
+    size_t num_locals = buf_len(eval_locals);
+    size_t mark = eval_num_regs;
+    int end_label = eval_new_label();
+    int next_label = eval_new_label();
+    if (stmt->if_stmt.init) {
+        eval_stmt(stmt->if_stmt.init);
+    }
+    if (stmt->if_stmt.cond) {
+        eval_cond_jz(stmt->if_stmt.cond, next_label);
+    } else {
+        EvalLocal *local = eval_get_local(stmt->if_stmt.init->init.name);
+        uint16_t val = local->in_memory ? eval_load(stmt->pos, eval_frame_addr(stmt->pos, local->loc), local->type) : (uint16_t)local->loc;
+        eval_jump(stmt->pos, EVAL_JZ, val, next_label);
+    }
+    eval_stmt_block(stmt->if_stmt.then_block);
+    eval_jump(stmt->pos, EVAL_JMP, 0, end_label);
+    for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+        ElseIf elseif = stmt->if_stmt.elseifs[i];
+        eval_bind_label(next_label);
+        next_label = eval_new_label();
+        eval_cond_jz(elseif.cond, next_label);
+        eval_stmt_block(elseif.block);
+        eval_jump(stmt->pos, EVAL_JMP, 0, end_label);
+    }
+    eval_bind_label(next_label);
+    if (stmt->if_stmt.else_block.stmts) {
+        eval_stmt_block(stmt->if_stmt.else_block);
+    } else if (get_stmt_note(stmt, complete_name)) {
+        eval_emit(stmt->pos, EVAL_TRAP, 0, 0, 0);
+    }
+    eval_bind_label(end_label);
+    if (eval_locals) {
+        buf__hdr(eval_locals)->len = num_locals;
+    }
+    eval_num_regs = mark;
+}
+
+void eval_stmt_switch(Stmt *stmt) {
+    SrcPos pos = stmt->pos;
+    Type *type = eval_expr_type(stmt->switch_stmt.expr);
+    bool sign = is_signed_type(eval_scalar_type(type));
+    size_t mark = eval_num_regs;
+    int end_label = eval_new_label();
+    int default_label = end_label;
+    int *case_labels = NULL;
+    uint16_t val = eval_expr(stmt->switch_stmt.expr);
+    uint16_t test = eval_new_reg(pos);
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase switch_case = stmt->switch_stmt.cases[i];
+        int case_label = eval_new_label();
+        buf_push(case_labels, case_label);
+        if (switch_case.is_default) {
+            default_label = case_label;
+        }
+        for (size_t j = 0; j < switch_case.num_patterns; j++) {
+            SwitchCasePattern pattern = switch_case.patterns[j];
+            size_t pattern_mark = eval_num_regs;
+            uint16_t start = eval_const(pos, eval_normalize_const(eval_const_val(pattern.start), type));
+            if (!pattern.end) {
+                eval_emit(pos, EVAL_EQ, test, val, start);
+                eval_jump(pos, EVAL_JNZ, test, case_label);
+            } else {
+                uint16_t end = eval_const(pos, eval_normalize_const(eval_const_val(pattern.end), type));
+                int next_label = eval_new_label();
+                eval_emit(pos, sign ? EVAL_LTS : EVAL_LTU, test, val, start);
+                eval_jump(pos, EVAL_JNZ, test, next_label);
+                eval_emit(pos, sign ? EVAL_LES : EVAL_LEU, test, val, end);
+                eval_jump(pos, EVAL_JNZ, test, case_label);
+                eval_bind_label(next_label);
+            }
+            eval_num_regs = pattern_mark;
+        }
+    }
+    if (default_label == end_label && get_stmt_note(stmt, complete_name)) {
+        eval_emit(pos, EVAL_TRAP, 0, 0, 0);
+    } else {
+        eval_jump(pos, EVAL_JMP, 0, default_label);
+    }
+    eval_num_regs = mark;
+    int old_break_label = eval_break_label;
+    eval_break_label = end_label;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        eval_bind_label(case_labels[i]);
+        eval_stmt_block(stmt->switch_stmt.cases[i].block);
+        eval_jump(pos, EVAL_JMP, 0, end_label);
+    }
+    eval_break_label = old_break_label;
+    eval_bind_label(end_label);
+    buf_free(case_labels);
+}
+
+int eval_goto_label(const char *name) {
+    for (EvalGotoLabel *it = eval_goto_labels; it != buf_end(eval_goto_labels); it++) {
+        if (it->name == name) {
+            return it->label;
+        }
+    }
+    int label = eval_new_label();
+    buf_push(eval_goto_labels, (EvalGotoLabel){name, label});
+    return label;
+}
+
+// Loops test their condition at the bottom, as in the native backend.
+void eval_loop(SrcPos pos, Stmt *init, Expr *cond, Stmt *next, StmtList block, bool cond_first) {
+    size_t num_locals = buf_len(eval_locals);
+    size_t mark = eval_num_regs;
+    int old_break_label = eval_break_label;
+    int old_continue_label = eval_continue_label;
+    int top_label = eval_new_label();
+    int cond_label = eval_new_label();
+    eval_break_label = eval_new_label();
+    eval_continue_label = next ? eval_new_label() : cond_label;
+    if (init) {
+        eval_simple_stmt(init);
+    }
+    if (cond_first) {
+        eval_jump(pos, EVAL_JMP, 0, cond_label);
+    }
+    eval_bind_label(top_label);
+    eval_stmt_block(block);
+    if (next) {
+        eval_bind_label(eval_continue_label);
+        eval_simple_stmt(next);
+    }
+    eval_bind_label(cond_label);
+    if (cond) {
+        size_t cond_mark = eval_num_regs;
+        eval_jump(cond->pos, EVAL_JNZ, eval_expr(cond), top_label);
+        eval_num_regs = cond_mark;
+    } else {
+        eval_jump(pos, EVAL_JMP, 0, top_label);
+    }
+    eval_bind_label(eval_break_label);
+    eval_break_label = old_break_label;
+    eval_continue_label = old_continue_label;
+    if (eval_locals) {
+        buf__hdr(eval_locals)->len = num_locals;
+    }
+    eval_num_regs = mark;
+}
+
+void eval_stmt_return(Stmt *stmt) {
+    size_t mark = eval_num_regs;
+    if (!stmt->expr) {
+        eval_emit(stmt->pos, EVAL_RET, eval_const(stmt->pos, 0), 0, 0);
+    } else if (is_eval_memory_type(eval_ret_type)) {
+        uint16_t src = eval_expr(stmt->expr);
+        eval_emit(stmt->pos, EVAL_COPY, eval_ret_ptr_reg, src, eval_add_const(stmt->pos, type_sizeof(eval_ret_type)));
+        eval_emit(stmt->pos, EVAL_RET, eval_ret_ptr_reg, 0, 0);
+    } else {
+        uint16_t val = eval_convert(stmt->pos, eval_expr(stmt->expr), type_decay(eval_expr_type(stmt->expr)), eval_ret_type);
+        eval_emit(stmt->pos, EVAL_RET, val, 0, 0);
+    }
+    eval_num_regs = mark;
+}
+
+void eval_stmt(Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        eval_stmt_return(stmt);
+        break;
+    case STMT_BREAK:
+        eval_jump(stmt->pos, EVAL_JMP, 0, eval_break_label);
+        break;
+    case STMT_CONTINUE:
+        eval_jump(stmt->pos, EVAL_JMP, 0, eval_continue_label);
+        break;
+    case STMT_BLOCK:
+        eval_stmt_block(stmt->block);
+        break;
+    case STMT_NOTE:
+        if (stmt->note.name == assert_name) {
+            size_t mark = eval_num_regs;
+            int label = eval_new_label();
+            eval_jump(stmt->pos, EVAL_JNZ, eval_expr(stmt->note.args[0].expr), label);
+            eval_emit(stmt->pos, EVAL_TRAP, 0, 0, 0);
+            eval_bind_label(label);
+            eval_num_regs = mark;
+        }
+        break;
+    case STMT_IF:
+        eval_stmt_if(stmt);
+        break;
+    case STMT_WHILE:
+        eval_loop(stmt->pos, NULL, stmt->while_stmt.cond, NULL, stmt->while_stmt.block, true);
+        break;
+    case STMT_DO_WHILE:
+        eval_loop(stmt->pos, NULL, stmt->while_stmt.cond, NULL, stmt->while_stmt.block, false);
+        break;
+    case STMT_FOR:
+        eval_loop(stmt->pos, stmt->for_stmt.init, stmt->for_stmt.cond, stmt->for_stmt.next, stmt->for_stmt.block, true);
+        break;
+    case STMT_SWITCH:
+        eval_stmt_switch(stmt);
+        break;
+    case STMT_LABEL:
+        eval_bind_label(eval_goto_label(stmt->label));
+        break;
+    case STMT_GOTO:
+        eval_jump(stmt->pos, EVAL_JMP, 0, eval_goto_label(stmt->label));
+        break;
+    default:
+        eval_simple_stmt(stmt);
+        break;
+    }
+}
+
+void eval_compile_body(EvalFunc *func) {
+    Sym *sym = func->sym;
+    Decl *decl = sym->decl;
+    Type *type = sym->type;
+    buf_clear(func->code);
+    buf_clear(func->code_pos);
+    buf_clear(func->consts);
+    buf_clear(eval_locals);
+    buf_clear(eval_labels);
+    buf_clear(eval_fixups);
+    buf_clear(eval_goto_labels);
+    func->num_regs = 0;
+    func->frame_size = 0;
+    eval_func = func;
+    eval_num_regs = 0;
+    eval_break_label = -1;
+    eval_continue_label = -1;
+    eval_ret_type = type->func.ret;
+    size_t num_params = type->func.num_params;
+    for (size_t i = 0; i < num_params; i++) {
+        eval_new_reg(decl->pos);
+    }
+    if (is_eval_memory_type(eval_ret_type)) {
+        eval_ret_ptr_reg = eval_new_reg(decl->pos);
+    }
+    for (size_t i = 0; i < num_params; i++) {
+        FuncParam param = decl->func.params[i];
+        Type *param_type = type->func.params[i];
+        if (is_eval_memory_type(param_type) || is_eval_addr_taken(param.name)) {
+            EvalLocal *local = eval_new_local(param.pos, param.name, param_type);
+            size_t mark = eval_num_regs;
+            eval_store(param.pos, eval_frame_addr(param.pos, local->loc), (uint16_t)i, param_type);
+            eval_num_regs = mark;
+        } else {
+            eval_push_local(param.name, param_type, false, (uint32_t)i);
+        }
+    }
+    eval_stmt_block(decl->func.block);
+    eval_emit(decl->pos, EVAL_RET, eval_const(decl->pos, 0), 0, 0);
+    if (eval_pos() > UINT32_MAX) {
+        fatal_error(decl->pos, "Function too large for compile-time evaluation");
+    }
+    eval_resolve_fixups();
+}
+
+void eval_compile(EvalFunc *func, SrcPos pos) {
+    Sym *sym = func->sym;
+    if (map_get_uint64(&func_body_state_map, sym) == FUNC_BODY_RESOLVING) {
+        fatal_error(pos, "Cannot evaluate '%s' at compile time from inside its own body", sym->name);
+    }
+    if (sym->state != SYM_RESOLVED || !resolve_func_body_nested(sym)) {
+        fatal_error(pos, "Cannot evaluate '%s' at compile time because it has errors", sym->name);
+    }
+    buf_clear(eval_addr_taken);
+    do {
+        eval_recompile = false;
+        eval_compile_body(func);
+    } while (eval_recompile);
+    func->compiled = true;
+}
+
+// Interpreter
+
+uint8_t *eval_check_ptr(EvalFunc *func, size_t pc, int64_t ptr, size_t size) {
+    uint64_t offset = (uint64_t)ptr - (uint64_t)(uintptr_t)eval_mem;
+    if (offset > EVAL_MEM_SIZE - size) {
+        fatal_error(func->code_pos[pc], "Invalid memory access during compile-time evaluation");
+    }
+    return (uint8_t *)(uintptr_t)ptr;
+}
+
+int64_t eval_invoke(EvalFunc *func, int64_t *regs, SrcPos pos);
+
+// Backward jumps and calls count against a budget so runaway loops and recursion are reported.
+void eval_count_step(EvalFunc *func, size_t pc) {
+    if (++eval_steps == EVAL_MAX_STEPS) {
+        fatal_error(func->code_pos[pc], "Compile-time evaluation did not finish after %llu steps", EVAL_MAX_STEPS);
+    }
+}
+
+int64_t eval_run(EvalFunc *func, int64_t *regs, uint8_t *frame) {
+    const EvalInstr *code = func->code;
+    const int64_t *consts = func->consts;
+    size_t pc = 0;
+    for (;;) {
+        EvalInstr in = code[pc++];
+        switch (in.op) {
+        case EVAL_MOV:
+            regs[in.a] = regs[in.b];
+            break;
+        case EVAL_CONST:
+            regs[in.a] = consts[in.b];
+            break;
+        case EVAL_FRAME:
+            regs[in.a] = (int64_t)(uintptr_t)(frame + consts[in.b]);
+            break;
+        case EVAL_ADD:
+            regs[in.a] = (int64_t)((uint64_t)regs[in.b] + (uint64_t)regs[in.c]);
+            break;
+        case EVAL_SUB:
+            regs[in.a] = (int64_t)((uint64_t)regs[in.b] - (uint64_t)regs[in.c]);
+            break;
+        case EVAL_MUL:
+            regs[in.a] = (int64_t)((uint64_t)regs[in.b] * (uint64_t)regs[in.c]);
+            break;
+        case EVAL_DIVS:
+        case EVAL_MODS:
+            if (!regs[in.c]) {
+                fatal_error(func->code_pos[pc - 1], "Division by zero during compile-time evaluation");
+            }
+            if (regs[in.c] == -1) {
+                // Avoid trapping on INT64_MIN / -1 in the host.
+                regs[in.a] = in.op == EVAL_DIVS ? (int64_t)(0 - (uint64_t)regs[in.b]) : 0;
+            } else {
+                regs[in.a] = in.op == EVAL_DIVS ? regs[in.b] / regs[in.c] : regs[in.b] % regs[in.c];
+            }
+            break;
+        case EVAL_DIVU:
+        case EVAL_MODU:
+            if (!regs[in.c]) {
+                fatal_error(func->code_pos[pc - 1], "Division by zero during compile-time evaluation");
+            }
+            regs[in.a] = (int64_t)(in.op == EVAL_DIVU ? (uint64_t)regs[in.b] / (uint64_t)regs[in.c] : (uint64_t)regs[in.b] % (uint64_t)regs[in.c]);
+            break;
+        case EVAL_AND:
+            regs[in.a] = regs[in.b] & regs[in.c];
+            break;
+        case EVAL_OR:
+            regs[in.a] = regs[in.b] | regs[in.c];
+            break;
+        case EVAL_XOR:
+            regs[in.a] = regs[in.b] ^ regs[in.c];
+            break;
+        case EVAL_SHL:
+            regs[in.a] = (int64_t)((uint64_t)regs[in.b] << (regs[in.c] & 63));
+            break;
+        case EVAL_SHRS:
+            regs[in.a] = regs[in.b] >> (regs[in.c] & 63);
+            break;
+        case EVAL_SHRU:
+            regs[in.a] = (int64_t)((uint64_t)regs[in.b] >> (regs[in.c] & 63));
+            break;
+        case EVAL_EQ:
+            regs[in.a] = regs[in.b] == regs[in.c];
+            break;
+        case EVAL_NE:
+            regs[in.a] = regs[in.b] != regs[in.c];
+            break;
+        case EVAL_LTS:
+            regs[in.a] = regs[in.b] < regs[in.c];
+            break;
+        case EVAL_LTU:
+            regs[in.a] = (uint64_t)regs[in.b] < (uint64_t)regs[in.c];
+            break;
+        case EVAL_LES:
+            regs[in.a] = regs[in.b] <= regs[in.c];
+            break;
+        case EVAL_LEU:
+            regs[in.a] = (uint64_t)regs[in.b] <= (uint64_t)regs[in.c];
+            break;
+        case EVAL_NEG:
+            regs[in.a] = (int64_t)(0 - (uint64_t)regs[in.b]);
+            break;
+        case EVAL_NOT:
+            regs[in.a] = ~regs[in.b];
+            break;
+        case EVAL_LNOT:
+            regs[in.a] = !regs[in.b];
+            break;
+        case EVAL_BOOL:
+            regs[in.a] = regs[in.b] != 0;
+            break;
+        case EVAL_SX8:
+            regs[in.a] = (int8_t)regs[in.b];
+            break;
+        case EVAL_SX16:
+            regs[in.a] = (int16_t)regs[in.b];
+            break;
+        case EVAL_SX32:
+            regs[in.a] = (int32_t)regs[in.b];
+            break;
+        case EVAL_ZX8:
+            regs[in.a] = (uint8_t)regs[in.b];
+            break;
+        case EVAL_ZX16:
+            regs[in.a] = (uint16_t)regs[in.b];
+            break;
+        case EVAL_ZX32:
+            regs[in.a] = (uint32_t)regs[in.b];
+            break;
+        case EVAL_LD8S:
+            regs[in.a] = *(int8_t *)eval_check_ptr(func, pc - 1, regs[in.b], 1);
+            break;
+        case EVAL_LD8U:
+            regs[in.a] = *(uint8_t *)eval_check_ptr(func, pc - 1, regs[in.b], 1);
+            break;
+        case EVAL_LD16S: {
+            int16_t val;
+            memcpy(&val, eval_check_ptr(func, pc - 1, regs[in.b], 2), 2);
+            regs[in.a] = val;
+            break;
+        }
+        case EVAL_LD16U: {
+            uint16_t val;
+            memcpy(&val, eval_check_ptr(func, pc - 1, regs[in.b], 2), 2);
+            regs[in.a] = val;
+            break;
+        }
+        case EVAL_LD32S: {
+            int32_t val;
+            memcpy(&val, eval_check_ptr(func, pc - 1, regs[in.b], 4), 4);
+            regs[in.a] = val;
+            break;
+        }
+        case EVAL_LD32U: {
+            uint32_t val;
+            memcpy(&val, eval_check_ptr(func, pc - 1, regs[in.b], 4), 4);
+            regs[in.a] = val;
+            break;
+        }
+        case EVAL_LD64:
+            memcpy(&regs[in.a], eval_check_ptr(func, pc - 1, regs[in.b], 8), 8);
+            break;
+        case EVAL_ST8:
+            *eval_check_ptr(func, pc - 1, regs[in.a], 1) = (uint8_t)regs[in.b];
+            break;
+        case EVAL_ST16: {
+            uint16_t val = (uint16_t)regs[in.b];
+            memcpy(eval_check_ptr(func, pc - 1, regs[in.a], 2), &val, 2);
+            break;
+        }
+        case EVAL_ST32: {
+            uint32_t val = (uint32_t)regs[in.b];
+            memcpy(eval_check_ptr(func, pc - 1, regs[in.a], 4), &val, 4);
+            break;
+        }
+        case EVAL_ST64:
+            memcpy(eval_check_ptr(func, pc - 1, regs[in.a], 8), &regs[in.b], 8);
+            break;
+        case EVAL_COPY: {
+            size_t size = (size_t)consts[in.c];
+            uint8_t *dest = eval_check_ptr(func, pc - 1, regs[in.a], size);
+            memmove(dest, eval_check_ptr(func, pc - 1, regs[in.b], size), size);
+            break;
+        }
+        case EVAL_ZERO: {
+            size_t size = (size_t)consts[in.b];
+            memset(eval_check_ptr(func, pc - 1, regs[in.a], size), 0, size);
+            break;
+        }
+        case EVAL_JMP:
+        case EVAL_JZ:
+        case EVAL_JNZ: {
+            if (in.op == EVAL_JZ ? regs[in.a] != 0 : in.op == EVAL_JNZ ? regs[in.a] == 0 : false) {
+                break;
+            }
+            size_t target = in.b | (size_t)in.c << 16;
+            if (target < pc) {
+                eval_count_step(func, pc - 1);
+            }
+            pc = target;
+            break;
+        }
+        case EVAL_CALL:
+            eval_count_step(func, pc - 1);
+            regs[in.a] = eval_invoke(eval_funcs[in.b], regs + in.a, func->code_pos[pc - 1]);
+            break;
+        case EVAL_RET:
+            return regs[in.a];
+        case EVAL_TRAP:
+            fatal_error(func->code_pos[pc - 1], "Assertion failed during compile-time evaluation");
+            break;
+        default:
+            assert(0);
+            break;
+        }
+    }
+}
+
+int64_t eval_invoke(EvalFunc *func, int64_t *regs, SrcPos pos) {
+    if (!func->compiled) {
+        eval_compile(func, pos);
+    }
+    if (regs + func->num_regs > eval_reg_stack + EVAL_REG_STACK_SIZE || eval_call_depth == EVAL_MAX_CALL_DEPTH) {
+        fatal_error(pos, "Stack overflow during compile-time evaluation");
+    }
+    size_t frame_offset = ALIGN_UP(eval_mem_used, 16);
+    if (frame_offset + func->frame_size > eval_mem_static) {
+        fatal_error(pos, "Out of memory for compile-time evaluation");
+    }
+    size_t old_mem_used = eval_mem_used;
+    int64_t *old_reg_top = eval_reg_top;
+    eval_mem_used = frame_offset + func->frame_size;
+    eval_reg_top = MAX(eval_reg_top, regs + func->num_regs);
+    eval_call_depth++;
+    int64_t result = eval_run(func, regs, eval_mem + frame_offset);
+    eval_call_depth--;
+    eval_reg_top = old_reg_top;
+    eval_mem_used = old_mem_used;
+    return result;
+}
+
+// Calls a function with constant arguments. Aggregate results are written to the arena and the
+// returned value is their address.
+int64_t eval_call_const_args(Expr *expr) {
+    if (type_sizeof(type_ptr(type_void)) != sizeof(void *)) {
+        fatal_error(expr->pos, "Compile-time evaluation needs a target with the host's pointer size");
+    }
+    if (!eval_mem) {
+        eval_mem = xmalloc(EVAL_MEM_SIZE);
+        eval_reg_stack = xmalloc(EVAL_REG_STACK_SIZE * sizeof(int64_t));
+        eval_reg_top = eval_reg_stack;
+    }
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    Type *func_type = sym->type;
+    Type *ret_type = func_type->func.ret;
+    size_t num_args = expr->call.num_args;
+    bool ret_memory = is_eval_memory_type(ret_type);
+    if (eval_reg_top + num_args + ret_memory > eval_reg_stack + EVAL_REG_STACK_SIZE) {
+        fatal_error(expr->pos, "Stack overflow during compile-time evaluation");
+    }
+    // A nested evaluation (from a constant expression inside a function compiled on demand) runs
+    // above whatever the outer one is using.
+    size_t old_mem_used = eval_mem_used;
+    int64_t *old_reg_top = eval_reg_top;
+    int old_call_depth = eval_call_depth;
+    jmp_buf recovery;
+    jmp_buf *old_recovery = error_recovery;
+    if (setjmp(recovery)) {
+        error_recovery = old_recovery;
+        eval_mem_used = old_mem_used;
+        eval_reg_top = old_reg_top;
+        eval_call_depth = old_call_depth;
+        recover_from_error();
+    }
+    error_recovery = &recovery;
+    int64_t *regs = eval_reg_top;
+    for (size_t i = 0; i < num_args; i++) {
+        regs[i] = eval_normalize_const(eval_const_val(expr->call.args[i]), type_decay(func_type->func.params[i]));
+    }
+    if (ret_memory) {
+        size_t offset = ALIGN_UP(eval_mem_used, 16);
+        if (offset + type_sizeof(ret_type) > eval_mem_static) {
+            fatal_error(expr->pos, "Out of memory for compile-time evaluation");
+        }
+        regs[num_args] = (int64_t)(uintptr_t)(eval_mem + offset);
+        eval_mem_used = offset + type_sizeof(ret_type);
+    }
+    eval_reg_top = regs + num_args + ret_memory;
+    if (!eval_call_depth) {
+        eval_steps = 0;
+    }
+    uint16_t func_index;
+    int64_t result = eval_invoke(get_eval_func(sym, &func_index), regs, expr->pos);
+    error_recovery = old_recovery;
+    eval_mem_used = old_mem_used;
+    eval_reg_top = old_reg_top;
+    return result;
+}
+
+// Resolver entry points
+
+bool is_eval_call(Expr *expr) {
+    if (expr->kind != EXPR_CALL || !is_eval_func_sym(get_resolved_sym(expr->call.expr))) {
+        return false;
+    }
+    for (size_t i = 0; i < expr->call.num_args; i++) {
+        if (!is_resolved_const(expr->call.args[i])) {
+            return false;
+        }
+    }
+    return !get_resolved_sym(expr->call.expr)->type->func.has_varargs;
+}
+
+Operand eval_const_call(Expr *expr, Type *type) {
+    Val val = {.ll = eval_call_const_args(expr)};
+    return operand_const(type, val);
+}
+
+uint8_t *get_eval_init(Expr *expr) {
+    return map_get(&eval_init_map, expr);
+}
+
+void check_eval_data(SrcPos pos, Type *type, const uint8_t *data) {
+    type = eval_scalar_type(type);
+    switch (type->kind) {
+    case TYPE_PTR:
+    case TYPE_FUNC: {
+        uint64_t val;
+        memcpy(&val, data, sizeof(val));
+        if (val) {
+            fatal_error(pos, "Compile-time evaluated initializer cannot contain non-null pointers");
+        }
+        break;
+    }
+    case TYPE_ARRAY:
+        for (size_t i = 0; i < type->num_elems; i++) {
+            check_eval_data(pos, type->base, data + i * type_sizeof(type->base));
+        }
+        break;
+    case TYPE_STRUCT:
+    case TYPE_TUPLE:
+        for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+            check_eval_data(pos, type->aggregate.fields[i].type, data + type->aggregate.fields[i].offset);
+        }
+        break;
+    case TYPE_UNION:
+        for (size_t i = 0; i < type_sizeof(type); i++) {
+            if (data[i]) {
+                fatal_error(pos, "Compile-time evaluated initializer cannot contain non-zero unions");
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Evaluates a global variable's initializer at compile time. The result bytes are generated as
+// constant data in place of the call.
+void eval_global_init(Expr *expr, Type *type) {
+    Type *ret_type = get_resolved_sym(expr->call.expr)->type->func.ret;
+    int64_t result = eval_call_const_args(expr);
+    size_t size = type_sizeof(type);
+    uint8_t *data = xcalloc(1, CLAMP_MIN(size, 1));
+    if (is_eval_memory_type(ret_type)) {
+        if (unqualify_type(ret_type) != unqualify_type(type)) {
+            fatal_error(expr->pos, "Compile-time evaluated initializer must have the variable's type");
+        }
+        memcpy(data, (void *)(uintptr_t)result, size);
+    } else if (is_integer_type(eval_scalar_type(type)) || is_ptr_type(unqualify_type(type))) {
+        result = eval_normalize_const(result, type);
+        memcpy(data, &result, size);
+    } else {
+        fatal_eval_unsupported(expr->pos, "Initializer of this type");
+    }
+    check_eval_data(expr->pos, type, data);
+    map_put(&eval_init_map, expr, data);
+}
@@ -4,13 +4,16 @@ char *gen_buf = NULL;
 #define genlnf(...) (genln(), genf(__VA_ARGS__))
 
 int gen_indent;
-SrcPos gen_pos;
+SrcLoc gen_pos;
+Map gen_file_indices;
 
 const char **gen_headers_buf;
 
 char *gen_preamble_buf;
 char *gen_postamble_buf;
 
+const char *gen_output_path = "";
+
 void genln(void) {
     genf("\n%.*s", gen_indent * 4, "                                                                  ");
     gen_pos.line++;
@@ -83,41 +86,122 @@ void gen_buf_pos(char **pbuf, SrcPos pos) {
     if (flag_nolinesync) {
         return;
     }
+    SrcLoc loc = get_src_loc(pos);
     char *buf = *pbuf;
-    buf_printf(buf, "\n#line %d ", pos.line);
+    buf_printf(buf, "\n#line %d ", loc.line);
     char *old_gen_buf = gen_buf;
     gen_buf = buf;
-    gen_str(pos.name, false);
+    gen_str(loc.name, false);
     buf = gen_buf;
     gen_buf = old_gen_buf;
     buf_printf(buf, "\n");
     *pbuf = buf;
 }
 
+enum {
+    MAX_LINESYNC_PADDING = 8,
+};
+
+// In compact mode, small forward gaps are padded with blank lines like the C preprocessor
+// does itself, and file names are defined once as macros and referenced by index.
+void gen_sync_pos_compact(SrcLoc loc) {
+    if (gen_pos.name == loc.name && gen_pos.line <= loc.line && loc.line - gen_pos.line <= MAX_LINESYNC_PADDING) {
+        for (; gen_pos.line < loc.line; gen_pos.line++) {
+            genf("\n");
+        }
+        return;
+    }
+    if (gen_pos.name == loc.name) {
+        genlnf("#line %d", loc.line);
+    } else {
+        int index = (int)(intptr_t)map_get(&gen_file_indices, loc.name);
+        if (!index) {
+            index = (int)gen_file_indices.len + 1;
+            map_put(&gen_file_indices, loc.name, (void *)(intptr_t)index);
+            genlnf("#define ION_FILE_%d ", index);
+            gen_str(loc.name, false);
+        }
+        genlnf("#line %d ION_FILE_%d", loc.line, index);
+    }
+    gen_pos = loc;
+}
+
 void gen_sync_pos(SrcPos pos) {
     if (flag_nolinesync) {
         return;
     }
-    if (gen_pos.line != pos.line || gen_pos.name != pos.name) {
-        genlnf("#line %d", pos.line);
-        if (gen_pos.name != pos.name) {
+    SrcLoc loc = get_src_loc(pos);
+    if (flag_compactlinesync) {
+        if (gen_pos.line != loc.line || gen_pos.name != loc.name) {
+            gen_sync_pos_compact(loc);
+        }
+        return;
+    }
+    if (gen_pos.line != loc.line || gen_pos.name != loc.name) {
+        genlnf("#line %d", loc.line);
+        if (gen_pos.name != loc.name) {
             genf(" ");
-            gen_str(pos.name, false);
+            gen_str(loc.name, false);
+        }
+        gen_pos = loc;
+    }
+}
+
+#define GEN_LINESYNC_OUTPUT "#line ION_OUTPUT_LINE"
+
+// Code that doesn't come from an Ion declaration, like array helpers, is mapped back to the
+// generated file. Its line numbers are only known once the whole file is generated, so this emits
+// a placeholder that gen_resolve_output_lines replaces.
+void gen_sync_output(void) {
+    if (flag_nolinesync) {
+        return;
+    }
+    genlnf(GEN_LINESYNC_OUTPUT);
+    gen_pos = (SrcLoc){0};
+}
+
+void gen_resolve_output_lines(void) {
+    if (flag_nolinesync) {
+        return;
+    }
+    char *old_gen_buf = gen_buf;
+    gen_buf = NULL;
+    gen_str(gen_output_path, false);
+    char *path = gen_buf;
+    gen_buf = NULL;
+    size_t len = strlen(GEN_LINESYNC_OUTPUT);
+    int line = 1;
+    for (const char *ptr = old_gen_buf; ptr != buf_end(old_gen_buf); ptr++) {
+        if (*ptr == '\n') {
+            line++;
+            if (buf_end(old_gen_buf) - ptr > len && strncmp(ptr + 1, GEN_LINESYNC_OUTPUT, len) == 0 && (ptr + len + 1 == buf_end(old_gen_buf) || ptr[len + 1] == '\n')) {
+                genf("\n#line %d %.*s", line + 1, (int)buf_len(path), path);
+                ptr += len;
+                continue;
+            }
         }
-        gen_pos = pos;
+        buf_push(gen_buf, *ptr);
     }
+    buf_free(path);
+    buf_free(old_gen_buf);
 }
 
 const char *cdecl_paren(const char *str, char c) {
     return c && c != '[' ? strf("(%s)", str) : str;
 }
 
+const char *soa_array_name(Type *type) {
+    return strf("soa%d", type->typeid);
+}
+
 const char *cdecl_name(Type *type) {
     const char *type_name = type_names[type->kind];
     if (type_name) {
         return type_name;
     } else if (type->kind == TYPE_TUPLE) {
         return strf("tuple%d", type->typeid);
+    } else if (type->kind == TYPE_VECTOR) {
+        return vector_type_name(type);
     } else {
         assert(type->sym);
         return get_gen_name(type->sym);
@@ -131,7 +215,9 @@ char *type_to_cdecl(Type *type, const char *str) {
     case TYPE_CONST:
         return type_to_cdecl(type->base, strf("const %s", cdecl_paren(str, *str)));
     case TYPE_ARRAY:
-        if (type->num_elems == 0) {
+        if (is_soa_array_type(type)) {
+            return strf("%s%s%s", soa_array_name(type), *str ? " " : "", str);
+        } else if (type->num_elems == 0) {
             return type_to_cdecl(type->base, cdecl_paren(strf("%s[]", str), *str));
         } else {
             return type_to_cdecl(type->base, cdecl_paren(strf("%s[%zu]", str, type->num_elems), *str));
@@ -223,7 +309,9 @@ char *typespec_to_cdecl(Typespec *typespec, const char *str) {
         return typespec_to_cdecl(typespec->base, str);
         // return typespec_to_cdecl(typespec->base, strf("const %s", cdecl_paren(str, *str)));
     case TYPESPEC_ARRAY:
-        if (typespec->num_elems == 0) {
+        if (is_soa_array_type(get_resolved_type(typespec))) {
+            return strf("%s%s%s", soa_array_name(get_resolved_type(typespec)), *str ? " " : "", str);
+        } else if (typespec->num_elems == 0) {
             return typespec_to_cdecl(typespec->base, cdecl_paren(strf("%s[]", str), *str));
         } else {
             return typespec_to_cdecl(typespec->base, cdecl_paren(strf("%s[%s]", str, gen_expr_str(typespec->num_elems)), *str));
@@ -283,7 +371,8 @@ void gen_func_decl(Decl *decl) {
             if (i != 0) {
                 buf_printf(result, ", ");
             }
-            gen_decl_from_typespec(&result, param.type, param.name);
+            const char *name = get_note(param.notes, restrict_name) ? strf("RESTRICT %s", param.name) : param.name;
+            gen_decl_from_typespec(&result, param.type, name);
         }
     }
     if (decl->func.has_varargs) {
@@ -316,9 +405,21 @@ void gen_func_decl(Decl *decl) {
     if (get_decl_note(decl, inline_name)) {
         genlnf("INLINE");
     }
-    if (get_decl_note(decl, str_intern("noinline"))) {
+    if (get_decl_note(decl, noinline_name)) {
         genlnf("NOINLINE");
     }
+    if (get_decl_note(decl, hot_name)) {
+        genlnf("HOT");
+    }
+    if (get_decl_note(decl, cold_name)) {
+        genlnf("COLD");
+    }
+    if (get_decl_note(decl, flatten_name)) {
+        genlnf("FLATTEN");
+    }
+    if (get_decl_note(decl, pure_name)) {
+        genlnf("PURE");
+    }
 
     if (decl->func.ret_type) {
         char *temp = 0;
@@ -343,12 +444,24 @@ bool is_tuple_reachable(Type *type) {
 }
 
 void gen_forward_decls(void) {
+    for (int i = 0; i < buf_len(vector_types); i++) {
+        Type *type = vector_types[i];
+        if (is_reachable(get_reachable(type))) {
+            genlnf("typedef %s %s __attribute__((vector_size(%zu)));", type_to_cdecl(type->base, ""), vector_type_name(type), type_sizeof(type));
+        }
+    }
     for (int i = 0; i < buf_len(tuple_types); i++) {
         Type *type = tuple_types[i];
         if (is_tuple_reachable(type)) {
             genlnf("typedef struct tuple%d tuple%d;", type->typeid, type->typeid);
         }
     }
+    for (int i = 0; i < buf_len(soa_array_types); i++) {
+        Type *type = soa_array_types[i];
+        if (is_reachable(get_reachable(type))) {
+            genlnf("typedef struct %s %s;", soa_array_name(type), soa_array_name(type));
+        }
+    }
     for (Sym **it = sorted_syms; it != buf_end(sorted_syms); it++) {
         Sym *sym = *it;
         Decl *decl = sym->decl;
@@ -372,17 +485,28 @@ void gen_forward_decls(void) {
     }
 }
 
+void gen_align_note(Notes notes) {
+    size_t align = get_align_note(notes);
+    if (align) {
+        genf("ALIGN(%zu) ", align);
+    }
+}
+
 void gen_aggregate_items(Aggregate *aggregate) {
     gen_indent++;
     for (size_t i = 0; i < aggregate->num_items; i++) {
         AggregateItem item = aggregate->items[i];
         if (item.kind == AGGREGATE_ITEM_FIELD) {
             for (size_t j = 0; j < item.num_names; j++) {
-                gen_sync_pos(item.pos);
+                if (!flag_compactlinesync) {
+                    gen_sync_pos(item.pos);
+                }
+                genln();
+                gen_align_note(item.notes);
                 if (item.type->kind == TYPESPEC_ARRAY && !item.type->num_elems) {
-                    genlnf("%s;", typespec_to_cdecl(new_typespec_ptr(item.pos, item.type->base), item.names[j]));
+                    genf("%s;", typespec_to_cdecl(new_typespec_ptr(item.pos, item.type->base), item.names[j]));
                 } else {
-                    genlnf("%s;", typespec_to_cdecl(item.type, item.names[j]));
+                    genf("%s;", typespec_to_cdecl(item.type, item.names[j]));
                 }
             }
         } else if (item.kind == AGGREGATE_ITEM_SUBAGGREGATE) {
@@ -468,6 +592,7 @@ const char *typeid_kind_names[NUM_TYPE_KINDS] = {
     [TYPE_UNION] = "TYPE_UNION",
     [TYPE_FUNC] = "TYPE_FUNC",
     [TYPE_TUPLE] = "TYPE_TUPLE",
+    [TYPE_VECTOR] = "TYPE_VECTOR",
 };
 
 const char *typeid_kind_name(Type *type) {
@@ -482,6 +607,9 @@ const char *typeid_kind_name(Type *type) {
 
 bool is_excluded_typeinfo(Type *type) {
     while (type->kind == TYPE_ARRAY || type->kind == TYPE_CONST || type->kind == TYPE_PTR) {
+        if (is_soa_array_type(type) && !is_reachable(get_reachable(type))) {
+            return true;
+        }
         type = type->base;
     }
     if (type->sym) {
@@ -492,6 +620,8 @@ bool is_excluded_typeinfo(Type *type) {
         }
     } else if (type->kind == TYPE_TUPLE) {
         return !is_tuple_reachable(type);
+    } else if (type->kind == TYPE_VECTOR) {
+        return !is_reachable(get_reachable(type));
     } else {
         return !type->sym && (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION);
     }
@@ -505,96 +635,460 @@ void gen_typeid(Type *type) {
     }
 }
 
-void gen_intrinsic(Sym *sym, Expr *expr) {
+Type *get_intrinsic_array_base(Expr *expr) {
     Type *type = get_resolved_type(expr->call.args[0]);
-    Type *base = is_ptr_type(type) ? unqualify_type(type->base) : 0;
-    Type *key = base && is_aggregate_type(base) && base->aggregate.num_fields == 2 ? base->aggregate.fields[0].type : 0;
-    Type *val = base && is_aggregate_type(base) && base->aggregate.num_fields == 2 ? base->aggregate.fields[1].type : 0;
-    if (sym->name == str_intern("va_copy") || sym->name == str_intern("va_start") || sym->name == str_intern("va_end")) {
-        genf("%s(", sym->name);
-        for (int i = 0; i < expr->call.num_args; i++) {
-            if (i != 0) {
-                genf(", ");
-            }
-            gen_expr(expr->call.args[i]);
+    return is_ptr_type(type) ? unqualify_type(type->base) : 0;
+}
+
+Type *get_intrinsic_array_field(Expr *expr, int index) {
+    Type *base = get_intrinsic_array_base(expr);
+    return base && is_aggregate_type(base) && base->aggregate.num_fields == 2 ? base->aggregate.fields[index].type : 0;
+}
+
+// Generates the remaining arguments of an intrinsic macro call, each one parenthesized.
+void gen_intrinsic_args_from(Expr *expr, int start) {
+    for (int i = start; i < expr->call.num_args; i++) {
+        genf("), (");
+        gen_expr(expr->call.args[i]);
+    }
+    genf("))");
+}
+
+void gen_intrinsic_call(Sym *sym, Expr *expr) {
+    genf("%s(", sym->name);
+    for (int i = 0; i < expr->call.num_args; i++) {
+        if (i != 0) {
+            genf(", ");
         }
+        gen_expr(expr->call.args[i]);
+    }
+    genf(")");
+}
+
+void gen_intrinsic_va_arg(Sym *sym, Expr *expr) {
+    assert(expr->call.num_args == 2);
+    gen_expr(expr->call.args[1]);
+    genf(" = va_arg(");
+    gen_expr(expr->call.args[0]);
+    Type *type = get_resolved_type(expr->call.args[1]);
+    genf(", %s)", type_to_cdecl(type, ""));
+}
+
+// (t, a, ...)
+void gen_intrinsic_t(Sym *sym, Expr *expr) {
+    genf("%s(%s, (", sym->name, type_to_cdecl(get_intrinsic_array_base(expr), ""));
+    gen_expr(expr->call.args[0]);
+    gen_intrinsic_args_from(expr, 1);
+}
+
+// (t, tv, a, ...)
+void gen_intrinsic_t_tv(Sym *sym, Expr *expr) {
+    genf("%s(%s, %s, (", sym->name, type_to_cdecl(get_intrinsic_array_base(expr), ""), type_to_cdecl(get_intrinsic_array_field(expr, 1), ""));
+    gen_expr(expr->call.args[0]);
+    gen_intrinsic_args_from(expr, 1);
+}
+
+// (t, tk, a, ...)
+void gen_intrinsic_t_tk(Sym *sym, Expr *expr) {
+    genf("%s(%s, %s, (", sym->name, type_to_cdecl(get_intrinsic_array_base(expr), ""), type_to_cdecl(get_intrinsic_array_field(expr, 0), ""));
+    gen_expr(expr->call.args[0]);
+    gen_intrinsic_args_from(expr, 1);
+}
+
+// (t, tk, tv, a, ...)
+void gen_intrinsic_t_tk_tv(Sym *sym, Expr *expr) {
+    genf("%s(%s, %s, %s, (", sym->name, type_to_cdecl(get_intrinsic_array_base(expr), ""), type_to_cdecl(get_intrinsic_array_field(expr, 0), ""), type_to_cdecl(get_intrinsic_array_field(expr, 1), ""));
+    gen_expr(expr->call.args[0]);
+    gen_intrinsic_args_from(expr, 1);
+}
+
+void gen_intrinsic_anew(Sym *sym, Expr *expr) {
+    Type *result_type = get_resolved_type(expr);
+    assert(is_ptr_type(result_type));
+    genf("%s(%s, ", sym->name, type_to_cdecl(result_type->base, ""));
+    gen_expr(expr->call.args[0]);
+    genf(")");
+}
+
+// (t, p, ...)
+void gen_intrinsic_atomic(Sym *sym, Expr *expr) {
+    genf("%s(%s, (", get_gen_name(expr->call.expr), type_to_cdecl(get_intrinsic_array_base(expr), ""));
+    gen_expr(expr->call.args[0]);
+    gen_intrinsic_args_from(expr, 1);
+}
+
+void gen_intrinsic_atomic_fence(Sym *sym, Expr *expr) {
+    genf("%s(", get_gen_name(expr->call.expr));
+    gen_expr(expr->call.args[0]);
+    genf(")");
+}
+
+// (t, ...)
+void gen_intrinsic_vector(Sym *sym, Expr *expr) {
+    genf("%s(%s", get_gen_name(expr->call.expr), type_to_cdecl(get_resolved_type(expr), ""));
+    for (int i = 0; i < expr->call.num_args; i++) {
+        genf(", (");
+        gen_expr(expr->call.args[i]);
         genf(")");
-    } else if (sym->name == str_intern("va_arg")) {
-        assert(expr->call.num_args == 2);
-        gen_expr(expr->call.args[1]);
-        genf(" = va_arg(");
-        gen_expr(expr->call.args[0]);
-        Type *type = get_resolved_type(expr->call.args[1]);
-        genf(", %s)", type_to_cdecl(type, ""));
-    } else if (sym->name == str_intern("apush") || sym->name == str_intern("aputv") || sym->name == str_intern("adelv") ||
-        sym->name == str_intern("agetvi") || sym->name == str_intern("agetvp") || sym->name == str_intern("agetv") ||
-        sym->name == str_intern("asetcap") || sym->name == str_intern("afit") || sym->name == str_intern("acat") ||
-        sym->name == str_intern("adeli") || sym->name == str_intern("aindexv") || sym->name == str_intern("asetlen")) {
-        // (t, a, v)
-        genf("%s(%s, (", sym->name, type_to_cdecl(base, ""));
-        gen_expr(expr->call.args[0]);
-        genf("), (");
-        gen_expr(expr->call.args[1]);
-        genf("))");
-    } else if (sym->name == str_intern("adefault")) {
-        // (t, tv, a, v)
-        genf("%s(%s, %s, (", sym->name, type_to_cdecl(base, ""), type_to_cdecl(val, ""));
-        gen_expr(expr->call.args[0]);
-        genf("), (");
-        gen_expr(expr->call.args[1]);
-        genf("))");
-    } else if (sym->name == str_intern("afill")) {
-        // (t, a, v, n)
-        genf("%s(%s, (", sym->name, type_to_cdecl(base, ""));
+    }
+    genf(")");
+}
+
+// (t, p, v)
+void gen_intrinsic_vstore(Sym *sym, Expr *expr) {
+    genf("%s(%s, (", get_gen_name(expr->call.expr), type_to_cdecl(get_resolved_type(expr->call.args[1]), ""));
+    gen_expr(expr->call.args[0]);
+    gen_intrinsic_args_from(expr, 1);
+}
+
+// (t, m, a, b, ...), where m is the lane mask type of t.
+void gen_intrinsic_vshuffle(Sym *sym, Expr *expr) {
+    Type *type = get_resolved_type(expr);
+    genf("%s(%s, %s, (", get_gen_name(expr->call.expr), type_to_cdecl(type, ""), type_to_cdecl(vector_mask_type(type), ""));
+    gen_expr(expr->call.args[0]);
+    genf("), (");
+    gen_expr(expr->call.args[1]);
+    genf(")");
+    for (int i = 2; i < expr->call.num_args; i++) {
+        genf(", %lld", get_resolved_val(expr->call.args[i]).ll);
+    }
+    genf(")");
+}
+
+typedef void (*GenIntrinsicFunc)(Sym *sym, Expr *expr);
+
+GenIntrinsicFunc gen_intrinsic_funcs[NUM_INTRINSICS] = {
+    [INTRINSIC_VA_START] = gen_intrinsic_call,
+    [INTRINSIC_VA_END] = gen_intrinsic_call,
+    [INTRINSIC_VA_COPY] = gen_intrinsic_call,
+    [INTRINSIC_VA_ARG] = gen_intrinsic_va_arg,
+    [INTRINSIC_APUSH] = gen_intrinsic_t,
+    [INTRINSIC_APUTV] = gen_intrinsic_t,
+    [INTRINSIC_ADELV] = gen_intrinsic_t,
+    [INTRINSIC_AGETVI] = gen_intrinsic_t,
+    [INTRINSIC_AGETVP] = gen_intrinsic_t,
+    [INTRINSIC_AGETV] = gen_intrinsic_t,
+    [INTRINSIC_ASETCAP] = gen_intrinsic_t,
+    [INTRINSIC_AFIT] = gen_intrinsic_t,
+    [INTRINSIC_ACAT] = gen_intrinsic_t,
+    [INTRINSIC_ADELI] = gen_intrinsic_t,
+    [INTRINSIC_AINDEXV] = gen_intrinsic_t,
+    [INTRINSIC_ASETLEN] = gen_intrinsic_t,
+    [INTRINSIC_ADEFAULT] = gen_intrinsic_t_tv,
+    [INTRINSIC_AFILL] = gen_intrinsic_t,
+    [INTRINSIC_ACATN] = gen_intrinsic_t,
+    [INTRINSIC_ADELN] = gen_intrinsic_t,
+    [INTRINSIC_AINDEX] = gen_intrinsic_t_tk,
+    [INTRINSIC_AGETI] = gen_intrinsic_t_tk,
+    [INTRINSIC_ADEL] = gen_intrinsic_t_tk,
+    [INTRINSIC_AGETP] = gen_intrinsic_t_tk_tv,
+    [INTRINSIC_AGET] = gen_intrinsic_t_tk_tv,
+    [INTRINSIC_APUT] = gen_intrinsic_t_tk,
+    [INTRINSIC_AHDRSIZE] = gen_intrinsic_t,
+    [INTRINSIC_AHDRALIGN] = gen_intrinsic_t,
+    [INTRINSIC_AHDR] = gen_intrinsic_t,
+    [INTRINSIC_ALEN] = gen_intrinsic_t,
+    [INTRINSIC_ACAP] = gen_intrinsic_t,
+    [INTRINSIC_AFREE] = gen_intrinsic_t,
+    [INTRINSIC_ACLEAR] = gen_intrinsic_t,
+    [INTRINSIC_APOP] = gen_intrinsic_t,
+    [INTRINSIC_ANEW] = gen_intrinsic_anew,
+    [INTRINSIC_QNEW] = gen_intrinsic_t,
+    [INTRINSIC_QFREE] = gen_intrinsic_t,
+    [INTRINSIC_QPUSH] = gen_intrinsic_t,
+    [INTRINSIC_QPOP] = gen_intrinsic_t,
+    [INTRINSIC_ATOMIC_LOAD] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_STORE] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_EXCHANGE] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_CAS] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_FETCH_ADD] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_FETCH_SUB] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_FETCH_AND] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_FETCH_OR] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_FETCH_XOR] = gen_intrinsic_atomic,
+    [INTRINSIC_ATOMIC_THREAD_FENCE] = gen_intrinsic_atomic_fence,
+    [INTRINSIC_ATOMIC_SIGNAL_FENCE] = gen_intrinsic_atomic_fence,
+    [INTRINSIC_VLOAD] = gen_intrinsic_vector,
+    [INTRINSIC_VSTORE] = gen_intrinsic_vstore,
+    [INTRINSIC_VSHUFFLE] = gen_intrinsic_vshuffle,
+    [INTRINSIC_VCONVERT] = gen_intrinsic_vector,
+};
+
+// Array intrinsics on a known element type call helpers generated for that type. The header offset
+// and the element and key sizes are constants there, elements are copied by assignment, and arrays
+// still on std's default indexer are searched inline. The std functions remain the slow paths.
+typedef struct ArrayHelper {
+    Type *type;
+    bool apush;
+    bool find;
+    bool aget;
+} ArrayHelper;
+
+ArrayHelper *array_helpers;
+Map array_helper_map;
+Package *array_helper_package;
+
+const char *array_helper_name(Type *type) {
+    return strf("arr%d", type->typeid);
+}
+
+const char *get_array_helper_std_name(const char *name) {
+    Sym *sym = get_package_sym(array_helper_package, str_intern(name));
+    assert(sym);
+    return get_gen_name(sym);
+}
+
+bool is_array_helper_map_type(Type *type) {
+    return type && (type->kind == TYPE_STRUCT || type->kind == TYPE_TUPLE) && type->aggregate.num_fields == 2;
+}
+
+void gen_array_helpers(void) {
+    for (ArrayHelper *it = array_helpers; it != buf_end(array_helpers); it++) {
+        Type *type = it->type;
+        const char *name = array_helper_name(type);
+        const char *elem = type_to_cdecl(type, "");
+        const char *a = type_to_cdecl(type_ptr(type), "a");
+        const char *hdr = get_array_helper_std_name("Ahdr");
+        genlnf("INLINE %s *%s_hdr(%s) {", hdr, name, a);
+        gen_indent++;
+        // Matches alayout in std.
+        genlnf("size_t off_hdr = (sizeof(%s) + alignof(%s) - 1) & ~(alignof(%s) - 1);", elem, hdr, hdr);
+        genlnf("size_t off_elems = (off_hdr + offsetof(%s, buf) + alignof(%s) - 1) & ~(alignof(%s) - 1);", hdr, elem, elem);
+        genlnf("return (%s *)((char *)a - (off_elems - off_hdr));", hdr);
+        gen_indent--;
+        genlnf("}");
+        genlnf("INLINE %s *%s_ahdr(%s) { return a ? %s_hdr(a) : 0; }", hdr, name, a, name);
+        genlnf("INLINE size_t %s_alen(%s) { return a ? %s_hdr(a)->len : 0; }", name, a, name);
+        genlnf("INLINE size_t %s_acap(%s) { return a ? %s_hdr(a)->cap : 0; }", name, a, name);
+        genlnf("INLINE void %s_apop(%s) {", name, a);
+        gen_indent++;
+        genlnf("if (a && %s_hdr(a)->len > 0) {", name);
+        genlnf("    %s_hdr(a)->len--;", name);
+        genlnf("}");
+        gen_indent--;
+        genlnf("}");
+        if (it->apush) {
+            genlnf("INLINE size_t %s_apush(%s, %s) {", name, type_to_cdecl(type_ptr(type_ptr(type)), "ap"), type_to_cdecl(type, "v"));
+            gen_indent++;
+            genlnf("%s = *ap;", a);
+            genlnf("if (a && %s_hdr(a)->len < %s_hdr(a)->cap) {", name, name);
+            genlnf("    a[%s_hdr(a)->len] = v;", name);
+            genlnf("    return %s_hdr(a)->len++;", name);
+            genlnf("}");
+            genlnf("return %s((void **)ap, &v, sizeof(%s), alignof(%s));", get_array_helper_std_name("apush_func"), elem, elem);
+            gen_indent--;
+            genlnf("}");
+        }
+        if (it->find) {
+            genlnf("INLINE size_t %s_find(%s, void *k, size_t key_size) {", name, a);
+            gen_indent++;
+            genlnf("if (!a) {");
+            genlnf("    return 0;");
+            genlnf("}");
+            genlnf("%s *hdr = %s_hdr(a);", hdr, name);
+            genlnf("if (hdr->index.indexer == %s) {", get_array_helper_std_name("default_indexer"));
+            genlnf("    for (size_t i = 0; i < hdr->len; i++) {");
+            genlnf("        if (memcmp(&a[i], k, key_size) == 0) {");
+            genlnf("            return i;");
+            genlnf("        }");
+            genlnf("    }");
+            genlnf("    return hdr->len;");
+            genlnf("}");
+            genlnf("return hdr->index.indexer->get(hdr->index.data, a, k, hdr->len, sizeof(%s), key_size);", elem);
+            gen_indent--;
+            genlnf("}");
+            genlnf("INLINE bool %s_has(%s, void *k, size_t key_size) {", name, a);
+            genlnf("    return a && %s_find(a, k, key_size) != %s_hdr(a)->len;", name, name);
+            genlnf("}");
+        }
+        if (it->find && is_array_helper_map_type(type)) {
+            genlnf("INLINE void *%s_agetp(%s, void *k, size_t key_size) {", name, a);
+            gen_indent++;
+            genlnf("size_t i = %s_find(a, k, key_size);", name);
+            genlnf("return a && i != %s_hdr(a)->len ? &a[i].%s : 0;", name, type->aggregate.fields[1].name);
+            gen_indent--;
+            genlnf("}");
+        }
+        if (it->aget) {
+            // Misses read the value from the default element in front of the header, like aget_func.
+            genlnf("INLINE void *%s_aget(%s, void *k, size_t key_size) {", name, type_to_cdecl(type_ptr(type_ptr(type)), "ap"));
+            gen_indent++;
+            genlnf("%s = *ap;", a);
+            genlnf("if (!a) {");
+            genlnf("    return %s((void **)ap, k, key_size, sizeof(%s), alignof(%s));", get_array_helper_std_name("aget_func"), elem, elem);
+            genlnf("}");
+            genlnf("size_t i = %s_find(a, k, key_size);", name);
+            genlnf("size_t off_hdr = (sizeof(%s) + alignof(%s) - 1) & ~(alignof(%s) - 1);", elem, hdr, hdr);
+            genlnf("%s = i != %s_hdr(a)->len ? &a[i] : (%s *)((char *)%s_hdr(a) - off_hdr);", type_to_cdecl(type_ptr(type), "p"), name, elem, name);
+            genlnf("return &p->%s;", type->aggregate.fields[1].name);
+            gen_indent--;
+            genlnf("}");
+        }
+    }
+}
+
+// Registers the element type of an intrinsic call that has a specialized helper and returns it.
+Type *get_array_helper_type(Sym *sym, Expr *expr) {
+    switch (sym->intrinsic) {
+    case INTRINSIC_AHDR:
+    case INTRINSIC_ALEN:
+    case INTRINSIC_ACAP:
+    case INTRINSIC_APOP:
+    case INTRINSIC_APUSH:
+    case INTRINSIC_AGETVI:
+    case INTRINSIC_AGETV:
+        break;
+    case INTRINSIC_AGETI:
+    case INTRINSIC_AGETP:
+    case INTRINSIC_AGET:
+        if (!is_array_helper_map_type(get_intrinsic_array_base(expr))) {
+            return NULL;
+        }
+        break;
+    default:
+        return NULL;
+    }
+    Type *type = get_intrinsic_array_base(expr);
+    if (!type || type->kind == TYPE_VOID || is_array_type(type) || is_const_type(type) || type->size == 0) {
+        return NULL;
+    }
+    size_t index = (size_t)map_get(&array_helper_map, type);
+    if (!index) {
+        buf_push(array_helpers, (ArrayHelper){type});
+        index = buf_len(array_helpers);
+        map_put(&array_helper_map, type, (void *)index);
+    }
+    ArrayHelper *helper = &array_helpers[index - 1];
+    switch (sym->intrinsic) {
+    case INTRINSIC_APUSH:
+        helper->apush = true;
+        break;
+    case INTRINSIC_AGET:
+        helper->aget = true;
+        helper->find = true;
+        break;
+    case INTRINSIC_AGETVI:
+    case INTRINSIC_AGETV:
+    case INTRINSIC_AGETI:
+    case INTRINSIC_AGETP:
+        helper->find = true;
+        break;
+    default:
+        break;
+    }
+    array_helper_package = sym->home_package;
+    return type;
+}
+
+// Generates the key argument as a pointer to a temporary of the given type, like the std macros.
+void gen_array_helper_key(Expr *expr, Type *key_type) {
+    const char *key = type_to_cdecl(key_type, "");
+    genf("(%s[]){(", key);
+    gen_expr(expr);
+    genf(")}, sizeof(%s))", key);
+}
+
+bool gen_array_helper_call(Sym *sym, Expr *expr) {
+    Type *type = get_array_helper_type(sym, expr);
+    if (!type) {
+        return false;
+    }
+    const char *name = array_helper_name(type);
+    const char *ptr = type_to_cdecl(type_ptr(type), "");
+    const char *ptr_ptr = type_to_cdecl(type_ptr(type_ptr(type)), "");
+    switch (sym->intrinsic) {
+    case INTRINSIC_APUSH:
+        genf("%s_apush((%s)&(", name, ptr_ptr);
         gen_expr(expr->call.args[0]);
         genf("), (");
         gen_expr(expr->call.args[1]);
-        genf("), (");
-        gen_expr(expr->call.args[2]);
         genf("))");
-    } else if (sym->name == str_intern("acatn") || sym->name == str_intern("adeln")) {
-        genf("%s(%s, (", sym->name, type_to_cdecl(base, ""));
+        break;
+    case INTRINSIC_AGETVI:
+    case INTRINSIC_AGETV:
+        genf("%s_%s((%s)(", name, sym->intrinsic == INTRINSIC_AGETV ? "has" : "find", ptr);
         gen_expr(expr->call.args[0]);
-        genf("), (");
-        gen_expr(expr->call.args[1]);
-        genf("), (");
-        gen_expr(expr->call.args[2]);
-        genf("))");
-    } else if (sym->name == str_intern("aindex") || sym->name == str_intern("ageti") || sym->name == str_intern("adel")) {
-        genf("%s(%s, %s, (", sym->name, type_to_cdecl(base, ""), type_to_cdecl(key, ""));
+        genf("), ");
+        gen_array_helper_key(expr->call.args[1], type);
+        break;
+    case INTRINSIC_AGETI:
+        genf("%s_find((%s)(", name, ptr);
         gen_expr(expr->call.args[0]);
-        genf("), (");
-        gen_expr(expr->call.args[1]);
-        genf("))");
-    } else if (sym->name == str_intern("agetp") || sym->name == str_intern("aget")) {
-        genf("%s(%s, %s, %s, (", sym->name, type_to_cdecl(base, ""), type_to_cdecl(key, ""), type_to_cdecl(val, ""));
+        genf("), ");
+        gen_array_helper_key(expr->call.args[1], type->aggregate.fields[0].type);
+        break;
+    case INTRINSIC_AGETP:
+        genf("((%s)%s_agetp((%s)(", type_to_cdecl(type_ptr(type->aggregate.fields[1].type), ""), name, ptr);
         gen_expr(expr->call.args[0]);
-        genf("), (");
-        gen_expr(expr->call.args[1]);
-        genf("))");
-    } else if (sym->name == str_intern("aput")) {
-        genf("%s(%s, %s, (", sym->name, type_to_cdecl(base, ""), type_to_cdecl(key, ""));
+        genf("), ");
+        gen_array_helper_key(expr->call.args[1], type->aggregate.fields[0].type);
+        genf(")");
+        break;
+    case INTRINSIC_AGET:
+        genf("(*(%s)%s_aget((%s)&(", type_to_cdecl(type_ptr(type->aggregate.fields[1].type), ""), name, ptr_ptr);
         gen_expr(expr->call.args[0]);
-        genf("), (");
-        gen_expr(expr->call.args[1]);
-        genf("), (");
-        gen_expr(expr->call.args[2]);
-        genf("))");
-    } else if (sym->name == str_intern("ahdrsize") || sym->name == str_intern("ahdralign") || sym->name == str_intern("ahdr") ||
-        sym->name == str_intern("alen") || sym->name == str_intern("acap") || sym->name == str_intern("afree") ||
-        sym->name == str_intern("aclear") || sym->name == str_intern("apop")) {
-        genf("%s(%s, (", sym->name, type_to_cdecl(base, ""));
+        genf("), ");
+        gen_array_helper_key(expr->call.args[1], type->aggregate.fields[0].type);
+        genf(")");
+        break;
+    default:
+        genf("%s_%s((%s)(", name, sym->name, ptr);
         gen_expr(expr->call.args[0]);
         genf("))");
-    } else if (sym->name == str_intern("anew")) {
-        Type *result_type = get_resolved_type(expr);
-        assert(is_ptr_type(result_type));
-        genf("%s(%s, ", sym->name, type_to_cdecl(result_type->base, ""));
-        gen_expr(expr->call.args[0]);
-        genf(")");
-    } else {
+        break;
+    }
+    return true;
+}
+
+void gen_intrinsic(Sym *sym, Expr *expr) {
+    GenIntrinsicFunc gen = gen_intrinsic_funcs[sym->intrinsic];
+    if (!gen) {
         fatal_error(expr->pos, "Call to unimplemented intrinsic %s", sym->name);
     }
+    if (!gen_array_helper_call(sym, expr)) {
+        gen(sym, expr);
+    }
+}
+
+// Under -allocsites, new expressions and calls that may allocate first store their source position
+// in the thread-local alloc_site, where allocators such as TraceAllocator can attribute the memory.
+// Code in system packages is left alone so that allocations keep the site of the user code that
+// called into it.
+Package *gen_package;
+
+bool is_alloc_site_gen(void) {
+    return flag_allocsites && !(gen_package && gen_package->is_system);
+}
+
+bool is_alloc_site_call(Sym *sym) {
+    if (!is_alloc_site_gen() || !sym || sym->kind != SYM_FUNC) {
+        return false;
+    }
+    switch (sym->intrinsic) {
+    case INTRINSIC_APUSH:
+    case INTRINSIC_APUTV:
+    case INTRINSIC_ASETCAP:
+    case INTRINSIC_AFIT:
+    case INTRINSIC_ACAT:
+    case INTRINSIC_ACATN:
+    case INTRINSIC_AFILL:
+    case INTRINSIC_APUT:
+    case INTRINSIC_AGET:
+    case INTRINSIC_ANEW:
+    case INTRINSIC_QNEW:
+    case INTRINSIC_QPUSH:
+        return true;
+    default:
+        break;
+    }
+    return sym->home_package == builtin_package && (sym->name == str_intern("alloc") || sym->name == str_intern("generic_alloc") || sym->name == str_intern("generic_realloc"));
+}
+
+void gen_alloc_site(SrcPos pos) {
+    SrcLoc loc = get_src_loc(pos);
+    genf("(alloc_site = ");
+    gen_str(strf("%s:%d", loc.name, loc.line), false);
+    genf(", ");
 }
 
 void gen_expr_new(Expr *expr) {
@@ -660,6 +1154,586 @@ void gen_expr_new(Expr *expr) {
     }
 }
 
+const char *switch_val_lit(long long val, bool is_signed);
+
+// The C backend inlines small functions itself rather than leaving it to the C compiler, which can't
+// see through the generated wrappers and function pointers. A function whose body is a single
+// return is inlined at a call by substituting its arguments for its parameters. A void function is
+// inlined at a call statement as a block that copies its arguments to temporaries. Functions marked
+// @inline are inlined up to -inlinebudget AST nodes, other functions only when they're trivial.
+
+enum {
+    MAX_TRIVIAL_INLINE_SIZE = 8,
+    MAX_INLINE_DEPTH = 4,
+};
+
+typedef enum InlineForm {
+    INLINE_NONE,
+    INLINE_EXPR,
+    INLINE_STMT,
+} InlineForm;
+
+typedef struct InlineInfo {
+    InlineForm form;
+    const char *reason;
+    bool marked;
+    bool has_side_effects;
+    int *uses;
+    // Parameters used where the body's side effects may come first or unsequenced.
+    bool *exposed;
+} InlineInfo;
+
+typedef struct InlineScan {
+    Decl *decl;
+    bool substitute;
+    int size;
+    int *uses;
+    // Side effects in the body, and how many of them enclose the current expression. A call's or
+    // modification's own operands are evaluated before its side effect, other expressions may not be.
+    int num_effects;
+    int effect_depth;
+    int *min_effect_depth;
+    const char *reason;
+} InlineScan;
+
+typedef struct InlineFrame {
+    Sym *sym;
+    // NULL when the parameters are bound to temporaries.
+    Expr **args;
+    int id;
+    struct InlineFrame *parent;
+} InlineFrame;
+
+Decl *gen_func;
+InlineFrame *inline_frame;
+int inline_depth;
+int inline_temp_id;
+int num_inlined_calls;
+int num_inline_calls;
+Map inline_info_map;
+Map inline_reported_map;
+
+int get_inline_param(Decl *decl, Expr *expr) {
+    if (expr->kind != EXPR_NAME || get_resolved_sym(expr)) {
+        return -1;
+    }
+    for (size_t i = 0; i < decl->func.num_params; i++) {
+        if (decl->func.params[i].name == expr->name) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Returns the parameter whose storage the expression designates, or -1.
+int get_inline_place_param(Decl *decl, Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        return get_inline_place_param(decl, expr->paren.expr);
+    case EXPR_FIELD:
+        if (get_resolved_sym(expr) || is_ptr_type(unqualify_type(get_resolved_type(expr->field.expr)))) {
+            return -1;
+        }
+        return get_inline_place_param(decl, expr->field.expr);
+    case EXPR_INDEX:
+        if (is_ptr_type(unqualify_type(get_resolved_type(expr->index.expr)))) {
+            return -1;
+        }
+        return get_inline_place_param(decl, expr->index.expr);
+    default:
+        return get_inline_param(decl, expr);
+    }
+}
+
+void set_inline_reason(InlineScan *scan, const char *reason) {
+    if (!scan->reason) {
+        scan->reason = reason;
+    }
+}
+
+void scan_inline_expr(InlineScan *scan, Expr *expr);
+InlineInfo *get_inline_info(Sym *sym);
+
+// Calls to @pure functions and to functions that are themselves substituted without side effects
+// don't count. A function whose info is still being computed is part of a cycle and counts.
+bool is_inline_pure_call(Expr *expr) {
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    if (is_resolved_const(expr) || (sym && sym->kind == SYM_TYPE)) {
+        return true;
+    }
+    if (sym && sym->kind == SYM_FUNC && sym->decl && get_decl_note(sym->decl, pure_name)) {
+        return true;
+    }
+    if (!sym || sym->kind != SYM_FUNC || !sym->decl || sym->decl->kind != DECL_FUNC) {
+        return false;
+    }
+    InlineInfo *info = map_get(&inline_info_map, sym);
+    if (info && !info->uses) {
+        return false;
+    }
+    info = get_inline_info(sym);
+    return info->form == INLINE_EXPR && !info->has_side_effects;
+}
+
+// A substituted argument isn't an lvalue, so the body can't take the address of a parameter.
+void scan_inline_place(InlineScan *scan, Expr *expr) {
+    if (scan->substitute && get_inline_place_param(scan->decl, expr) >= 0) {
+        set_inline_reason(scan, "uses the address of a parameter");
+    }
+}
+
+
+void scan_inline_effect_expr(InlineScan *scan, Expr *expr) {
+    scan->effect_depth++;
+    scan_inline_expr(scan, expr);
+    scan->effect_depth--;
+}
+
+// The first operand of ?:, && and || is evaluated before the side effects in the others.
+void scan_inline_sequenced_expr(InlineScan *scan, Expr *first, Expr *second, Expr *third) {
+    int num_effects = scan->num_effects;
+    scan_inline_expr(scan, second);
+    scan_inline_expr(scan, third);
+    int num_later_effects = scan->num_effects - num_effects;
+    scan->effect_depth += num_later_effects;
+    scan_inline_expr(scan, first);
+    scan->effect_depth -= num_later_effects;
+}
+
+void scan_inline_expr(InlineScan *scan, Expr *expr) {
+    if (!expr) {
+        return;
+    }
+    scan->size++;
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        scan_inline_expr(scan, expr->paren.expr);
+        break;
+    case EXPR_NAME: {
+        int i = get_inline_param(scan->decl, expr);
+        if (i >= 0) {
+            scan->uses[i]++;
+            scan->min_effect_depth[i] = MIN(scan->min_effect_depth[i], scan->effect_depth);
+        }
+        break;
+    }
+    case EXPR_CAST:
+        scan_inline_expr(scan, expr->cast.expr);
+        break;
+    case EXPR_CALL: {
+        bool has_effect = !is_inline_pure_call(expr);
+        scan->num_effects += has_effect;
+        scan->effect_depth += has_effect;
+        scan_inline_expr(scan, expr->call.expr);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            scan_inline_expr(scan, expr->call.args[i]);
+        }
+        scan->effect_depth -= has_effect;
+        break;
+    }
+    case EXPR_INDEX:
+        if (is_array_type(unqualify_type(get_resolved_type(expr)))) {
+            scan_inline_place(scan, expr);
+        }
+        scan_inline_expr(scan, expr->index.expr);
+        scan_inline_expr(scan, expr->index.index);
+        break;
+    case EXPR_FIELD:
+        if (!get_resolved_sym(expr)) {
+            if (is_array_type(unqualify_type(get_resolved_type(expr)))) {
+                scan_inline_place(scan, expr);
+            }
+            scan_inline_expr(scan, expr->field.expr);
+        }
+        break;
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            scan_inline_expr(scan, expr->compound.fields[i].index);
+            scan_inline_expr(scan, expr->compound.fields[i].init);
+        }
+        break;
+    case EXPR_UNARY:
+        if (expr->unary.op == TOKEN_AND) {
+            scan_inline_place(scan, expr->unary.expr);
+        }
+        scan_inline_expr(scan, expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        if (expr->binary.op == TOKEN_AND_AND || expr->binary.op == TOKEN_OR_OR) {
+            scan_inline_sequenced_expr(scan, expr->binary.left, expr->binary.right, NULL);
+        } else {
+            scan_inline_expr(scan, expr->binary.left);
+            scan_inline_expr(scan, expr->binary.right);
+        }
+        break;
+    case EXPR_TERNARY:
+        scan_inline_sequenced_expr(scan, expr->ternary.cond, expr->ternary.then_expr, expr->ternary.else_expr);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        scan_inline_expr(scan, expr->sizeof_expr);
+        break;
+    case EXPR_MODIFY:
+        scan->num_effects++;
+        scan_inline_place(scan, expr->modify.expr);
+        scan_inline_effect_expr(scan, expr->modify.expr);
+        break;
+    case EXPR_NEW:
+        scan->num_effects++;
+        scan_inline_effect_expr(scan, expr->new_expr.alloc);
+        scan_inline_effect_expr(scan, expr->new_expr.len);
+        scan_inline_effect_expr(scan, expr->new_expr.arg);
+        break;
+    default:
+        break;
+    }
+}
+
+void scan_inline_stmt(InlineScan *scan, Stmt *stmt);
+
+void scan_inline_stmt_block(InlineScan *scan, StmtList block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        scan_inline_stmt(scan, block.stmts[i]);
+    }
+}
+
+void scan_inline_stmt(InlineScan *scan, Stmt *stmt) {
+    if (!stmt) {
+        return;
+    }
+    scan->size++;
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        set_inline_reason(scan, "returns from inside its body");
+        break;
+    case STMT_DECL:
+    case STMT_LABEL:
+    case STMT_GOTO:
+        set_inline_reason(scan, "has a label or local declaration");
+        break;
+    case STMT_NOTE:
+        if (stmt->note.name == assert_name) {
+            scan_inline_expr(scan, stmt->note.args[0].expr);
+        } else if (stmt->note.name == foreign_name) {
+            set_inline_reason(scan, "has a #foreign directive");
+        }
+        break;
+    case STMT_BLOCK:
+        scan_inline_stmt_block(scan, stmt->block);
+        break;
+    case STMT_IF:
+        scan_inline_stmt(scan, stmt->if_stmt.init);
+        scan_inline_expr(scan, stmt->if_stmt.cond);
+        scan_inline_stmt_block(scan, stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            scan_inline_expr(scan, stmt->if_stmt.elseifs[i].cond);
+            scan_inline_stmt_block(scan, stmt->if_stmt.elseifs[i].block);
+        }
+        scan_inline_stmt_block(scan, stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        scan_inline_expr(scan, stmt->while_stmt.cond);
+        scan_inline_stmt_block(scan, stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        scan_inline_stmt(scan, stmt->for_stmt.init);
+        scan_inline_expr(scan, stmt->for_stmt.cond);
+        scan_inline_stmt(scan, stmt->for_stmt.next);
+        scan_inline_stmt_block(scan, stmt->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        scan_inline_expr(scan, stmt->switch_stmt.expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            scan_inline_stmt_block(scan, stmt->switch_stmt.cases[i].block);
+        }
+        break;
+    case STMT_ASSIGN:
+        scan_inline_expr(scan, stmt->assign.left);
+        scan_inline_expr(scan, stmt->assign.right);
+        break;
+    case STMT_INIT:
+        scan_inline_expr(scan, stmt->init.expr);
+        break;
+    case STMT_EXPR:
+        scan_inline_expr(scan, stmt->expr);
+        break;
+    default:
+        break;
+    }
+}
+
+InlineInfo *get_inline_info(Sym *sym) {
+    InlineInfo *info = map_get(&inline_info_map, sym);
+    if (info) {
+        return info;
+    }
+    info = xcalloc(1, sizeof(InlineInfo));
+    map_put(&inline_info_map, sym, info);
+    Decl *decl = sym->decl;
+    info->marked = get_decl_note(decl, inline_name) != NULL;
+    int budget = info->marked ? flag_inlinebudget : MIN(flag_inlinebudget, MAX_TRIVIAL_INLINE_SIZE);
+    InlineScan scan = {decl, .uses = xcalloc(decl->func.num_params + 1, sizeof(int))};
+    scan.min_effect_depth = xmalloc((decl->func.num_params + 1) * sizeof(int));
+    for (size_t i = 0; i <= decl->func.num_params; i++) {
+        scan.min_effect_depth[i] = INT_MAX;
+    }
+    StmtList block = decl->func.block;
+    InlineForm form = INLINE_NONE;
+    if (get_decl_note(decl, noinline_name)) {
+        scan.reason = "is marked @noinline";
+    } else if (decl->is_incomplete || is_decl_foreign(decl)) {
+        scan.reason = "is foreign";
+    } else if (decl->func.has_varargs) {
+        scan.reason = "is variadic";
+    } else if (block.num_stmts == 1 && block.stmts[0]->kind == STMT_RETURN && block.stmts[0]->expr) {
+        Expr *expr = block.stmts[0]->expr;
+        form = INLINE_EXPR;
+        scan.substitute = true;
+        scan.size = 1;
+        scan_inline_expr(&scan, expr);
+        if (expr->kind == EXPR_COMPOUND) {
+            set_inline_reason(&scan, "returns a compound literal");
+        }
+    } else if (sym->type->func.ret == type_void) {
+        form = INLINE_STMT;
+        scan_inline_stmt_block(&scan, block);
+    } else {
+        scan.reason = "returns a value from a body with more than one statement";
+    }
+    if (!scan.reason && scan.size > budget) {
+        scan.reason = strf("is larger than the inline budget (%d > %d)", scan.size, budget);
+    }
+    info->form = scan.reason ? INLINE_NONE : form;
+    info->reason = scan.reason;
+    info->has_side_effects = scan.num_effects != 0;
+    info->exposed = xcalloc(decl->func.num_params + 1, sizeof(bool));
+    for (size_t i = 0; i < decl->func.num_params; i++) {
+        info->exposed[i] = scan.min_effect_depth[i] < scan.num_effects;
+    }
+    free(scan.min_effect_depth);
+    info->uses = scan.uses;
+    return info;
+}
+
+// Cheap and free of side effects, so the argument can be substituted any number of times.
+bool is_inline_simple_arg(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_NAME:
+    case EXPR_INT:
+    case EXPR_FLOAT:
+    case EXPR_STR:
+    case EXPR_SIZEOF_TYPE:
+    case EXPR_ALIGNOF_EXPR:
+    case EXPR_ALIGNOF_TYPE:
+    case EXPR_TYPEOF_EXPR:
+    case EXPR_TYPEOF_TYPE:
+    case EXPR_OFFSETOF:
+        return true;
+    case EXPR_PAREN:
+        return is_inline_simple_arg(expr->paren.expr);
+    case EXPR_CAST:
+        return is_inline_simple_arg(expr->cast.expr);
+    case EXPR_FIELD:
+        return get_resolved_sym(expr) || is_inline_simple_arg(expr->field.expr);
+    case EXPR_INDEX:
+        return is_inline_simple_arg(expr->index.expr) && is_inline_simple_arg(expr->index.index);
+    case EXPR_UNARY:
+        return is_inline_simple_arg(expr->unary.expr);
+    default:
+        return false;
+    }
+}
+
+// Free of side effects, so the argument can be substituted where it isn't evaluated in call order.
+bool is_inline_pure_arg(Expr *expr) {
+    if (!expr) {
+        return true;
+    }
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        return is_inline_pure_arg(expr->paren.expr);
+    case EXPR_CAST:
+        return is_inline_pure_arg(expr->cast.expr);
+    case EXPR_CALL: {
+        Sym *sym = get_resolved_sym(expr->call.expr);
+        if (sym && sym->kind == SYM_TYPE) {
+            return is_inline_pure_arg(expr->call.args[0]);
+        }
+        return sym && sym->kind == SYM_FUNC && is_resolved_const(expr);
+    }
+    case EXPR_INDEX:
+        return is_inline_pure_arg(expr->index.expr) && is_inline_pure_arg(expr->index.index);
+    case EXPR_FIELD:
+        return get_resolved_sym(expr) || is_inline_pure_arg(expr->field.expr);
+    case EXPR_UNARY:
+        return is_inline_pure_arg(expr->unary.expr);
+    case EXPR_BINARY:
+        return is_inline_pure_arg(expr->binary.left) && is_inline_pure_arg(expr->binary.right);
+    case EXPR_TERNARY:
+        return is_inline_pure_arg(expr->ternary.cond) && is_inline_pure_arg(expr->ternary.then_expr) && is_inline_pure_arg(expr->ternary.else_expr);
+    case EXPR_COMPOUND:
+    case EXPR_MODIFY:
+    case EXPR_NEW:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Doesn't read any storage, so side effects of the substituted body can't change its value.
+bool is_inline_const_arg(Expr *expr) {
+    if (is_resolved_const(expr)) {
+        return true;
+    }
+    switch (expr->kind) {
+    case EXPR_INT:
+    case EXPR_FLOAT:
+    case EXPR_STR:
+    case EXPR_SIZEOF_TYPE:
+    case EXPR_ALIGNOF_TYPE:
+    case EXPR_TYPEOF_TYPE:
+    case EXPR_OFFSETOF:
+        return true;
+    case EXPR_PAREN:
+        return is_inline_const_arg(expr->paren.expr);
+    case EXPR_CAST:
+        return is_inline_const_arg(expr->cast.expr);
+    default:
+        return false;
+    }
+}
+
+const char *get_inline_call_reason(Sym *sym, InlineInfo *info, Expr *expr, bool is_stmt) {
+    if (info->form == INLINE_NONE) {
+        return info->reason;
+    }
+    if (info->form == INLINE_STMT && !is_stmt) {
+        return "is called outside of a statement";
+    }
+    if (inline_depth >= MAX_INLINE_DEPTH) {
+        return "is nested too deeply";
+    }
+    if (sym->decl == gen_func) {
+        return "is recursive";
+    }
+    for (InlineFrame *frame = inline_frame; frame; frame = frame->parent) {
+        if (frame->sym == sym) {
+            return "is recursive";
+        }
+    }
+    if (info->form == INLINE_EXPR) {
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            Expr *arg = expr->call.args[i];
+            if (!is_inline_pure_arg(arg)) {
+                return strf("has an argument %d with side effects", (int)i + 1);
+            }
+            if (info->uses[i] > 1 && !is_inline_simple_arg(arg)) {
+                return strf("uses a complex argument %d more than once", (int)i + 1);
+            }
+            // The argument would be evaluated unsequenced with the body's side effects instead of
+            // before them, and they may modify what it reads.
+            if (info->exposed[i] && !is_inline_const_arg(arg)) {
+                return strf("has side effects that may come before argument %d", (int)i + 1);
+            }
+        }
+    }
+    return NULL;
+}
+
+const char *get_inline_caller_name(void) {
+    return inline_frame ? inline_frame->sym->name : gen_func->name;
+}
+
+// Decides whether to inline a direct call and reports the decision once per call site.
+bool can_inline_call(Expr *expr, bool is_stmt) {
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    if (!gen_func || !flag_inlinebudget || !sym || sym->kind != SYM_FUNC || !sym->decl || sym->decl->kind != DECL_FUNC) {
+        return false;
+    }
+    InlineInfo *info = get_inline_info(sym);
+    const char *reason = get_inline_call_reason(sym, info, expr, is_stmt);
+    if (!map_get(&inline_reported_map, expr) && (is_stmt || info->form != INLINE_STMT)) {
+        map_put(&inline_reported_map, expr, (void *)1);
+        if (info->marked || info->form != INLINE_NONE) {
+            num_inline_calls++;
+            num_inlined_calls += !reason;
+            if (flag_inlinereport) {
+                SrcLoc loc = get_src_loc(expr->pos);
+                if (reason) {
+                    printf("%s(%d): not inlined %s into %s: %s %s\n", loc.name, loc.line, sym->name, get_inline_caller_name(), sym->name, reason);
+                } else {
+                    printf("%s(%d): inlined %s into %s\n", loc.name, loc.line, sym->name, get_inline_caller_name());
+                }
+            }
+        }
+    }
+    return !reason;
+}
+
+Type *get_inline_param_type(Sym *sym, int i) {
+    Type *type = unqualify_type(sym->type->func.params[i]);
+    return is_array_type(type) ? type_decay(type) : type;
+}
+
+const char *get_inline_temp_name(InlineFrame *frame, int i) {
+    return strf("__inl%d_%s", frame->id, frame->sym->decl->func.params[i].name);
+}
+
+// Generates a reference to a parameter of the innermost inlined function.
+bool gen_inline_param(Expr *expr) {
+    InlineFrame *frame = inline_frame;
+    if (!frame) {
+        return false;
+    }
+    int i = get_inline_param(frame->sym->decl, expr);
+    if (i < 0) {
+        return false;
+    }
+    if (!frame->args) {
+        genf("%s", get_inline_temp_name(frame, i));
+        return true;
+    }
+    Type *type = get_inline_param_type(frame->sym, i);
+    // The argument belongs to the caller's scope.
+    inline_frame = frame->parent;
+    if (is_scalar_type(type)) {
+        genf("((%s)(", type_to_cdecl(type, ""));
+        gen_expr(frame->args[i]);
+        genf("))");
+    } else {
+        gen_paren_expr(frame->args[i]);
+    }
+    inline_frame = frame;
+    return true;
+}
+
+bool gen_inline_expr_call(Expr *expr) {
+    if (!can_inline_call(expr, false)) {
+        return false;
+    }
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    InlineFrame frame = {sym, expr->call.args, 0, inline_frame};
+    Type *ret = unqualify_type(sym->type->func.ret);
+    inline_frame = &frame;
+    inline_depth++;
+    if (is_scalar_type(ret) || ret == type_void) {
+        genf("((%s)(", type_to_cdecl(ret, ""));
+        gen_expr(sym->decl->func.block.stmts[0]->expr);
+        genf("))");
+    } else {
+        gen_paren_expr(sym->decl->func.block.stmts[0]->expr);
+    }
+    inline_depth--;
+    inline_frame = frame.parent;
+    return true;
+}
+
+void print_inline_stats(void) {
+    if (num_inline_calls) {
+        printf("Inlined %d of %d calls to inline candidates\n", num_inlined_calls, num_inline_calls);
+    }
+}
+
 void gen_expr(Expr *expr) {
     Type *type = NULL;
     Type *conv = type_conv(expr);
@@ -706,7 +1780,9 @@ void gen_expr(Expr *expr) {
         gen_str(expr->str_lit.val, expr->str_lit.mod == MOD_MULTILINE);
         break;
     case EXPR_NAME:
-        genf("%s", get_gen_name_or_default(expr, expr->name));
+        if (!gen_inline_param(expr)) {
+            genf("%s", get_gen_name_or_default(expr, expr->name));
+        }
         break;
     case EXPR_CAST:
         genf("(%s)(", typespec_to_cdecl(expr->cast.type, ""));
@@ -715,14 +1791,27 @@ void gen_expr(Expr *expr) {
         break;
     case EXPR_CALL: {
         Sym *sym = get_resolved_sym(expr->call.expr);
-        if (is_intrinsic(sym)) {
+        bool alloc_site = is_alloc_site_call(sym);
+        if (alloc_site) {
+            gen_alloc_site(expr->pos);
+        }
+        if (is_elided_free(expr)) {
+            // Frees a new object that escape analysis moved to the stack.
+            genf("((void)0)");
+        } else if (is_intrinsic(sym)) {
             gen_intrinsic(sym, expr);
-        } else {
-            if (sym && sym->kind == SYM_TYPE) {
-                genf("(%s)", get_gen_name(sym));
-            } else {
-                gen_expr(expr->call.expr);
-            }
+        } else if (sym && sym->kind == SYM_FUNC && is_resolved_const(expr)) {
+            // Evaluated at compile time.
+            Type *type = get_resolved_type(expr);
+            bool sign = is_signed_type(eval_scalar_type(type));
+            genf("((%s)%s)", type_to_cdecl(type, ""), switch_val_lit(get_resolved_val(expr).ll, sign));
+        } else if (sym && sym->kind == SYM_TYPE) {
+            // Parenthesized so that a following index or field access applies to the converted value.
+            genf("((%s)(", get_gen_name(sym));
+            gen_expr(expr->call.args[0]);
+            genf("))");
+        } else if (!gen_inline_expr_call(expr)) {
+            gen_expr(expr->call.expr);
             genf("(");
             for (size_t i = 0; i < expr->call.num_args; i++) {
                 if (i != 0) {
@@ -732,11 +1821,20 @@ void gen_expr(Expr *expr) {
             }
             genf(")");
         }
+        if (alloc_site) {
+            genf(")");
+        }
         break;
     }
     case EXPR_INDEX: {
         Type *type = unqualify_type(get_resolved_type(expr->index.expr));
-        if (is_aggregate_type(type)) {
+        if (is_soa_array_type(type)) {
+            genf("%s_get(&(", soa_array_name(type));
+            gen_expr(expr->index.expr);
+            genf("), ");
+            gen_expr(expr->index.index);
+            genf(")");
+        } else if (is_aggregate_type(type)) {
             gen_expr(expr->index.expr);
             genf(".");
             long long i = get_resolved_val(expr->index.index).ll;
@@ -753,6 +1851,13 @@ void gen_expr(Expr *expr) {
         Sym *sym = get_resolved_sym(expr);
         if (sym) {
             genf("(%s)", get_gen_name(sym));
+        } else if (is_soa_index_expr(expr->field.expr)) {
+            Expr *index_expr = expr->field.expr;
+            genf("(");
+            gen_expr(index_expr->index.expr);
+            genf(").%s[", expr->field.name);
+            gen_expr(index_expr->index.index);
+            genf("]");
         } else {
             gen_expr(expr->field.expr);
             Type *type = unqualify_type(get_resolved_type(expr->field.expr));
@@ -833,7 +1938,13 @@ void gen_expr(Expr *expr) {
         }
         break;
     case EXPR_NEW:
-        gen_expr_new(expr);
+        if (is_alloc_site_gen()) {
+            gen_alloc_site(expr->pos);
+            gen_expr_new(expr);
+            genf(")");
+        } else {
+            gen_expr_new(expr);
+        }
         break;
     default:
         assert(0);
@@ -860,12 +1971,42 @@ void gen_stmt_block(StmtList block) {
     genlnf("}");
 }
 
+bool gen_inline_stmt_call(Expr *expr) {
+    if (expr->kind != EXPR_CALL) {
+        return false;
+    }
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    if (!sym || sym->kind != SYM_FUNC || !sym->decl || sym->decl->kind != DECL_FUNC || get_inline_info(sym)->form != INLINE_STMT || !can_inline_call(expr, true)) {
+        return false;
+    }
+    InlineFrame frame = {sym, NULL, ++inline_temp_id, inline_frame};
+    genlnf("{");
+    gen_indent++;
+    for (size_t i = 0; i < expr->call.num_args; i++) {
+        genlnf("%s = ", type_to_cdecl(get_inline_param_type(sym, (int)i), get_inline_temp_name(&frame, (int)i)));
+        gen_expr(expr->call.args[i]);
+        genf(";");
+    }
+    inline_frame = &frame;
+    inline_depth++;
+    StmtList block = sym->decl->func.block;
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        gen_stmt(block.stmts[i]);
+    }
+    inline_depth--;
+    inline_frame = frame.parent;
+    gen_indent--;
+    genlnf("}");
+    return true;
+}
+
 void gen_simple_stmt(Stmt *stmt) {
     switch (stmt->kind) {
     case STMT_EXPR:
         gen_expr(stmt->expr);
         break;
     case STMT_INIT:
+        gen_align_note(stmt->notes);
         if (stmt->init.type) {
             Typespec *init_typespec = stmt->init.type;
             bool incomplete = is_incomplete_array_typespec(stmt->init.type);
@@ -910,7 +2051,7 @@ void gen_simple_stmt(Stmt *stmt) {
             assert(stmt->assign.op == TOKEN_ADD_ASSIGN);
             Type *left_type = get_resolved_type(stmt->assign.left);
             if (stmt->assign.left->kind == EXPR_NAME) {
-                const char *name = get_gen_name_or_default(stmt->assign.left, stmt->assign.left->name);
+                const char *name = gen_expr_str(stmt->assign.left);
                 genf("%s = (char *)(%s) + ", name, name);
                 gen_expr(stmt->assign.right);
             } else {
@@ -922,6 +2063,16 @@ void gen_simple_stmt(Stmt *stmt) {
                 gen_expr(stmt->assign.right);
                 genf("); } while(0)");
             }
+        } else if (is_soa_index_expr(stmt->assign.left)) {
+            assert(stmt->assign.op == TOKEN_ASSIGN);
+            Expr *left = stmt->assign.left;
+            genf("%s_set(&(", soa_array_name(unqualify_type(get_resolved_type(left->index.expr))));
+            gen_expr(left->index.expr);
+            genf("), ");
+            gen_expr(left->index.index);
+            genf(", ");
+            gen_expr(stmt->assign.right);
+            genf(")");
         } else {
             gen_expr(stmt->assign.left);
             genf(" %s ", token_kind_name(stmt->assign.op));
@@ -938,6 +2089,256 @@ static bool is_char_lit(Expr *expr) {
     return expr->kind == EXPR_INT && expr->int_lit.mod == MOD_CHAR;
 }
 
+enum {
+    // Ranges spanning more values than this aren't expanded into individual case labels.
+    MAX_SWITCH_RANGE_LABELS = 16,
+    // Switches whose case values fit in a span this size, at least half of it covered, have all their
+    // ranges expanded into case labels so the C compiler can lower the whole switch to a jump table.
+    MAX_SWITCH_TABLE_SPAN = 1024,
+    // Wide ranges are dispatched with a binary search instead of an if-chain from this many.
+    MIN_SWITCH_RANGE_BSEARCH = 4,
+};
+
+typedef struct SwitchRange {
+    long long start;
+    long long end;
+    size_t case_index;
+} SwitchRange;
+
+int gen_switch_count;
+
+// Case values are stored as long long, so unsigned values at or above 2^63 are negative here and
+// have to be compared as unsigned long long when the switch operand is unsigned.
+bool switch_val_less(long long x, long long y, bool is_signed) {
+    return is_signed ? x < y : (unsigned long long)x < (unsigned long long)y;
+}
+
+unsigned long long switch_pattern_width(SwitchCasePattern pattern) {
+    if (!pattern.end) {
+        return 0;
+    }
+    return (unsigned long long)get_resolved_val(pattern.end).ll - (unsigned long long)get_resolved_val(pattern.start).ll;
+}
+
+bool is_dense_switch(Stmt *stmt, bool is_signed) {
+    long long min = 0;
+    long long max = 0;
+    unsigned long long covered = 0;
+    bool has_ranges = false;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase switch_case = stmt->switch_stmt.cases[i];
+        for (size_t j = 0; j < switch_case.num_patterns; j++) {
+            SwitchCasePattern pattern = switch_case.patterns[j];
+            unsigned long long width = switch_pattern_width(pattern);
+            if (width >= MAX_SWITCH_TABLE_SPAN) {
+                return false;
+            }
+            long long start = get_resolved_val(pattern.start).ll;
+            long long end = pattern.end ? get_resolved_val(pattern.end).ll : start;
+            if (covered == 0 || switch_val_less(start, min, is_signed)) {
+                min = start;
+            }
+            if (covered == 0 || switch_val_less(max, end, is_signed)) {
+                max = end;
+            }
+            covered += width + 1;
+            has_ranges |= pattern.end != NULL;
+        }
+    }
+    unsigned long long span = (unsigned long long)max - (unsigned long long)min;
+    return has_ranges && span < MAX_SWITCH_TABLE_SPAN && covered * 2 > span;
+}
+
+bool is_wide_switch_range(SwitchCasePattern pattern, bool is_dense) {
+    return !is_dense && switch_pattern_width(pattern) >= MAX_SWITCH_RANGE_LABELS;
+}
+
+int switch_range_cmp_signed(const void *a, const void *b) {
+    long long x = ((const SwitchRange *)a)->start;
+    long long y = ((const SwitchRange *)b)->start;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+int switch_range_cmp_unsigned(const void *a, const void *b) {
+    unsigned long long x = ((const SwitchRange *)a)->start;
+    unsigned long long y = ((const SwitchRange *)b)->start;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+const char *switch_val_lit(long long val, bool is_signed) {
+    return is_signed ? strf("%lldll", val) : strf("%lluull", (unsigned long long)val);
+}
+
+void gen_switch_dispatch(int switch_index, SwitchRange *ranges, size_t num_ranges, bool is_signed) {
+    if (num_ranges < MIN_SWITCH_RANGE_BSEARCH) {
+        for (size_t i = 0; i < num_ranges; i++) {
+            genlnf("if (ion__switch%d >= %s && ion__switch%d <= %s) goto ion__switch%d_case%zu;",
+                switch_index, switch_val_lit(ranges[i].start, is_signed), switch_index, switch_val_lit(ranges[i].end, is_signed),
+                switch_index, ranges[i].case_index);
+        }
+        return;
+    }
+    size_t mid = num_ranges / 2;
+    genlnf("if (ion__switch%d < %s) {", switch_index, switch_val_lit(ranges[mid].start, is_signed));
+    gen_indent++;
+    gen_switch_dispatch(switch_index, ranges, mid, is_signed);
+    gen_indent--;
+    genlnf("} else if (ion__switch%d <= %s) {", switch_index, switch_val_lit(ranges[mid].end, is_signed));
+    gen_indent++;
+    genlnf("goto ion__switch%d_case%zu;", switch_index, ranges[mid].case_index);
+    gen_indent--;
+    genlnf("} else {");
+    gen_indent++;
+    gen_switch_dispatch(switch_index, ranges + mid + 1, num_ranges - mid - 1, is_signed);
+    gen_indent--;
+    genlnf("}");
+}
+
+// Short ranges, and all ranges of a dense switch, are expanded into case labels, which the C
+// compiler can turn into jump tables. Wide ranges use GCC/Clang case ranges where available, and otherwise are dispatched from
+// the default case with an if-chain or a binary search that jumps to the case's label.
+void gen_switch_range_dispatch(int switch_index, SwitchRange *ranges, bool is_signed) {
+    if (!ranges) {
+        return;
+    }
+    genlnf("#ifndef CASE_RANGES");
+    gen_switch_dispatch(switch_index, ranges, buf_len(ranges), is_signed);
+    genlnf("#endif");
+}
+
+void gen_stmt_switch(Stmt *stmt) {
+    Type *type = unqualify_type(get_resolved_type(stmt->switch_stmt.expr));
+    bool is_signed = is_signed_type(type->kind == TYPE_ENUM ? type->base : type);
+    bool is_dense = is_dense_switch(stmt, is_signed);
+    SwitchRange *ranges = NULL;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase switch_case = stmt->switch_stmt.cases[i];
+        for (size_t j = 0; j < switch_case.num_patterns; j++) {
+            SwitchCasePattern pattern = switch_case.patterns[j];
+            if (is_wide_switch_range(pattern, is_dense)) {
+                buf_push(ranges, (SwitchRange){get_resolved_val(pattern.start).ll, get_resolved_val(pattern.end).ll, i});
+            }
+        }
+    }
+    int switch_index = 0;
+    if (ranges) {
+        qsort(ranges, buf_len(ranges), sizeof(*ranges), is_signed ? switch_range_cmp_signed : switch_range_cmp_unsigned);
+        switch_index = ++gen_switch_count;
+        genlnf("{");
+        gen_indent++;
+        genlnf("%s = ", type_to_cdecl(type, strf("ion__switch%d", switch_index)));
+        gen_expr(stmt->switch_stmt.expr);
+        genf(";");
+        genlnf("switch (ion__switch%d) {", switch_index);
+    } else {
+        genlnf("switch (");
+        gen_expr(stmt->switch_stmt.expr);
+        genf(") {");
+    }
+    bool has_default = false;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase switch_case = stmt->switch_stmt.cases[i];
+        bool has_wide_range = false;
+        for (size_t j = 0; j < switch_case.num_patterns; j++) {
+            SwitchCasePattern pattern = switch_case.patterns[j];
+            if (is_wide_switch_range(pattern, is_dense)) {
+                genlnf("#ifdef CASE_RANGES");
+                genlnf("case %s ... %s:", switch_val_lit(get_resolved_val(pattern.start).ll, is_signed), switch_val_lit(get_resolved_val(pattern.end).ll, is_signed));
+                genlnf("#endif");
+                has_wide_range = true;
+            } else if (pattern.end) {
+                Val start_val = get_resolved_val(pattern.start);
+                Val end_val = get_resolved_val(pattern.end);
+                unsigned long long width = switch_pattern_width(pattern);
+                if (is_char_lit(pattern.start) && is_char_lit(pattern.end)) {
+                    genln();
+                    for (int c = (int)start_val.ll; c <= (int)end_val.ll; c++) {
+                        genf("case ");
+                        gen_char(c);
+                        genf(": ");
+                    } 
+                } else {
+                    genlnf("// ");
+                    gen_expr(pattern.start);
+                    genf("...");
+                    gen_expr(pattern.end);
+                    genln();
+                    for (unsigned long long k = 0; k <= width; k++) {
+                        unsigned long long val = (unsigned long long)start_val.ll + k;
+                        if (is_signed) {
+                            genf("case %lld: ", (long long)val);
+                        } else {
+                            genf("case %llu: ", val);
+                        }
+                    }
+                }
+            } else {
+                genlnf("case ");
+                gen_expr(pattern.start);
+                genf(":");
+            }
+        }
+        if (switch_case.is_default) {
+            has_default = true;
+            genlnf("default:");
+        }
+        if (has_wide_range) {
+            genlnf("ion__switch%d_case%zu:", switch_index, i);
+        }
+        genf(" ");
+        genf("{");
+        gen_indent++;
+        if (switch_case.is_default) {
+            gen_switch_range_dispatch(switch_index, ranges, is_signed);
+        }
+        StmtList block = switch_case.block;
+        for (size_t j = 0; j < block.num_stmts; j++) {
+            gen_stmt(block.stmts[j]);
+        }
+        genlnf("break;");
+        gen_indent--;
+        genlnf("}");
+    }
+    if (!has_default) {
+        Note *note = get_stmt_note(stmt, complete_name);
+        if (note || ranges) {
+            genlnf("default:");
+            gen_indent++;
+            gen_switch_range_dispatch(switch_index, ranges, is_signed);
+            if (note) {
+                genlnf("assert(\"@complete switch failed to handle case\" && 0);");
+            }
+            genlnf("break;");
+            gen_indent--;
+        }
+    }
+    genlnf("}");
+    if (ranges) {
+        gen_indent--;
+        genlnf("}");
+    }
+    buf_free(ranges);
+}
+
+// The object gets its own local declared next to the pointer, so it lives exactly as long.
+void gen_stack_new_init(Stmt *stmt) {
+    Expr *expr = stmt->init.expr;
+    Type *type = get_resolved_type(expr);
+    const char *name = strf("__new_%s", stmt->init.name);
+    if (expr->new_expr.len) {
+        genlnf("%s;", type_to_cdecl(type->base, strf("%s[%lld]", name, get_resolved_val(expr->new_expr.len).ll)));
+    } else if (expr->new_expr.arg) {
+        genlnf("%s = ", type_to_cdecl(type->base, name));
+        gen_expr(expr->new_expr.arg);
+        genf(";");
+    } else {
+        genlnf("%s;", type_to_cdecl(type->base, name));
+    }
+    genln();
+    gen_align_note(stmt->notes);
+    genf("%s = %s%s;", type_to_cdecl(type, stmt->init.name), expr->new_expr.len ? "" : "&", name);
+}
+
 void gen_stmt(Stmt *stmt) {
     gen_sync_pos(stmt->pos);
     switch (stmt->kind) {
@@ -995,11 +2396,19 @@ void gen_stmt(Stmt *stmt) {
         }
         gen_sync_pos(stmt->pos);
         genlnf("if (");
+        if (get_stmt_note(stmt, likely_name)) {
+            genf("LIKELY(");
+        } else if (get_stmt_note(stmt, unlikely_name)) {
+            genf("UNLIKELY(");
+        }
         if (stmt->if_stmt.cond) {
             gen_expr(stmt->if_stmt.cond);
         } else {
             genf("%s", stmt->if_stmt.init->init.name);
         }
+        if (get_stmt_note(stmt, likely_name) || get_stmt_note(stmt, unlikely_name)) {
+            genf(")");
+        }
         genf(") ");
         gen_stmt_block(stmt->if_stmt.then_block);
         for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
@@ -1059,75 +2468,32 @@ void gen_stmt(Stmt *stmt) {
         genf(") ");
         gen_stmt_block(stmt->for_stmt.block);
         break;
-    case STMT_SWITCH: {
-        genlnf("switch (");
-        gen_expr(stmt->switch_stmt.expr);
-        genf(") {");
-        bool has_default = false;
-        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
-            SwitchCase switch_case = stmt->switch_stmt.cases[i];
-            for (size_t j = 0; j < switch_case.num_patterns; j++) {
-                SwitchCasePattern pattern = switch_case.patterns[j];
-                if (pattern.end) {
-                    Val start_val = get_resolved_val(pattern.start);
-                    Val end_val = get_resolved_val(pattern.end);
-                    if (is_char_lit(pattern.start) && is_char_lit(pattern.end)) {
-                        genln();
-                        for (int c = (int)start_val.ll; c <= (int)end_val.ll; c++) {
-                            genf("case ");
-                            gen_char(c);
-                            genf(": ");
-                        } 
-                    } else {
-                        genlnf("// ");
-                        gen_expr(pattern.start);
-                        genf("...");
-                        gen_expr(pattern.end);
-                        genln();
-                        for (long long ll = start_val.ll; ll <= end_val.ll; ll++) {
-                            genf("case %lld: ", ll);
-                        }
-                    }
-                } else {
-                    genlnf("case ");
-                    gen_expr(pattern.start);
-                    genf(":");
-                }
-            }
-            if (switch_case.is_default) {
-                has_default = true;
-                genlnf("default:");
-            }
-            genf(" ");
-            genf("{");
-            gen_indent++;
-            StmtList block = switch_case.block;
-            for (size_t j = 0; j < block.num_stmts; j++) {
-                gen_stmt(block.stmts[j]);
-            }
-            genlnf("break;");
-            gen_indent--;
-            genlnf("}");
-        }
-        if (!has_default) {
-            Note *note = get_stmt_note(stmt, complete_name);
-            if (note) {
-                genlnf("default:");
-                gen_indent++;
-                genlnf("assert(\"@complete switch failed to handle case\" && 0);");
-                genlnf("break;");
-                gen_indent--;
-            }
-        }
-        genlnf("}");
+    case STMT_SWITCH:
+        gen_stmt_switch(stmt);
         break;
-    }
     case STMT_LABEL:
         genlnf("%s: ;", stmt->label);
         break;
     case STMT_GOTO:
         genlnf("goto %s;", stmt->label);
         break;
+    case STMT_INIT:
+        if (stmt->init.expr && is_stack_new(stmt->init.expr)) {
+            gen_stack_new_init(stmt);
+            break;
+        }
+        genln();
+        gen_simple_stmt(stmt);
+        genf(";");
+        break;
+    case STMT_EXPR:
+        if (gen_inline_stmt_call(stmt->expr)) {
+            break;
+        }
+        genln();
+        gen_simple_stmt(stmt);
+        genf(";");
+        break;
     default:
         genln();
         gen_simple_stmt(stmt);
@@ -1159,6 +2525,7 @@ void gen_decl(Sym *sym) {
         if (is_decl_threadlocal(decl)) {
             genf("THREADLOCAL ");
         }
+        gen_align_note(decl->notes);
         if (decl->var.type && !is_incomplete_array_typespec(decl->var.type)) {
             genf("%s", typespec_to_cdecl(decl->var.type, get_gen_name(sym)));
         } else {
@@ -1194,6 +2561,50 @@ void gen_decl(Sym *sym) {
     genln();
 }
 
+// Each array of an @soa struct becomes a struct of field arrays, defined right after the
+// element struct, with accessors for reading and writing whole elements.
+void gen_soa_arrays(Type *base) {
+    for (int i = 0; i < buf_len(soa_array_types); i++) {
+        Type *type = soa_array_types[i];
+        if (unqualify_type(type->base) != base || !is_reachable(get_reachable(type))) {
+            continue;
+        }
+        const char *name = soa_array_name(type);
+        const char *elem = type_to_cdecl(base, "");
+        gen_sync_output();
+        genlnf("struct %s {", name);
+        gen_indent++;
+        for (size_t j = 0; j < base->aggregate.num_fields; j++) {
+            TypeField field = base->aggregate.fields[j];
+            genln();
+            if (field.align) {
+                genf("ALIGN(%zu) ", field.align);
+            }
+            genf("%s;", type_to_cdecl(field.type, strf("%s[%zu]", field.name, type->num_elems)));
+        }
+        gen_indent--;
+        genlnf("};");
+        genlnf("INLINE %s %s_get(%s *a, size_t i) {", elem, name, name);
+        gen_indent++;
+        genlnf("%s;", type_to_cdecl(base, "v"));
+        for (size_t j = 0; j < base->aggregate.num_fields; j++) {
+            const char *field_name = base->aggregate.fields[j].name;
+            genlnf("memcpy(&v.%s, &a->%s[i], sizeof(v.%s));", field_name, field_name, field_name);
+        }
+        genlnf("return v;");
+        gen_indent--;
+        genlnf("}");
+        genlnf("INLINE void %s_set(%s *a, size_t i, %s) {", name, name, type_to_cdecl(base, "v"));
+        gen_indent++;
+        for (size_t j = 0; j < base->aggregate.num_fields; j++) {
+            const char *field_name = base->aggregate.fields[j].name;
+            genlnf("memcpy(&a->%s[i], &v.%s, sizeof(v.%s));", field_name, field_name, field_name);
+        }
+        gen_indent--;
+        genlnf("}");
+    }
+}
+
 void gen_sorted_decls(void) {
     for (int i = 0; i < buf_len(tuple_types); i++) {
         Type *type = tuple_types[i];
@@ -1210,9 +2621,93 @@ void gen_sorted_decls(void) {
         genlnf("};");
     }
     for (size_t i = 0; i < buf_len(sorted_syms); i++) {
-        if (sorted_syms[i]->reachable == REACHABLE_NATURAL) {
-            gen_decl(sorted_syms[i]);
+        Sym *sym = sorted_syms[i];
+        if (sym->reachable == REACHABLE_NATURAL) {
+            gen_decl(sym);
+            if (sym->kind == SYM_TYPE && is_soa_struct_type(sym->type)) {
+                gen_soa_arrays(sym->type);
+            }
+        }
+    }
+}
+
+void gen_eval_data(Type *type, const uint8_t *data);
+
+void gen_eval_soa_data(Type *type, const uint8_t *data) {
+    Type *base = unqualify_type(type->base);
+    genf("{");
+    for (size_t i = 0; i < base->aggregate.num_fields; i++) {
+        TypeField field = base->aggregate.fields[i];
+        const uint8_t *field_data = data + soa_field_offset(type, i);
+        genf("%s{", i == 0 ? "" : ", ");
+        for (size_t j = 0; j < type->num_elems; j++) {
+            if (j != 0) {
+                genf(", ");
+            }
+            gen_eval_data(field.type, field_data + j * type_sizeof(field.type));
+        }
+        genf("}");
+    }
+    genf("}");
+}
+
+// Generates an initializer for a global whose value was computed by compile-time evaluation.
+void gen_eval_data(Type *type, const uint8_t *data) {
+    type = unqualify_type(type);
+    if (is_soa_array_type(type)) {
+        gen_eval_soa_data(type, data);
+        return;
+    }
+    switch (type->kind) {
+    case TYPE_ARRAY:
+    case TYPE_VECTOR:
+        genf("{");
+        for (size_t i = 0; i < type->num_elems; i++) {
+            if (i != 0) {
+                genf(", ");
+            }
+            gen_eval_data(type->base, data + i * type_sizeof(type->base));
+        }
+        genf("}");
+        break;
+    case TYPE_STRUCT:
+    case TYPE_TUPLE:
+        genf("{");
+        for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+            if (i != 0) {
+                genf(", ");
+            }
+            gen_eval_data(type->aggregate.fields[i].type, data + type->aggregate.fields[i].offset);
         }
+        genf("}");
+        break;
+    case TYPE_UNION:
+        genf("{0}");
+        break;
+    case TYPE_PTR:
+    case TYPE_FUNC:
+        genf("0");
+        break;
+    case TYPE_FLOAT: {
+        float val;
+        memcpy(&val, data, sizeof(val));
+        genf("(float)%.9g", val);
+        break;
+    }
+    case TYPE_DOUBLE: {
+        double val;
+        memcpy(&val, data, sizeof(val));
+        genf("%.17g", val);
+        break;
+    }
+    default: {
+        assert(is_integer_type(type));
+        long long val = 0;
+        memcpy(&val, data, type_sizeof(type));
+        bool sign = is_signed_type(eval_scalar_type(type));
+        genf("%s", switch_val_lit(eval_normalize_const(val, type), sign));
+        break;
+    }
     }
 }
 
@@ -1223,6 +2718,7 @@ void gen_defs(void) {
         if (sym->state != SYM_RESOLVED || !decl || decl->is_incomplete || sym->reachable != REACHABLE_NATURAL) {
             continue;
         }
+        gen_package = sym->home_package;
         if (decl->kind == DECL_FUNC) {
             bool foreign = is_decl_foreign(decl);;
             char *buf = gen_buf;
@@ -1231,7 +2727,9 @@ void gen_defs(void) {
             }
             gen_func_decl(decl);
             genf(" ");
+            gen_func = decl;
             gen_stmt_block(decl->func.block);
+            gen_func = NULL;
             genln();
             if (foreign) {
                 gen_buf = buf;
@@ -1251,14 +2749,21 @@ void gen_defs(void) {
             if (is_decl_threadlocal(decl)) {
                 genlnf("THREADLOCAL");
             }
+            genln();
+            gen_align_note(decl->notes);
             if (decl->var.type && !is_incomplete_array_typespec(decl->var.type)) {
-                genlnf("%s", typespec_to_cdecl(decl->var.type, get_gen_name(sym)));
+                genf("%s", typespec_to_cdecl(decl->var.type, get_gen_name(sym)));
             } else {
-                genlnf("%s", type_to_cdecl(sym->type, get_gen_name(sym)));
+                genf("%s", type_to_cdecl(sym->type, get_gen_name(sym)));
             }
             if (decl->var.expr) {
                 genf(" = ");
-                gen_expr(decl->var.expr);
+                uint8_t *data = get_eval_init(decl->var.expr);
+                if (data) {
+                    gen_eval_data(sym->type, data);
+                } else {
+                    gen_expr(decl->var.expr);
+                }
             }
             genf(";");
         }
@@ -1444,6 +2949,24 @@ void gen_typeinfo(Type *type) {
     case TYPE_ARRAY:
         if (is_incomplete_array_type(type)) {
             genf("NULL, // Incomplete array type");
+        } else if (is_soa_array_type(type)) {
+            gen_typeinfo_header("TYPE_ARRAY", type);
+            genf(", .base = ");
+            gen_typeid(type->base);
+            genf(", .count = %d", type->num_elems);
+            Type *base = unqualify_type(type->base);
+            genf(", .num_fields = %d, .fields = (TypeFieldInfo[]) {", base->aggregate.num_fields);
+            gen_indent++;
+            for (size_t i = 0; i < base->aggregate.num_fields; i++) {
+                TypeField field = base->aggregate.fields[i];
+                genlnf("{");
+                gen_str(field.name, false);
+                genf(", .type = ");
+                gen_typeid(field.type);
+                genf(", .offset = offsetof(%s, %s)},", soa_array_name(type), field.name);
+            }
+            gen_indent--;
+            genlnf("}},");
         } else {
             gen_typeinfo_header("TYPE_ARRAY", type);
             genf(", .base = ");
@@ -1451,6 +2974,14 @@ void gen_typeinfo(Type *type) {
             genf(", .count = %d},", type->num_elems);
         }
         break;
+    case TYPE_VECTOR:
+        gen_typeinfo_header("TYPE_VECTOR", type);
+        genf(", .name = ");
+        gen_str(vector_type_name(type), false);
+        genf(", .base = ");
+        gen_typeid(type->base);
+        genf(", .count = %d},", type->num_elems);
+        break;
     case TYPE_STRUCT:
     case TYPE_UNION:
         gen_typeinfo_header(type->kind == TYPE_STRUCT ? "TYPE_STRUCT" : "TYPE_UNION", type);
@@ -1538,7 +3069,18 @@ void gen_all(void) {
     genln();
     gen_sorted_decls();
     gen_typeinfos();
+    // Function bodies decide which array helpers they need, which are defined ahead of them.
+    char *decls_buf = gen_buf;
+    gen_buf = NULL;
+    gen_pos = (SrcLoc){0};
     gen_defs();
+    char *defs_buf = gen_buf;
+    gen_buf = decls_buf;
+    if (array_helpers) {
+        gen_sync_output();
+        gen_array_helpers();
+    }
+    genf("%s", defs_buf);
     gen_foreign_sources();
     genln();
     gen_postamble();
@@ -1546,4 +3088,5 @@ void gen_all(void) {
     gen_buf = NULL;
     gen_preamble();
     genf("%s", buf);
+    gen_resolve_output_lines();
 }
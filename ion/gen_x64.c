@@ -0,0 +1,1847 @@
+// Direct x64 ELF object file backend. This is a simple single-pass stack machine: every expression
+// leaves its value in rax, intermediates are pushed on the machine stack, and locals live in the
+// rbp frame. Aggregates and arrays are represented by their address. Anything outside the supported
+// subset (floating point, by-value aggregates across calls, intrinsics, any, new, threadlocal) is
+// reported as an error so the C backend can be used instead.
+
+typedef enum X64Reg {
+    X64_RAX,
+    X64_RCX,
+    X64_RDX,
+    X64_RBX,
+    X64_RSP,
+    X64_RBP,
+    X64_RSI,
+    X64_RDI,
+    X64_R8,
+    X64_R9,
+    X64_R10,
+    X64_R11,
+} X64Reg;
+
+typedef enum X64Cond {
+    X64_CC_B = 0x2,
+    X64_CC_AE = 0x3,
+    X64_CC_E = 0x4,
+    X64_CC_NE = 0x5,
+    X64_CC_BE = 0x6,
+    X64_CC_A = 0x7,
+    X64_CC_L = 0xC,
+    X64_CC_GE = 0xD,
+    X64_CC_LE = 0xE,
+    X64_CC_G = 0xF,
+} X64Cond;
+
+enum {
+    X64_NUM_ARG_REGS = 6,
+};
+
+X64Reg x64_arg_regs[X64_NUM_ARG_REGS] = {X64_RDI, X64_RSI, X64_RDX, X64_RCX, X64_R8, X64_R9};
+
+enum {
+    ELF_SECTION_NULL,
+    ELF_SECTION_TEXT,
+    ELF_SECTION_RELA_TEXT,
+    ELF_SECTION_DATA,
+    ELF_SECTION_RELA_DATA,
+    ELF_SECTION_BSS,
+    ELF_SECTION_RODATA,
+    ELF_SECTION_NOTE_GNU_STACK,
+    ELF_SECTION_SYMTAB,
+    ELF_SECTION_STRTAB,
+    ELF_SECTION_SHSTRTAB,
+    NUM_ELF_SECTIONS,
+};
+
+enum {
+    ELF_SYM_NULL,
+    ELF_SYM_TEXT,
+    ELF_SYM_DATA,
+    ELF_SYM_BSS,
+    ELF_SYM_RODATA,
+    NUM_ELF_LOCAL_SYMS,
+};
+
+enum {
+    ELF_SHT_PROGBITS = 1,
+    ELF_SHT_SYMTAB = 2,
+    ELF_SHT_STRTAB = 3,
+    ELF_SHT_RELA = 4,
+    ELF_SHT_NOBITS = 8,
+    ELF_SHF_WRITE = 0x1,
+    ELF_SHF_ALLOC = 0x2,
+    ELF_SHF_EXECINSTR = 0x4,
+    ELF_SHF_INFO_LINK = 0x40,
+    ELF_STB_LOCAL = 0,
+    ELF_STB_GLOBAL = 1,
+    ELF_STT_NOTYPE = 0,
+    ELF_STT_OBJECT = 1,
+    ELF_STT_FUNC = 2,
+    ELF_STT_SECTION = 3,
+    R_X86_64_64 = 1,
+    R_X86_64_PC32 = 2,
+    R_X86_64_PLT32 = 4,
+    R_X86_64_GOTPCREL = 9,
+};
+
+typedef struct ElfHeader {
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} ElfHeader;
+
+typedef struct ElfSection {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+} ElfSection;
+
+typedef struct ElfSym {
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+} ElfSym;
+
+typedef struct ElfRela {
+    uint64_t offset;
+    uint64_t info;
+    int64_t addend;
+} ElfRela;
+
+typedef struct X64Local {
+    const char *name;
+    Type *type;
+    int32_t offset;
+} X64Local;
+
+typedef struct X64Fixup {
+    uint32_t at;
+    int label;
+} X64Fixup;
+
+typedef struct X64GotoLabel {
+    const char *name;
+    int label;
+} X64GotoLabel;
+
+uint8_t *x64_text;
+uint8_t *x64_data;
+uint8_t *x64_rodata;
+size_t x64_bss_size;
+ElfRela *x64_text_relas;
+ElfRela *x64_data_relas;
+ElfSym *x64_syms;
+char *x64_strtab;
+Map x64_sym_indices;
+Map x64_str_offsets;
+
+X64Local *x64_locals;
+int32_t x64_frame_size;
+int x64_depth;
+int32_t *x64_labels;
+X64Fixup *x64_fixups;
+X64GotoLabel *x64_goto_labels;
+int x64_break_label = -1;
+int x64_continue_label = -1;
+Type *x64_ret_type;
+
+#define x64_emit(...) x64_emit_bytes((uint8_t[]){__VA_ARGS__}, sizeof((uint8_t[]){__VA_ARGS__}))
+
+void x64_emit_bytes(const uint8_t *bytes, size_t len) {
+    buf_fit(x64_text, buf_len(x64_text) + len);
+    memcpy(buf_end(x64_text), bytes, len);
+    buf__hdr(x64_text)->len += len;
+}
+
+void x64_emit32(uint32_t val) {
+    x64_emit(val, val >> 8, val >> 16, val >> 24);
+}
+
+void x64_emit64(uint64_t val) {
+    x64_emit32((uint32_t)val);
+    x64_emit32((uint32_t)(val >> 32));
+}
+
+void x64_patch32(uint32_t at, uint32_t val) {
+    x64_text[at] = (uint8_t)val;
+    x64_text[at + 1] = (uint8_t)(val >> 8);
+    x64_text[at + 2] = (uint8_t)(val >> 16);
+    x64_text[at + 3] = (uint8_t)(val >> 24);
+}
+
+uint32_t x64_pos(void) {
+    return (uint32_t)buf_len(x64_text);
+}
+
+uint32_t x64_add_string(const char *str) {
+    uint32_t offset = (uint32_t)buf_len(x64_strtab);
+    size_t len = strlen(str) + 1;
+    buf_fit(x64_strtab, offset + len);
+    memcpy(x64_strtab + offset, str, len);
+    buf__hdr(x64_strtab)->len += len;
+    return offset;
+}
+
+void x64_align_data(uint8_t **data, size_t align) {
+    while (buf_len(*data) % align) {
+        buf_push(*data, 0);
+    }
+}
+
+bool is_x64_defined_sym(Sym *sym) {
+    Decl *decl = sym->decl;
+    return decl && sym->state == SYM_RESOLVED && sym->reachable == REACHABLE_NATURAL && !decl->is_incomplete && !is_decl_foreign(decl);
+}
+
+uint32_t x64_sym_index(Sym *sym) {
+    uint32_t index = (uint32_t)map_get_uint64(&x64_sym_indices, sym);
+    if (!index) {
+        index = (uint32_t)buf_len(x64_syms);
+        buf_push(x64_syms, (ElfSym){
+            .name = x64_add_string(get_gen_name(sym)),
+            .info = ELF_STB_GLOBAL << 4 | ELF_STT_NOTYPE,
+        });
+        map_put_uint64(&x64_sym_indices, sym, index);
+    }
+    return index;
+}
+
+void x64_define_sym(Sym *sym, uint16_t section, uint64_t value, uint64_t size) {
+    uint32_t index = x64_sym_index(sym);
+    ElfSym *elf_sym = &x64_syms[index];
+    elf_sym->info = ELF_STB_GLOBAL << 4 | (sym->kind == SYM_FUNC ? ELF_STT_FUNC : ELF_STT_OBJECT);
+    elf_sym->shndx = section;
+    elf_sym->value = value;
+    elf_sym->size = size;
+}
+
+void x64_text_rela(uint32_t at, uint32_t sym_index, uint32_t type, int64_t addend) {
+    buf_push(x64_text_relas, (ElfRela){at, (uint64_t)sym_index << 32 | type, addend});
+}
+
+uint32_t x64_rodata_str(const char *str) {
+    uint32_t offset = (uint32_t)map_get_uint64(&x64_str_offsets, (void *)str);
+    if (!offset) {
+        offset = (uint32_t)buf_len(x64_rodata);
+        size_t len = strlen(str) + 1;
+        buf_fit(x64_rodata, offset + len);
+        memcpy(x64_rodata + offset, str, len);
+        buf__hdr(x64_rodata)->len += len;
+        map_put_uint64(&x64_str_offsets, (void *)str, offset + 1);
+    } else {
+        offset--;
+    }
+    return offset;
+}
+
+uint8_t x64_rex(bool w, X64Reg reg, X64Reg rm) {
+    return 0x40 | (w ? 8 : 0) | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0);
+}
+
+uint8_t x64_modrm(int mod, X64Reg reg, X64Reg rm) {
+    return (uint8_t)(mod << 6 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op r/m64, r64 with register operands, e.g. 0x89 mov, 0x01 add, 0x39 cmp.
+void x64_op_rr(uint8_t op, X64Reg dst, X64Reg src) {
+    x64_emit(x64_rex(true, src, dst), op, x64_modrm(3, src, dst));
+}
+
+void x64_mov_rr(X64Reg dst, X64Reg src) {
+    x64_op_rr(0x89, dst, src);
+}
+
+void x64_push(X64Reg reg) {
+    if (reg >= 8) {
+        x64_emit(0x41);
+    }
+    x64_emit(0x50 + (reg & 7));
+    x64_depth++;
+}
+
+void x64_pop(X64Reg reg) {
+    if (reg >= 8) {
+        x64_emit(0x41);
+    }
+    x64_emit(0x58 + (reg & 7));
+    x64_depth--;
+}
+
+void x64_mov_imm(X64Reg reg, uint64_t val) {
+    if (reg >= 8) {
+        x64_emit(0x49, 0xB8 + (reg & 7));
+        x64_emit64(val);
+    } else if (val <= 0xFFFFFFFF) {
+        x64_emit(0xB8 + reg);
+        x64_emit32((uint32_t)val);
+    } else if ((int64_t)val == (int32_t)val) {
+        x64_emit(0x48, 0xC7, x64_modrm(3, 0, reg));
+        x64_emit32((uint32_t)val);
+    } else {
+        x64_emit(0x48, 0xB8 + reg);
+        x64_emit64(val);
+    }
+}
+
+void x64_lea_local(X64Reg reg, int32_t offset) {
+    x64_emit(x64_rex(true, reg, X64_RBP), 0x8D, x64_modrm(2, reg, X64_RBP));
+    x64_emit32((uint32_t)offset);
+}
+
+void x64_store_local64(int32_t offset, X64Reg reg) {
+    x64_emit(x64_rex(true, reg, X64_RBP), 0x89, x64_modrm(2, reg, X64_RBP));
+    x64_emit32((uint32_t)offset);
+}
+
+void x64_add_imm(X64Reg reg, int32_t val) {
+    if (val) {
+        x64_emit(x64_rex(true, 0, reg), 0x81, x64_modrm(3, 0, reg));
+        x64_emit32((uint32_t)val);
+    }
+}
+
+void x64_sub_rsp(int32_t val) {
+    x64_emit(0x48, 0x81, 0xEC);
+    x64_emit32((uint32_t)val);
+}
+
+void x64_add_rsp(int32_t val) {
+    if (val) {
+        x64_emit(0x48, 0x81, 0xC4);
+        x64_emit32((uint32_t)val);
+    }
+}
+
+void x64_test_rax(void) {
+    x64_emit(0x48, 0x85, 0xC0);
+}
+
+void x64_setcc_rax(X64Cond cond) {
+    x64_emit(0x0F, 0x90 + cond, 0xC0);
+    x64_emit(0x0F, 0xB6, 0xC0);
+}
+
+// Copies rcx bytes from rsi to rdi.
+void x64_copy(void) {
+    x64_emit(0xF3, 0xA4);
+}
+
+void x64_zero_local(int32_t offset, size_t size) {
+    x64_lea_local(X64_RDI, offset);
+    x64_emit(0x31, 0xC0);
+    x64_mov_imm(X64_RCX, size);
+    x64_emit(0xF3, 0xAA);
+}
+
+int x64_new_label(void) {
+    buf_push(x64_labels, -1);
+    return (int)buf_len(x64_labels) - 1;
+}
+
+void x64_bind_label(int label) {
+    x64_labels[label] = x64_pos();
+}
+
+void x64_jmp(int label) {
+    x64_emit(0xE9);
+    buf_push(x64_fixups, (X64Fixup){x64_pos(), label});
+    x64_emit32(0);
+}
+
+void x64_jcc(X64Cond cond, int label) {
+    x64_emit(0x0F, 0x80 + cond);
+    buf_push(x64_fixups, (X64Fixup){x64_pos(), label});
+    x64_emit32(0);
+}
+
+void x64_jz(int label) {
+    x64_test_rax();
+    x64_jcc(X64_CC_E, label);
+}
+
+void x64_resolve_fixups(void) {
+    for (X64Fixup *it = x64_fixups; it != buf_end(x64_fixups); it++) {
+        int32_t target = x64_labels[it->label];
+        assert(target >= 0);
+        x64_patch32(it->at, (uint32_t)(target - (int32_t)(it->at + 4)));
+    }
+}
+
+Type *x64_scalar_type(Type *type) {
+    type = unqualify_type(type);
+    if (type->kind == TYPE_ENUM) {
+        type = unqualify_type(type->base);
+    }
+    return type;
+}
+
+bool is_x64_memory_type(Type *type) {
+    type = unqualify_type(type);
+    return is_aggregate_type(type) || type->kind == TYPE_ARRAY;
+}
+
+bool is_x64_signed_type(Type *type) {
+    return is_signed_type(x64_scalar_type(type));
+}
+
+// Sign or zero extends the low bytes of rax so the whole register holds a value of the given type.
+void x64_normalize(Type *type) {
+    type = x64_scalar_type(type);
+    if (type->kind == TYPE_BOOL) {
+        x64_test_rax();
+        x64_setcc_rax(X64_CC_NE);
+        return;
+    }
+    if (!is_integer_type(type)) {
+        return;
+    }
+    bool sign = is_signed_type(type);
+    switch (type_sizeof(type)) {
+    case 1:
+        if (sign) {
+            x64_emit(0x48, 0x0F, 0xBE, 0xC0);
+        } else {
+            x64_emit(0x0F, 0xB6, 0xC0);
+        }
+        break;
+    case 2:
+        if (sign) {
+            x64_emit(0x48, 0x0F, 0xBF, 0xC0);
+        } else {
+            x64_emit(0x0F, 0xB7, 0xC0);
+        }
+        break;
+    case 4:
+        if (sign) {
+            x64_emit(0x48, 0x63, 0xC0);
+        } else {
+            x64_emit(0x89, 0xC0);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void x64_convert(Type *from, Type *to) {
+    from = x64_scalar_type(from);
+    to = x64_scalar_type(to);
+    if (from == to && to->kind != TYPE_BOOL) {
+        return;
+    }
+    if (to->kind == TYPE_BOOL && from->kind == TYPE_BOOL) {
+        return;
+    }
+    x64_normalize(to);
+}
+
+// Loads a value of the given type from the address in rax. Aggregates and arrays stay as addresses.
+void x64_load(Type *type) {
+    if (is_x64_memory_type(type)) {
+        return;
+    }
+    type = x64_scalar_type(type);
+    bool sign = is_signed_type(type);
+    switch (type_sizeof(type)) {
+    case 1:
+        if (sign) {
+            x64_emit(0x48, 0x0F, 0xBE, 0x00);
+        } else {
+            x64_emit(0x0F, 0xB6, 0x00);
+        }
+        break;
+    case 2:
+        if (sign) {
+            x64_emit(0x48, 0x0F, 0xBF, 0x00);
+        } else {
+            x64_emit(0x0F, 0xB7, 0x00);
+        }
+        break;
+    case 4:
+        if (sign) {
+            x64_emit(0x48, 0x63, 0x00);
+        } else {
+            x64_emit(0x8B, 0x00);
+        }
+        break;
+    case 8:
+        x64_emit(0x48, 0x8B, 0x00);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// Stores rax to the address in rcx. For aggregates and arrays rax holds the source address.
+void x64_store(Type *type) {
+    if (is_x64_memory_type(type)) {
+        x64_mov_rr(X64_RSI, X64_RAX);
+        x64_mov_rr(X64_RDI, X64_RCX);
+        x64_mov_imm(X64_RCX, type_sizeof(type));
+        x64_copy();
+        return;
+    }
+    switch (type_sizeof(x64_scalar_type(type))) {
+    case 1:
+        x64_emit(0x88, 0x01);
+        break;
+    case 2:
+        x64_emit(0x66, 0x89, 0x01);
+        break;
+    case 4:
+        x64_emit(0x89, 0x01);
+        break;
+    case 8:
+        x64_emit(0x48, 0x89, 0x01);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// Arrays whose size was inferred from their initializer are left without an alignment.
+size_t x64_alignof(Type *type) {
+    type = unqualify_type(type);
+    while (type->kind == TYPE_ARRAY && !type->align) {
+        type = unqualify_type(type->base);
+    }
+    return CLAMP_MIN(type_alignof(type), 1);
+}
+
+int32_t x64_alloc_local(size_t size, size_t align) {
+    if (align > 16) {
+        align = 16;
+    }
+    x64_frame_size = (int32_t)ALIGN_UP((size_t)x64_frame_size + size, align);
+    return -x64_frame_size;
+}
+
+void x64_push_local(const char *name, Type *type, int32_t offset) {
+    buf_push(x64_locals, (X64Local){name, type, offset});
+}
+
+X64Local *x64_get_local(const char *name) {
+    for (X64Local *it = buf_end(x64_locals); it != x64_locals; it--) {
+        if (it[-1].name == name) {
+            return it - 1;
+        }
+    }
+    return NULL;
+}
+
+void x64_sym_addr(Sym *sym) {
+    if (is_x64_defined_sym(sym)) {
+        // lea rax, [rip + sym]
+        x64_emit(0x48, 0x8D, 0x05);
+        x64_text_rela(x64_pos(), x64_sym_index(sym), R_X86_64_PC32, -4);
+    } else {
+        // Foreign symbols may live in a shared library, so go through the GOT.
+        x64_emit(0x48, 0x8B, 0x05);
+        x64_text_rela(x64_pos(), x64_sym_index(sym), R_X86_64_GOTPCREL, -4);
+    }
+    x64_emit32(0);
+}
+
+void x64_str_addr(const char *str) {
+    x64_emit(0x48, 0x8D, 0x05);
+    x64_text_rela(x64_pos(), ELF_SYM_RODATA, R_X86_64_PC32, (int64_t)x64_rodata_str(str) - 4);
+    x64_emit32(0);
+}
+
+NORETURN void fatal_x64_unsupported(SrcPos pos, const char *what) {
+    fatal_error(pos, "%s is not supported by the native backend (use the C backend)", what);
+}
+
+// Stack frames and the data and bss sections are only 16-byte aligned.
+size_t x64_alignof_decl(SrcPos pos, Type *type, Notes notes) {
+    size_t align = MAX(x64_alignof(type), get_align_note(notes));
+    if (align > 16) {
+        fatal_x64_unsupported(pos, "Alignment above 16 bytes");
+    }
+    return align;
+}
+
+long long x64_const_val(Expr *expr) {
+    assert(is_resolved_const(expr));
+    return get_resolved_val(expr).ll;
+}
+
+// Truncates and re-extends a constant the same way x64_normalize does at run time.
+long long x64_normalize_const(long long val, Type *type) {
+    type = x64_scalar_type(type);
+    if (type->kind == TYPE_BOOL) {
+        return val != 0;
+    }
+    if (!is_integer_type(type) || type_sizeof(type) == 8) {
+        return val;
+    }
+    int bits = (int)type_sizeof(type) * 8;
+    unsigned long long mask = (1ull << bits) - 1;
+    unsigned long long u = (unsigned long long)val & mask;
+    if (is_signed_type(type) && (u >> (bits - 1))) {
+        u |= ~mask;
+    }
+    return (long long)u;
+}
+
+Type *x64_expr_type(Expr *expr) {
+    Type *type = get_resolved_type(expr);
+    assert(type);
+    return type;
+}
+
+Type *x64_arith_type(Type *left, Type *right) {
+    Operand left_operand = operand_rvalue(x64_scalar_type(left));
+    Operand right_operand = operand_rvalue(x64_scalar_type(right));
+    unify_arithmetic_operands(&left_operand, &right_operand);
+    return left_operand.type;
+}
+
+Type *x64_pointer_type(Expr *expr) {
+    Type *promo = pointer_promo_type(expr);
+    return promo ? promo : type_decay(x64_expr_type(expr));
+}
+
+size_t x64_elem_size(Type *ptr_type) {
+    Type *base = unqualify_type(ptr_type->base);
+    return base->kind == TYPE_VOID ? 1 : type_sizeof(base);
+}
+
+void gen_x64_expr(Expr *expr);
+void gen_x64_addr(Expr *expr);
+void gen_x64_stmt(Stmt *stmt);
+void gen_x64_init_at(Type *type, Expr *init, int32_t offset);
+
+void gen_x64_compound_fields(Expr *expr, Type *type, int32_t offset) {
+    type = unqualify_type(type);
+    if (is_aggregate_type(type)) {
+        int index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_NAME) {
+                index = aggregate_item_field_index(type, field.name);
+            }
+            TypeField type_field = type->aggregate.fields[index];
+            gen_x64_init_at(type_field.type, field.init, offset + (int32_t)type_field.offset);
+            index++;
+        }
+    } else if (type->kind == TYPE_ARRAY) {
+        size_t index = 0;
+        size_t elem_size = type_sizeof(type->base);
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_INDEX) {
+                index = (size_t)x64_const_val(field.index);
+            }
+            gen_x64_init_at(type->base, field.init, offset + (int32_t)(index * elem_size));
+            index++;
+        }
+    } else {
+        fatal_x64_unsupported(expr->pos, "Compound literal of this type");
+    }
+}
+
+void gen_x64_init_at(Type *type, Expr *init, int32_t offset) {
+    if (init->kind == EXPR_COMPOUND && is_x64_memory_type(x64_expr_type(init))) {
+        gen_x64_compound_fields(init, x64_expr_type(init), offset);
+        return;
+    }
+    gen_x64_expr(init);
+    if (is_x64_memory_type(type)) {
+        size_t size = type_sizeof(type);
+        if (init->kind == EXPR_STR) {
+            size = MIN(size, strlen(init->str_lit.val) + 1);
+        }
+        x64_mov_rr(X64_RSI, X64_RAX);
+        x64_lea_local(X64_RDI, offset);
+        x64_mov_imm(X64_RCX, size);
+        x64_copy();
+    } else {
+        x64_convert(type_decay(x64_expr_type(init)), type);
+        x64_lea_local(X64_RCX, offset);
+        x64_store(type);
+    }
+}
+
+void gen_x64_compound(Expr *expr) {
+    Type *type = unqualify_type(x64_expr_type(expr));
+    if (!is_x64_memory_type(type)) {
+        if (expr->compound.num_fields == 0) {
+            x64_mov_imm(X64_RAX, 0);
+        } else {
+            Expr *init = expr->compound.fields[0].init;
+            gen_x64_expr(init);
+            x64_convert(type_decay(x64_expr_type(init)), type);
+        }
+        return;
+    }
+    int32_t offset = x64_alloc_local(type_sizeof(type), x64_alignof(type));
+    x64_zero_local(offset, type_sizeof(type));
+    gen_x64_compound_fields(expr, type, offset);
+    x64_lea_local(X64_RAX, offset);
+}
+
+void gen_x64_name_addr(SrcPos pos, const char *name, Sym *sym) {
+    if (!sym) {
+        X64Local *local = x64_get_local(name);
+        assert(local);
+        x64_lea_local(X64_RAX, local->offset);
+    } else if (sym->kind == SYM_VAR || sym->kind == SYM_FUNC) {
+        if (sym->kind == SYM_VAR && is_decl_threadlocal(sym->decl)) {
+            fatal_x64_unsupported(pos, "@threadlocal variable");
+        }
+        x64_sym_addr(sym);
+    } else {
+        fatal_x64_unsupported(pos, "Address of this symbol");
+    }
+}
+
+void gen_x64_field_addr(Expr *expr) {
+    Type *type = unqualify_type(x64_expr_type(expr->field.expr));
+    if (type->kind == TYPE_PTR) {
+        gen_x64_expr(expr->field.expr);
+        type = unqualify_type(type->base);
+    } else {
+        gen_x64_addr(expr->field.expr);
+    }
+    int index = aggregate_item_field_index(type, expr->field.name);
+    assert(index >= 0);
+    x64_add_imm(X64_RAX, (int32_t)type->aggregate.fields[index].offset);
+}
+
+void gen_x64_index_addr(Expr *expr) {
+    Type *type = unqualify_type(x64_expr_type(expr->index.expr));
+    if (is_soa_array_type(type)) {
+        fatal_x64_unsupported(expr->pos, "@soa array indexing");
+    }
+    if (is_aggregate_type(type)) {
+        gen_x64_addr(expr->index.expr);
+        long long index = x64_const_val(expr->index.index);
+        x64_add_imm(X64_RAX, (int32_t)type->aggregate.fields[index].offset);
+        return;
+    }
+    gen_x64_expr(expr->index.expr);
+    x64_push(X64_RAX);
+    gen_x64_expr(expr->index.index);
+    size_t elem_size = type_sizeof(type->base);
+    if (elem_size != 1) {
+        x64_emit(0x48, 0x69, 0xC0);
+        x64_emit32((uint32_t)elem_size);
+    }
+    x64_pop(X64_RCX);
+    x64_op_rr(0x01, X64_RAX, X64_RCX);
+}
+
+void gen_x64_addr(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        gen_x64_addr(expr->paren.expr);
+        break;
+    case EXPR_NAME:
+        gen_x64_name_addr(expr->pos, expr->name, get_resolved_sym(expr));
+        break;
+    case EXPR_FIELD: {
+        Sym *sym = get_resolved_sym(expr);
+        if (sym) {
+            gen_x64_name_addr(expr->pos, sym->name, sym);
+        } else {
+            gen_x64_field_addr(expr);
+        }
+        break;
+    }
+    case EXPR_INDEX:
+        gen_x64_index_addr(expr);
+        break;
+    case EXPR_UNARY:
+        if (expr->unary.op != TOKEN_MUL) {
+            fatal_x64_unsupported(expr->pos, "Address of this expression");
+        }
+        gen_x64_expr(expr->unary.expr);
+        break;
+    case EXPR_COMPOUND:
+        gen_x64_compound(expr);
+        break;
+    case EXPR_STR:
+        x64_str_addr(expr->str_lit.val);
+        break;
+    default:
+        fatal_x64_unsupported(expr->pos, "Address of this expression");
+        break;
+    }
+}
+
+void gen_x64_call(Expr *expr) {
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    if (is_intrinsic(sym)) {
+        fatal_x64_unsupported(expr->pos, "Intrinsic call");
+    }
+    if (sym && sym->kind == SYM_TYPE) {
+        Expr *arg = expr->call.args[0];
+        gen_x64_expr(arg);
+        x64_convert(type_decay(x64_expr_type(arg)), sym->type);
+        return;
+    }
+    Type *func_type = unqualify_type(x64_expr_type(expr->call.expr));
+    if (func_type->kind == TYPE_PTR) {
+        func_type = unqualify_type(func_type->base);
+    }
+    assert(func_type->kind == TYPE_FUNC);
+    if (is_x64_memory_type(func_type->func.ret)) {
+        fatal_x64_unsupported(expr->pos, "Call returning an aggregate");
+    }
+    size_t num_args = expr->call.num_args;
+    size_t num_stack_args = num_args > X64_NUM_ARG_REGS ? num_args - X64_NUM_ARG_REGS : 0;
+    int padding = (x64_depth + (int)num_stack_args) % 2;
+    if (padding) {
+        x64_sub_rsp(8);
+        x64_depth++;
+    }
+    for (size_t i = num_args; i-- > 0;) {
+        Expr *arg = expr->call.args[i];
+        Type *param_type = i < func_type->func.num_params ? func_type->func.params[i] : func_type->func.varargs_type;
+        Type *arg_type = type_decay(x64_expr_type(arg));
+        if (is_x64_memory_type(arg_type)) {
+            fatal_x64_unsupported(arg->pos, "Passing an aggregate by value");
+        }
+        gen_x64_expr(arg);
+        if (param_type) {
+            x64_convert(arg_type, type_decay(param_type));
+        }
+        x64_push(X64_RAX);
+    }
+    bool direct = sym && sym->kind == SYM_FUNC;
+    if (!direct) {
+        gen_x64_expr(expr->call.expr);
+        x64_mov_rr(X64_R11, X64_RAX);
+    }
+    for (size_t i = 0; i < num_args && i < X64_NUM_ARG_REGS; i++) {
+        x64_pop(x64_arg_regs[i]);
+    }
+    // al holds the number of vector registers used by a varargs call.
+    x64_emit(0x31, 0xC0);
+    if (direct) {
+        x64_emit(0xE8);
+        x64_text_rela(x64_pos(), x64_sym_index(sym), R_X86_64_PLT32, -4);
+        x64_emit32(0);
+    } else {
+        x64_emit(0x41, 0xFF, 0xD3);
+    }
+    x64_add_rsp((int32_t)(8 * (num_stack_args + padding)));
+    x64_depth -= (int)num_stack_args + padding;
+    x64_normalize(func_type->func.ret);
+}
+
+// Applies op to rax and rcx in the given operation type, leaving the result in rax.
+void x64_binary_op(TokenKind op, Type *type) {
+    bool sign = is_x64_signed_type(type);
+    switch (op) {
+    case TOKEN_ADD:
+        x64_op_rr(0x01, X64_RAX, X64_RCX);
+        break;
+    case TOKEN_SUB:
+        x64_op_rr(0x29, X64_RAX, X64_RCX);
+        break;
+    case TOKEN_MUL:
+        x64_emit(0x48, 0x0F, 0xAF, 0xC1);
+        break;
+    case TOKEN_DIV:
+    case TOKEN_MOD:
+        if (sign) {
+            x64_emit(0x48, 0x99);
+            x64_emit(0x48, 0xF7, 0xF9);
+        } else {
+            x64_emit(0x31, 0xD2);
+            x64_emit(0x48, 0xF7, 0xF1);
+        }
+        if (op == TOKEN_MOD) {
+            x64_mov_rr(X64_RAX, X64_RDX);
+        }
+        break;
+    case TOKEN_AND:
+        x64_op_rr(0x21, X64_RAX, X64_RCX);
+        break;
+    case TOKEN_OR:
+        x64_op_rr(0x09, X64_RAX, X64_RCX);
+        break;
+    case TOKEN_XOR:
+        x64_op_rr(0x31, X64_RAX, X64_RCX);
+        break;
+    case TOKEN_LSHIFT:
+        x64_emit(0x48, 0xD3, 0xE0);
+        break;
+    case TOKEN_RSHIFT:
+        x64_emit(0x48, 0xD3, sign ? 0xF8 : 0xE8);
+        break;
+    case TOKEN_EQ:
+    case TOKEN_NOTEQ:
+    case TOKEN_LT:
+    case TOKEN_LTEQ:
+    case TOKEN_GT:
+    case TOKEN_GTEQ: {
+        X64Cond cond;
+        switch (op) {
+        case TOKEN_EQ: cond = X64_CC_E; break;
+        case TOKEN_NOTEQ: cond = X64_CC_NE; break;
+        case TOKEN_LT: cond = sign ? X64_CC_L : X64_CC_B; break;
+        case TOKEN_LTEQ: cond = sign ? X64_CC_LE : X64_CC_BE; break;
+        case TOKEN_GT: cond = sign ? X64_CC_G : X64_CC_A; break;
+        default: cond = sign ? X64_CC_GE : X64_CC_AE; break;
+        }
+        x64_op_rr(0x39, X64_RAX, X64_RCX);
+        x64_setcc_rax(cond);
+        break;
+    }
+    default:
+        assert(0);
+        break;
+    }
+}
+
+bool is_x64_cmp_op(TokenKind op) {
+    return TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP;
+}
+
+// Operation type for a binary operator: shifts use the promoted left operand, everything else the
+// usual arithmetic conversions, and pointers compare as unsigned addresses.
+Type *x64_binary_type(TokenKind op, Type *left, Type *right) {
+    left = type_decay(left);
+    right = type_decay(right);
+    if (is_ptr_like_type(left) || is_ptr_like_type(right)) {
+        return type_uintptr;
+    }
+    if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) {
+        Operand operand = operand_rvalue(x64_scalar_type(left));
+        promote_operand(&operand);
+        return operand.type;
+    }
+    return x64_arith_type(left, right);
+}
+
+void gen_x64_logical(Expr *expr) {
+    int short_label = x64_new_label();
+    int end_label = x64_new_label();
+    bool is_and = expr->binary.op == TOKEN_AND_AND;
+    gen_x64_expr(expr->binary.left);
+    x64_test_rax();
+    x64_jcc(is_and ? X64_CC_E : X64_CC_NE, short_label);
+    gen_x64_expr(expr->binary.right);
+    x64_test_rax();
+    x64_setcc_rax(X64_CC_NE);
+    x64_jmp(end_label);
+    x64_bind_label(short_label);
+    x64_mov_imm(X64_RAX, is_and ? 0 : 1);
+    x64_bind_label(end_label);
+}
+
+void gen_x64_binary(Expr *expr) {
+    TokenKind op = expr->binary.op;
+    if (op == TOKEN_AND_AND || op == TOKEN_OR_OR) {
+        gen_x64_logical(expr);
+        return;
+    }
+    Expr *left = expr->binary.left;
+    Expr *right = expr->binary.right;
+    Type *left_type = x64_pointer_type(left);
+    Type *right_type = x64_pointer_type(right);
+    Type *result_type = x64_expr_type(expr);
+    if ((op == TOKEN_ADD || op == TOKEN_SUB) && (is_ptr_type(left_type) || is_ptr_type(right_type))) {
+        bool both_ptrs = is_ptr_type(left_type) && is_ptr_type(right_type);
+        bool ptr_right = !is_ptr_type(left_type);
+        size_t elem_size = x64_elem_size(ptr_right ? right_type : left_type);
+        gen_x64_expr(left);
+        if (ptr_right && elem_size != 1) {
+            x64_emit(0x48, 0x69, 0xC0);
+            x64_emit32((uint32_t)elem_size);
+        }
+        x64_push(X64_RAX);
+        gen_x64_expr(right);
+        if (!ptr_right && !both_ptrs && elem_size != 1) {
+            x64_emit(0x48, 0x69, 0xC0);
+            x64_emit32((uint32_t)elem_size);
+        }
+        x64_mov_rr(X64_RCX, X64_RAX);
+        x64_pop(X64_RAX);
+        x64_binary_op(op, type_uintptr);
+        if (both_ptrs && elem_size != 1) {
+            x64_mov_imm(X64_RCX, elem_size);
+            x64_binary_op(TOKEN_DIV, type_ssize);
+        }
+        return;
+    }
+    Type *type = x64_binary_type(op, left_type, right_type);
+    gen_x64_expr(left);
+    x64_convert(left_type, type);
+    x64_push(X64_RAX);
+    gen_x64_expr(right);
+    if (op != TOKEN_LSHIFT && op != TOKEN_RSHIFT) {
+        x64_convert(right_type, type);
+    }
+    x64_mov_rr(X64_RCX, X64_RAX);
+    x64_pop(X64_RAX);
+    x64_binary_op(op, type);
+    if (!is_x64_cmp_op(op)) {
+        x64_normalize(result_type);
+    }
+}
+
+void gen_x64_unary(Expr *expr) {
+    Expr *operand = expr->unary.expr;
+    Type *type = x64_expr_type(expr);
+    switch (expr->unary.op) {
+    case TOKEN_AND:
+        gen_x64_addr(operand);
+        break;
+    case TOKEN_MUL:
+        gen_x64_expr(operand);
+        x64_load(type);
+        break;
+    case TOKEN_ADD:
+        gen_x64_expr(operand);
+        x64_convert(type_decay(x64_expr_type(operand)), type);
+        break;
+    case TOKEN_SUB:
+        gen_x64_expr(operand);
+        x64_convert(type_decay(x64_expr_type(operand)), type);
+        x64_emit(0x48, 0xF7, 0xD8);
+        x64_normalize(type);
+        break;
+    case TOKEN_NEG:
+        gen_x64_expr(operand);
+        x64_convert(type_decay(x64_expr_type(operand)), type);
+        x64_emit(0x48, 0xF7, 0xD0);
+        x64_normalize(type);
+        break;
+    case TOKEN_NOT:
+        gen_x64_expr(operand);
+        x64_test_rax();
+        x64_setcc_rax(X64_CC_E);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void gen_x64_modify(Expr *expr) {
+    Type *type = unqualify_type(x64_expr_type(expr->modify.expr));
+    int32_t delta = is_ptr_type(type) ? (int32_t)x64_elem_size(type) : 1;
+    gen_x64_addr(expr->modify.expr);
+    x64_push(X64_RAX);
+    x64_load(type);
+    x64_mov_rr(X64_RDX, X64_RAX);
+    x64_add_imm(X64_RAX, expr->modify.op == TOKEN_INC ? delta : -delta);
+    x64_normalize(type);
+    x64_pop(X64_RCX);
+    x64_store(type);
+    if (expr->modify.post) {
+        x64_mov_rr(X64_RAX, X64_RDX);
+    }
+}
+
+void gen_x64_ternary(Expr *expr) {
+    Type *type = x64_expr_type(expr);
+    int else_label = x64_new_label();
+    int end_label = x64_new_label();
+    gen_x64_expr(expr->ternary.cond);
+    x64_jz(else_label);
+    gen_x64_expr(expr->ternary.then_expr);
+    x64_convert(type_decay(x64_expr_type(expr->ternary.then_expr)), type);
+    x64_jmp(end_label);
+    x64_bind_label(else_label);
+    gen_x64_expr(expr->ternary.else_expr);
+    x64_convert(type_decay(x64_expr_type(expr->ternary.else_expr)), type);
+    x64_bind_label(end_label);
+}
+
+void gen_x64_name(SrcPos pos, const char *name, Sym *sym) {
+    Type *type;
+    if (!sym) {
+        X64Local *local = x64_get_local(name);
+        assert(local);
+        type = local->type;
+    } else if (sym->kind == SYM_FUNC) {
+        if (is_intrinsic(sym)) {
+            fatal_x64_unsupported(pos, "Intrinsic");
+        }
+        x64_sym_addr(sym);
+        return;
+    } else {
+        type = sym->type;
+    }
+    gen_x64_name_addr(pos, name, sym);
+    x64_load(type);
+}
+
+void gen_x64_expr(Expr *expr) {
+    Type *type = x64_expr_type(expr);
+    if (is_implicit_any(expr)) {
+        fatal_x64_unsupported(expr->pos, "Conversion to any");
+    }
+    if (is_floating_type(unqualify_type(type))) {
+        fatal_x64_unsupported(expr->pos, "Floating point");
+    }
+    if (is_vector_type(unqualify_type(type))) {
+        fatal_x64_unsupported(expr->pos, "Vector type");
+    }
+    if (is_resolved_const(expr)) {
+        x64_mov_imm(X64_RAX, (uint64_t)x64_normalize_const(x64_const_val(expr), type));
+        return;
+    }
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        gen_x64_expr(expr->paren.expr);
+        break;
+    case EXPR_STR:
+        x64_str_addr(expr->str_lit.val);
+        break;
+    case EXPR_NAME:
+        gen_x64_name(expr->pos, expr->name, get_resolved_sym(expr));
+        break;
+    case EXPR_CAST:
+        gen_x64_expr(expr->cast.expr);
+        x64_convert(type_decay(x64_expr_type(expr->cast.expr)), type);
+        break;
+    case EXPR_CALL:
+        gen_x64_call(expr);
+        break;
+    case EXPR_INDEX:
+        gen_x64_index_addr(expr);
+        x64_load(type);
+        break;
+    case EXPR_FIELD: {
+        Sym *sym = get_resolved_sym(expr);
+        if (sym) {
+            gen_x64_name(expr->pos, sym->name, sym);
+        } else {
+            gen_x64_field_addr(expr);
+            x64_load(type);
+        }
+        break;
+    }
+    case EXPR_COMPOUND:
+        gen_x64_compound(expr);
+        break;
+    case EXPR_UNARY:
+        gen_x64_unary(expr);
+        break;
+    case EXPR_BINARY:
+        gen_x64_binary(expr);
+        break;
+    case EXPR_TERNARY:
+        gen_x64_ternary(expr);
+        break;
+    case EXPR_MODIFY:
+        gen_x64_modify(expr);
+        break;
+    case EXPR_NEW:
+        fatal_x64_unsupported(expr->pos, "new");
+        break;
+    default:
+        fatal_x64_unsupported(expr->pos, "This expression");
+        break;
+    }
+}
+
+void gen_x64_stmt_block(StmtList block) {
+    size_t num_locals = buf_len(x64_locals);
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        gen_x64_stmt(block.stmts[i]);
+    }
+    if (x64_locals) {
+        buf__hdr(x64_locals)->len = num_locals;
+    }
+}
+
+void gen_x64_stmt_init(Stmt *stmt) {
+    Type *type = get_resolved_type(stmt);
+    int32_t offset = x64_alloc_local(type_sizeof(type), x64_alignof_decl(stmt->pos, type, stmt->notes));
+    Expr *expr = stmt->init.expr;
+    if (stmt->init.is_undef) {
+        // Leave the slot uninitialized.
+    } else if (expr) {
+        if (is_x64_memory_type(type) && (expr->kind == EXPR_STR || expr->kind == EXPR_COMPOUND)) {
+            x64_zero_local(offset, type_sizeof(type));
+        }
+        gen_x64_init_at(type, expr, offset);
+    } else {
+        x64_zero_local(offset, type_sizeof(type));
+    }
+    x64_push_local(stmt->init.name, type, offset);
+}
+
+void gen_x64_stmt_assign(Stmt *stmt) {
+    Expr *left = stmt->assign.left;
+    Expr *right = stmt->assign.right;
+    Type *left_type = unqualify_type(x64_expr_type(left));
+    Type *right_type = type_decay(x64_expr_type(right));
+    gen_x64_addr(left);
+    x64_push(X64_RAX);
+    if (stmt->assign.op == TOKEN_ASSIGN) {
+        gen_x64_expr(right);
+        x64_convert(right_type, left_type);
+    } else {
+        TokenKind op = assign_token_to_binary_token[stmt->assign.op];
+        x64_load(left_type);
+        Type *ptr_type = pointer_promo_type(left);
+        if (!ptr_type && is_ptr_type(left_type)) {
+            ptr_type = left_type;
+        }
+        Type *type = ptr_type ? type_uintptr : x64_binary_type(op, left_type, right_type);
+        x64_convert(left_type, type);
+        x64_push(X64_RAX);
+        gen_x64_expr(right);
+        if (ptr_type) {
+            size_t elem_size = x64_elem_size(ptr_type);
+            if (elem_size != 1) {
+                x64_emit(0x48, 0x69, 0xC0);
+                x64_emit32((uint32_t)elem_size);
+            }
+        } else if (op != TOKEN_LSHIFT && op != TOKEN_RSHIFT) {
+            x64_convert(right_type, type);
+        }
+        x64_mov_rr(X64_RCX, X64_RAX);
+        x64_pop(X64_RAX);
+        x64_binary_op(op, type);
+        x64_convert(type, left_type);
+    }
+    x64_pop(X64_RCX);
+    x64_store(left_type);
+}
+
+void gen_x64_simple_stmt(Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_EXPR:
+        gen_x64_expr(stmt->expr);
+        break;
+    case STMT_INIT:
+        gen_x64_stmt_init(stmt);
+        break;
+    case STMT_ASSIGN:
+        gen_x64_stmt_assign(stmt);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void gen_x64_cond_jz(Expr *cond, int label) {
+    gen_x64_expr(cond);
+    x64_jz(label);
+}
+
+void gen_x64_trap_unless(int label) {
+    x64_jcc(X64_CC_NE, label);
+    x64_emit(0x0F, 0x0B);
+    x64_bind_label(label);
+}
+
+void gen_x64_stmt_if(Stmt *stmt) {
+    size_t num_locals = buf_len(x64_locals);
+    int end_label = x64_new_label();
+    int next_label = x64_new_label();
+    if (stmt->if_stmt.init) {
+        gen_x64_stmt(stmt->if_stmt.init);
+    }
+    if (stmt->if_stmt.cond) {
+        gen_x64_cond_jz(stmt->if_stmt.cond, next_label);
+    } else {
+        X64Local *local = x64_get_local(stmt->if_stmt.init->init.name);
+        x64_lea_local(X64_RAX, local->offset);
+        x64_load(local->type);
+        x64_jz(next_label);
+    }
+    gen_x64_stmt_block(stmt->if_stmt.then_block);
+    x64_jmp(end_label);
+    for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+        ElseIf elseif = stmt->if_stmt.elseifs[i];
+        x64_bind_label(next_label);
+        next_label = x64_new_label();
+        gen_x64_cond_jz(elseif.cond, next_label);
+        gen_x64_stmt_block(elseif.block);
+        x64_jmp(end_label);
+    }
+    x64_bind_label(next_label);
+    if (stmt->if_stmt.else_block.stmts) {
+        gen_x64_stmt_block(stmt->if_stmt.else_block);
+    } else if (get_stmt_note(stmt, complete_name)) {
+        x64_emit(0x0F, 0x0B);
+    }
+    x64_bind_label(end_label);
+    if (x64_locals) {
+        buf__hdr(x64_locals)->len = num_locals;
+    }
+}
+
+void gen_x64_stmt_switch(Stmt *stmt) {
+    Type *type = x64_expr_type(stmt->switch_stmt.expr);
+    bool sign = is_x64_signed_type(type);
+    int end_label = x64_new_label();
+    int default_label = end_label;
+    int *case_labels = NULL;
+    gen_x64_expr(stmt->switch_stmt.expr);
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase switch_case = stmt->switch_stmt.cases[i];
+        int case_label = x64_new_label();
+        buf_push(case_labels, case_label);
+        if (switch_case.is_default) {
+            default_label = case_label;
+        }
+        for (size_t j = 0; j < switch_case.num_patterns; j++) {
+            SwitchCasePattern pattern = switch_case.patterns[j];
+            long long start = x64_normalize_const(x64_const_val(pattern.start), type);
+            x64_mov_imm(X64_RCX, (uint64_t)start);
+            x64_op_rr(0x39, X64_RAX, X64_RCX);
+            if (!pattern.end) {
+                x64_jcc(X64_CC_E, case_label);
+            } else {
+                long long end = x64_normalize_const(x64_const_val(pattern.end), type);
+                int next_label = x64_new_label();
+                x64_jcc(sign ? X64_CC_L : X64_CC_B, next_label);
+                x64_mov_imm(X64_RCX, (uint64_t)end);
+                x64_op_rr(0x39, X64_RAX, X64_RCX);
+                x64_jcc(sign ? X64_CC_LE : X64_CC_BE, case_label);
+                x64_bind_label(next_label);
+            }
+        }
+    }
+    if (default_label == end_label && get_stmt_note(stmt, complete_name)) {
+        default_label = x64_new_label();
+        x64_jmp(default_label);
+        x64_bind_label(default_label);
+        x64_emit(0x0F, 0x0B);
+    } else {
+        x64_jmp(default_label);
+    }
+    int old_break_label = x64_break_label;
+    x64_break_label = end_label;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        x64_bind_label(case_labels[i]);
+        gen_x64_stmt_block(stmt->switch_stmt.cases[i].block);
+        x64_jmp(end_label);
+    }
+    x64_break_label = old_break_label;
+    x64_bind_label(end_label);
+    buf_free(case_labels);
+}
+
+int x64_goto_label(const char *name) {
+    for (X64GotoLabel *it = x64_goto_labels; it != buf_end(x64_goto_labels); it++) {
+        if (it->name == name) {
+            return it->label;
+        }
+    }
+    int label = x64_new_label();
+    buf_push(x64_goto_labels, (X64GotoLabel){name, label});
+    return label;
+}
+
+// Loops test their condition at the bottom. While and for loops enter through the test, and
+// continue in a for loop runs the next statement before it.
+void gen_x64_loop(Stmt *init, Expr *cond, Stmt *next, StmtList block, bool cond_first) {
+    size_t num_locals = buf_len(x64_locals);
+    int old_break_label = x64_break_label;
+    int old_continue_label = x64_continue_label;
+    int top_label = x64_new_label();
+    int cond_label = x64_new_label();
+    x64_break_label = x64_new_label();
+    x64_continue_label = next ? x64_new_label() : cond_label;
+    if (init) {
+        gen_x64_simple_stmt(init);
+    }
+    if (cond_first) {
+        x64_jmp(cond_label);
+    }
+    x64_bind_label(top_label);
+    gen_x64_stmt_block(block);
+    if (next) {
+        x64_bind_label(x64_continue_label);
+        gen_x64_simple_stmt(next);
+    }
+    x64_bind_label(cond_label);
+    if (cond) {
+        gen_x64_expr(cond);
+        x64_test_rax();
+        x64_jcc(X64_CC_NE, top_label);
+    } else {
+        x64_jmp(top_label);
+    }
+    x64_bind_label(x64_break_label);
+    x64_break_label = old_break_label;
+    x64_continue_label = old_continue_label;
+    if (x64_locals) {
+        buf__hdr(x64_locals)->len = num_locals;
+    }
+}
+
+void gen_x64_stmt(Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        if (stmt->expr) {
+            if (is_x64_memory_type(x64_ret_type)) {
+                fatal_x64_unsupported(stmt->pos, "Returning an aggregate");
+            }
+            gen_x64_expr(stmt->expr);
+            x64_convert(type_decay(x64_expr_type(stmt->expr)), x64_ret_type);
+        }
+        x64_emit(0xC9, 0xC3);
+        break;
+    case STMT_BREAK:
+        x64_jmp(x64_break_label);
+        break;
+    case STMT_CONTINUE:
+        x64_jmp(x64_continue_label);
+        break;
+    case STMT_BLOCK:
+        gen_x64_stmt_block(stmt->block);
+        break;
+    case STMT_NOTE:
+        if (stmt->note.name == assert_name) {
+            gen_x64_expr(stmt->note.args[0].expr);
+            x64_test_rax();
+            gen_x64_trap_unless(x64_new_label());
+        }
+        break;
+    case STMT_IF:
+        gen_x64_stmt_if(stmt);
+        break;
+    case STMT_WHILE:
+        gen_x64_loop(NULL, stmt->while_stmt.cond, NULL, stmt->while_stmt.block, true);
+        break;
+    case STMT_DO_WHILE:
+        gen_x64_loop(NULL, stmt->while_stmt.cond, NULL, stmt->while_stmt.block, false);
+        break;
+    case STMT_FOR:
+        gen_x64_loop(stmt->for_stmt.init, stmt->for_stmt.cond, stmt->for_stmt.next, stmt->for_stmt.block, true);
+        break;
+    case STMT_SWITCH:
+        gen_x64_stmt_switch(stmt);
+        break;
+    case STMT_LABEL:
+        x64_bind_label(x64_goto_label(stmt->label));
+        break;
+    case STMT_GOTO:
+        x64_jmp(x64_goto_label(stmt->label));
+        break;
+    default:
+        gen_x64_simple_stmt(stmt);
+        break;
+    }
+}
+
+void x64_data_rela(size_t offset, uint32_t sym_index, int64_t addend) {
+    buf_push(x64_data_relas, (ElfRela){offset, (uint64_t)sym_index << 32 | R_X86_64_64, addend});
+}
+
+void gen_x64_static_compound(Expr *expr, size_t offset);
+
+void gen_x64_static_init(Type *type, Expr *expr, size_t offset) {
+    type = unqualify_type(type);
+    if (expr->kind == EXPR_PAREN) {
+        gen_x64_static_init(type, expr->paren.expr, offset);
+        return;
+    }
+    if (is_implicit_any(expr)) {
+        fatal_x64_unsupported(expr->pos, "Conversion to any");
+    }
+    if (is_floating_type(x64_scalar_type(type))) {
+        fatal_x64_unsupported(expr->pos, "Floating point");
+    }
+    if (is_vector_type(unqualify_type(type))) {
+        fatal_x64_unsupported(expr->pos, "Vector type");
+    }
+    size_t size = type_sizeof(type);
+    if (expr->kind == EXPR_COMPOUND) {
+        if (is_x64_memory_type(x64_expr_type(expr))) {
+            gen_x64_static_compound(expr, offset);
+        } else if (expr->compound.num_fields == 1) {
+            gen_x64_static_init(type, expr->compound.fields[0].init, offset);
+        }
+        return;
+    }
+    if (type->kind == TYPE_ARRAY && expr->kind == EXPR_STR) {
+        memcpy(x64_data + offset, expr->str_lit.val, MIN(size, strlen(expr->str_lit.val) + 1));
+        return;
+    }
+    if (is_resolved_const(expr)) {
+        unsigned long long val = (unsigned long long)x64_normalize_const(x64_const_val(expr), type);
+        for (size_t i = 0; i < size; i++) {
+            x64_data[offset + i] = (uint8_t)(val >> 8*i);
+        }
+        return;
+    }
+    if (size == type_metrics[TYPE_PTR].size) {
+        if (expr->kind == EXPR_STR) {
+            x64_data_rela(offset, ELF_SYM_RODATA, x64_rodata_str(expr->str_lit.val));
+            return;
+        }
+        bool is_addr = expr->kind == EXPR_UNARY && expr->unary.op == TOKEN_AND;
+        Sym *sym = get_resolved_sym(is_addr ? expr->unary.expr : expr);
+        if (sym && (sym->kind == SYM_FUNC || (sym->kind == SYM_VAR && (is_addr || is_array_type(sym->type))))) {
+            x64_data_rela(offset, x64_sym_index(sym), 0);
+            return;
+        }
+    }
+    fatal_x64_unsupported(expr->pos, "Non-constant global initializer");
+}
+
+void gen_x64_static_compound(Expr *expr, size_t offset) {
+    Type *type = unqualify_type(x64_expr_type(expr));
+    if (is_aggregate_type(type)) {
+        int index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_NAME) {
+                index = aggregate_item_field_index(type, field.name);
+            }
+            TypeField type_field = type->aggregate.fields[index];
+            gen_x64_static_init(type_field.type, field.init, offset + type_field.offset);
+            index++;
+        }
+    } else {
+        size_t index = 0;
+        size_t elem_size = type_sizeof(type->base);
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_INDEX) {
+                index = (size_t)x64_const_val(field.index);
+            }
+            gen_x64_static_init(type->base, field.init, offset + index * elem_size);
+            index++;
+        }
+    }
+}
+
+void gen_x64_var(Sym *sym) {
+    Decl *decl = sym->decl;
+    Type *type = sym->type;
+    if (is_decl_threadlocal(decl)) {
+        fatal_x64_unsupported(decl->pos, "@threadlocal variable");
+    }
+    size_t size = type_sizeof(type);
+    size_t align = x64_alignof_decl(decl->pos, type, decl->notes);
+    if (decl->var.expr) {
+        x64_align_data(&x64_data, align);
+        size_t offset = buf_len(x64_data);
+        buf_fit(x64_data, offset + size);
+        memset(x64_data + offset, 0, size);
+        buf__hdr(x64_data)->len += size;
+        uint8_t *data = get_eval_init(decl->var.expr);
+        if (data) {
+            memcpy(x64_data + offset, data, size);
+        } else {
+            gen_x64_static_init(type, decl->var.expr, offset);
+        }
+        x64_define_sym(sym, ELF_SECTION_DATA, offset, size);
+    } else {
+        x64_bss_size = ALIGN_UP(x64_bss_size, align);
+        x64_define_sym(sym, ELF_SECTION_BSS, x64_bss_size, size);
+        x64_bss_size += size;
+    }
+}
+
+void gen_x64_func(Sym *sym) {
+    Decl *decl = sym->decl;
+    Type *type = sym->type;
+    if (type->func.has_varargs) {
+        fatal_x64_unsupported(decl->pos, "Defining a varargs function");
+    }
+    if (is_x64_memory_type(type->func.ret)) {
+        fatal_x64_unsupported(decl->pos, "Returning an aggregate");
+    }
+    buf_clear(x64_locals);
+    buf_clear(x64_labels);
+    buf_clear(x64_fixups);
+    buf_clear(x64_goto_labels);
+    x64_frame_size = 0;
+    x64_depth = 0;
+    x64_break_label = -1;
+    x64_continue_label = -1;
+    x64_ret_type = type->func.ret;
+    uint32_t start = x64_pos();
+    x64_push(X64_RBP);
+    x64_mov_rr(X64_RBP, X64_RSP);
+    x64_depth = 0;
+    x64_emit(0x48, 0x81, 0xEC);
+    uint32_t frame_size_at = x64_pos();
+    x64_emit32(0);
+    for (size_t i = 0; i < type->func.num_params; i++) {
+        Type *param_type = type->func.params[i];
+        if (is_x64_memory_type(param_type)) {
+            fatal_x64_unsupported(decl->func.params[i].pos, "Passing an aggregate by value");
+        }
+        int32_t offset;
+        if (i < X64_NUM_ARG_REGS) {
+            offset = x64_alloc_local(8, 8);
+            x64_store_local64(offset, x64_arg_regs[i]);
+        } else {
+            offset = 16 + 8*(int32_t)(i - X64_NUM_ARG_REGS);
+        }
+        x64_push_local(decl->func.params[i].name, param_type, offset);
+    }
+    gen_x64_stmt_block(decl->func.block);
+    // Falling off the end returns 0, which is what main needs.
+    x64_emit(0x31, 0xC0, 0xC9, 0xC3);
+    x64_patch32(frame_size_at, (uint32_t)ALIGN_UP(x64_frame_size, 16));
+    x64_resolve_fixups();
+    x64_define_sym(sym, ELF_SECTION_TEXT, start, x64_pos() - start);
+}
+
+void gen_x64_sym(Sym *sym) {
+    if (sym->decl->kind == DECL_FUNC) {
+        gen_x64_func(sym);
+    } else {
+        gen_x64_var(sym);
+    }
+}
+
+size_t x64_elf_append(const void *data, size_t len, size_t align) {
+    while (buf_len(gen_buf) % align) {
+        buf_push(gen_buf, 0);
+    }
+    size_t offset = buf_len(gen_buf);
+    buf_fit(gen_buf, offset + len);
+    if (len) {
+        memcpy(gen_buf + offset, data, len);
+    }
+    buf__hdr(gen_buf)->len += len;
+    return offset;
+}
+
+void x64_write_elf(void) {
+    const char *section_names[NUM_ELF_SECTIONS] = {
+        [ELF_SECTION_NULL] = "",
+        [ELF_SECTION_TEXT] = ".text",
+        [ELF_SECTION_RELA_TEXT] = ".rela.text",
+        [ELF_SECTION_DATA] = ".data",
+        [ELF_SECTION_RELA_DATA] = ".rela.data",
+        [ELF_SECTION_BSS] = ".bss",
+        [ELF_SECTION_RODATA] = ".rodata",
+        [ELF_SECTION_NOTE_GNU_STACK] = ".note.GNU-stack",
+        [ELF_SECTION_SYMTAB] = ".symtab",
+        [ELF_SECTION_STRTAB] = ".strtab",
+        [ELF_SECTION_SHSTRTAB] = ".shstrtab",
+    };
+    ElfSection sections[NUM_ELF_SECTIONS] = {
+        [ELF_SECTION_TEXT] = {.type = ELF_SHT_PROGBITS, .flags = ELF_SHF_ALLOC | ELF_SHF_EXECINSTR, .addralign = 16},
+        [ELF_SECTION_RELA_TEXT] = {.type = ELF_SHT_RELA, .flags = ELF_SHF_INFO_LINK, .link = ELF_SECTION_SYMTAB, .info = ELF_SECTION_TEXT, .addralign = 8, .entsize = sizeof(ElfRela)},
+        [ELF_SECTION_DATA] = {.type = ELF_SHT_PROGBITS, .flags = ELF_SHF_WRITE | ELF_SHF_ALLOC, .addralign = 16},
+        [ELF_SECTION_RELA_DATA] = {.type = ELF_SHT_RELA, .flags = ELF_SHF_INFO_LINK, .link = ELF_SECTION_SYMTAB, .info = ELF_SECTION_DATA, .addralign = 8, .entsize = sizeof(ElfRela)},
+        [ELF_SECTION_BSS] = {.type = ELF_SHT_NOBITS, .flags = ELF_SHF_WRITE | ELF_SHF_ALLOC, .addralign = 16},
+        [ELF_SECTION_RODATA] = {.type = ELF_SHT_PROGBITS, .flags = ELF_SHF_ALLOC, .addralign = 1},
+        [ELF_SECTION_NOTE_GNU_STACK] = {.type = ELF_SHT_PROGBITS, .addralign = 1},
+        [ELF_SECTION_SYMTAB] = {.type = ELF_SHT_SYMTAB, .link = ELF_SECTION_STRTAB, .info = NUM_ELF_LOCAL_SYMS, .addralign = 8, .entsize = sizeof(ElfSym)},
+        [ELF_SECTION_STRTAB] = {.type = ELF_SHT_STRTAB, .addralign = 1},
+        [ELF_SECTION_SHSTRTAB] = {.type = ELF_SHT_STRTAB, .addralign = 1},
+    };
+    char *shstrtab = NULL;
+    for (int i = 0; i < NUM_ELF_SECTIONS; i++) {
+        sections[i].name = (uint32_t)buf_len(shstrtab);
+        size_t len = strlen(section_names[i]) + 1;
+        buf_fit(shstrtab, buf_len(shstrtab) + len);
+        memcpy(buf_end(shstrtab), section_names[i], len);
+        buf__hdr(shstrtab)->len += len;
+    }
+    struct {
+        const void *data;
+        size_t size;
+    } contents[NUM_ELF_SECTIONS] = {
+        [ELF_SECTION_TEXT] = {x64_text, buf_sizeof(x64_text)},
+        [ELF_SECTION_RELA_TEXT] = {x64_text_relas, buf_sizeof(x64_text_relas)},
+        [ELF_SECTION_DATA] = {x64_data, buf_sizeof(x64_data)},
+        [ELF_SECTION_RELA_DATA] = {x64_data_relas, buf_sizeof(x64_data_relas)},
+        [ELF_SECTION_RODATA] = {x64_rodata, buf_sizeof(x64_rodata)},
+        [ELF_SECTION_SYMTAB] = {x64_syms, buf_sizeof(x64_syms)},
+        [ELF_SECTION_STRTAB] = {x64_strtab, buf_sizeof(x64_strtab)},
+        [ELF_SECTION_SHSTRTAB] = {shstrtab, buf_sizeof(shstrtab)},
+    };
+    gen_buf = NULL;
+    ElfHeader header = {
+        .ident = {0x7F, 'E', 'L', 'F', 2, 1, 1},
+        .type = 1,
+        .machine = 62,
+        .version = 1,
+        .ehsize = sizeof(ElfHeader),
+        .shentsize = sizeof(ElfSection),
+        .shnum = NUM_ELF_SECTIONS,
+        .shstrndx = ELF_SECTION_SHSTRTAB,
+    };
+    x64_elf_append(&header, sizeof(header), 1);
+    for (int i = 1; i < NUM_ELF_SECTIONS; i++) {
+        sections[i].offset = x64_elf_append(contents[i].data, contents[i].size, sections[i].addralign);
+        sections[i].size = contents[i].size;
+    }
+    sections[ELF_SECTION_BSS].size = x64_bss_size;
+    header.shoff = x64_elf_append(sections, sizeof(sections), 8);
+    memcpy(gen_buf, &header, sizeof(header));
+    buf_free(shstrtab);
+}
+
+// Typeinfo tables aren't generated natively, so define them empty as with -notypeinfo.
+void gen_x64_typeinfos(void) {
+    const char *names[] = {"typeinfos", "num_typeinfos"};
+    for (size_t i = 0; i < sizeof(names)/sizeof(*names); i++) {
+        Sym *sym = get_package_sym(builtin_package, str_intern(names[i]));
+        if (sym && sym->kind == SYM_VAR) {
+            x64_bss_size = ALIGN_UP(x64_bss_size, x64_alignof(sym->type));
+            x64_define_sym(sym, ELF_SECTION_BSS, x64_bss_size, type_sizeof(sym->type));
+            x64_bss_size += type_sizeof(sym->type);
+        }
+    }
+}
+
+void gen_x64_program(void) {
+    x64_add_string("");
+    buf_push(x64_syms, (ElfSym){0});
+    buf_push(x64_syms, (ElfSym){.info = ELF_STB_LOCAL << 4 | ELF_STT_SECTION, .shndx = ELF_SECTION_TEXT});
+    buf_push(x64_syms, (ElfSym){.info = ELF_STB_LOCAL << 4 | ELF_STT_SECTION, .shndx = ELF_SECTION_DATA});
+    buf_push(x64_syms, (ElfSym){.info = ELF_STB_LOCAL << 4 | ELF_STT_SECTION, .shndx = ELF_SECTION_BSS});
+    buf_push(x64_syms, (ElfSym){.info = ELF_STB_LOCAL << 4 | ELF_STT_SECTION, .shndx = ELF_SECTION_RODATA});
+    for (Sym **it = sorted_syms; it != buf_end(sorted_syms); it++) {
+        Sym *sym = *it;
+        if (is_x64_defined_sym(sym) && (sym->decl->kind == DECL_FUNC || sym->decl->kind == DECL_VAR)) {
+            recover_sym(gen_x64_sym, sym);
+        }
+    }
+    gen_x64_typeinfos();
+}
+
+void gen_x64_all(void) {
+    gen_x64_program();
+    x64_write_elf();
+}
+
+// In-memory linking for -run. The text section and a jmp stub per foreign function share the
+// executable pages; the GOT, rodata, data and bss follow in writable pages, so everything the
+// code addresses rip-relatively is within rel32 range.
+
+enum {
+    X64_PAGE_SIZE = 4096,
+    X64_STUB_SIZE = 8,
+};
+
+bool x64_patch_rel32(uint8_t *at, uint64_t target) {
+    int64_t rel = (int64_t)(target - (uint64_t)at);
+    if (rel != (int32_t)rel) {
+        return false;
+    }
+    int32_t rel32 = (int32_t)rel;
+    memcpy(at, &rel32, sizeof(rel32));
+    return true;
+}
+
+void *x64_jit_link(Sym *entry_sym) {
+    size_t num_syms = buf_len(x64_syms);
+    size_t stubs_offset = ALIGN_UP(buf_len(x64_text), 16);
+    size_t code_size = ALIGN_UP(stubs_offset + num_syms * X64_STUB_SIZE, X64_PAGE_SIZE);
+    size_t got_offset = code_size;
+    size_t rodata_offset = got_offset + num_syms * sizeof(uint64_t);
+    size_t data_offset = ALIGN_UP(rodata_offset + buf_len(x64_rodata), 16);
+    size_t bss_offset = ALIGN_UP(data_offset + buf_len(x64_data), 16);
+    size_t image_size = ALIGN_UP(bss_offset + x64_bss_size, X64_PAGE_SIZE);
+    uint8_t *image = jit_alloc(image_size);
+    if (!image) {
+        fprintf(stderr, "error: Failed to allocate %zu bytes of executable memory\n", image_size);
+        return NULL;
+    }
+    memcpy(image, x64_text, buf_len(x64_text));
+    memcpy(image + rodata_offset, x64_rodata, buf_len(x64_rodata));
+    memcpy(image + data_offset, x64_data, buf_len(x64_data));
+    uint64_t section_addrs[NUM_ELF_SECTIONS] = {
+        [ELF_SECTION_TEXT] = (uint64_t)image,
+        [ELF_SECTION_DATA] = (uint64_t)(image + data_offset),
+        [ELF_SECTION_BSS] = (uint64_t)(image + bss_offset),
+        [ELF_SECTION_RODATA] = (uint64_t)(image + rodata_offset),
+    };
+    uint64_t *got = (uint64_t *)(image + got_offset);
+    uint64_t *sym_addrs = NULL;
+    uint64_t *call_addrs = NULL;
+    bool ok = true;
+    buf_push(sym_addrs, 0);
+    buf_push(call_addrs, 0);
+    for (size_t i = 1; i < num_syms; i++) {
+        ElfSym *elf_sym = &x64_syms[i];
+        uint64_t addr;
+        uint64_t call_addr;
+        if (elf_sym->shndx) {
+            addr = section_addrs[elf_sym->shndx] + elf_sym->value;
+            call_addr = addr;
+        } else {
+            const char *name = x64_strtab + elf_sym->name;
+            addr = (uint64_t)jit_lookup_sym(name);
+            if (!addr) {
+                fprintf(stderr, "error: Unresolved foreign symbol '%s'\n", name);
+                ok = false;
+            }
+            // jmp [rip + got]
+            uint8_t *stub = image + stubs_offset + i * X64_STUB_SIZE;
+            stub[0] = 0xFF;
+            stub[1] = 0x25;
+            x64_patch_rel32(stub + 2, (uint64_t)&got[i] - 4);
+            call_addr = (uint64_t)stub;
+        }
+        got[i] = addr;
+        buf_push(sym_addrs, addr);
+        buf_push(call_addrs, call_addr);
+    }
+    for (ElfRela *it = x64_text_relas; ok && it != buf_end(x64_text_relas); it++) {
+        uint32_t index = (uint32_t)(it->info >> 32);
+        uint8_t *at = image + it->offset;
+        uint64_t target;
+        switch ((uint32_t)it->info) {
+        case R_X86_64_PC32:
+            target = sym_addrs[index];
+            break;
+        case R_X86_64_PLT32:
+            target = call_addrs[index];
+            break;
+        case R_X86_64_GOTPCREL:
+            target = (uint64_t)&got[index];
+            break;
+        default:
+            assert(0);
+            target = 0;
+            break;
+        }
+        if (!x64_patch_rel32(at, target + it->addend)) {
+            fprintf(stderr, "error: Relocation out of range for '%s'\n", x64_strtab + x64_syms[index].name);
+            ok = false;
+        }
+    }
+    for (ElfRela *it = x64_data_relas; ok && it != buf_end(x64_data_relas); it++) {
+        assert((uint32_t)it->info == R_X86_64_64);
+        uint64_t value = sym_addrs[it->info >> 32] + it->addend;
+        memcpy(image + data_offset + it->offset, &value, sizeof(value));
+    }
+    void *entry = (void *)sym_addrs[map_get_uint64(&x64_sym_indices, entry_sym)];
+    buf_free(sym_addrs);
+    buf_free(call_addrs);
+    if (ok && !jit_protect_exec(image, code_size)) {
+        fprintf(stderr, "error: Failed to make generated code executable\n");
+        ok = false;
+    }
+    return ok ? entry : NULL;
+}
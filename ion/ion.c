@@ -88,21 +88,49 @@ void parse_env_vars(void) {
     }
 }
 
+double time_ms(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 int ion_main(int argc, const char **argv) {
+    double start_time = time_ms();
     parse_env_vars();
     const char *output_name = NULL;
     bool flag_check = false;
-    add_flag_str("o", &output_name, "file", "Output file (default: out_<main-package>.c)");
+    bool flag_native = false;
+    bool flag_run = false;
+    add_flag_str("o", &output_name, "file", "Output file (default: out_<main-package>.c, or .o with -native)");
     add_flag_enum("os", &target_os, "Target operating system", os_names, NUM_OSES);
     add_flag_enum("arch", &target_arch, "Target machine architecture", arch_names, NUM_ARCHES);
     add_flag_bool("check", &flag_check, "Semantic checking with no code generation");
+    add_flag_bool("native", &flag_native, "Generate an x64 ELF object file directly instead of C (language subset, no floats)");
+    add_flag_bool("run", &flag_run, "Compile main to memory with the native backend and run it; later arguments go to the program");
     add_flag_bool("lazy", &flag_lazy, "Only compile what's reachable from the main package");
     add_flag_bool("notypeinfo", &flag_notypeinfo, "Don't generate any typeinfo tables");
     add_flag_bool("fullgen", &flag_fullgen, "Force full code generation even for non-reachable symbols");
     add_flag_bool("nolinesync", &flag_nolinesync, "Disable #line synchronization between Ion code and generated C code.");
+    add_flag_bool("compactlinesync", &flag_compactlinesync, "Only emit #line at statement boundaries where the line mapping diverges.");
     add_flag_bool("verbose", &flag_verbose, "Extra diagnostic information");
+    add_flag_bool("jsondiag", &flag_jsondiag, "Print diagnostics as JSON lines with file, line, column and code");
+    add_flag_int("maxerrors", &flag_maxerrors, "n", "Stop after this many errors (0 for no limit)");
+    add_flag_int("inlinebudget", &flag_inlinebudget, "n", "Largest @inline function body in AST nodes that the C backend inlines (0 disables inlining)");
+    add_flag_bool("inlinereport", &flag_inlinereport, "Report the calls that the C backend inlines or declines to inline");
+    add_flag_bool("allocsites", &flag_allocsites, "Store the source position of each new, alloc and growing array call in alloc_site for allocation profiling");
+    // -run executes the program in this process, so it targets the host unless -os or -arch is given.
+    int default_os = target_os;
+    int default_arch = target_arch;
+    target_os = -1;
+    target_arch = -1;
     const char *program_name = parse_flags(&argc, &argv);
-    if (argc != 1) {
+    if (target_os == -1) {
+        target_os = flag_run ? OS_LINUX : default_os;
+    }
+    if (target_arch == -1) {
+        target_arch = flag_run ? ARCH_X64 : default_arch;
+    }
+    if (argc < 1 || (argc > 1 && !flag_run)) {
         printf("Usage: %s [flags] <main-package>\n", program_name);
         print_flags_usage();
         return 1;
@@ -147,7 +175,7 @@ int ion_main(int argc, const char **argv) {
     }
     main_sym->external_name = main_name;
     reachable_phase = REACHABLE_NATURAL;
-    resolve_sym(main_sym);
+    recover_sym(resolve_sym, main_sym);
     for (size_t i = 0; i < buf_len(package_list); i++) {
         if (package_list[i]->always_reachable) {
             resolve_package_syms(package_list[i]);
@@ -164,15 +192,62 @@ int ion_main(int argc, const char **argv) {
         }
         finalize_reachable_syms();
     }
-    printf("Processed %d symbols in %d packages\n", (int)buf_len(reachable_syms), (int)buf_len(package_list));
+    if (!flag_run || flag_verbose) {
+        printf("Processed %d symbols in %d packages\n", (int)buf_len(reachable_syms), (int)buf_len(package_list));
+    }
+    if (flag_verbose) {
+        print_escape_stats();
+    }
+    if (num_errors) {
+        if (!flag_jsondiag) {
+            fprintf(stderr, "error: Compilation failed with %d error%s\n", num_errors, num_errors == 1 ? "" : "s");
+        }
+        return 1;
+    }
+    if ((flag_native || flag_run) && (target_os != OS_LINUX || target_arch != ARCH_X64)) {
+        fprintf(stderr, "error: -native and -run only support linux/x64\n");
+        return 1;
+    }
+    if (flag_run) {
+        gen_x64_program();
+        if (num_errors) {
+            if (!flag_jsondiag) {
+                fprintf(stderr, "error: Native code generation failed with %d error%s\n", num_errors, num_errors == 1 ? "" : "s");
+            }
+            return 1;
+        }
+        int (*entry)(int, const char **) = (int (*)(int, const char **))x64_jit_link(main_sym);
+        if (!entry) {
+            return 1;
+        }
+        if (flag_verbose) {
+            printf("Startup to main: %.2f ms\n", time_ms() - start_time);
+        }
+        fflush(stdout);
+        return entry(argc, argv);
+    }
     if (!flag_check) {
         char c_path[MAX_PATH];
         if (output_name) {
             path_copy(c_path, output_name);
         } else {
-            snprintf(c_path, sizeof(c_path), "out_%s.c", package_name);
+            snprintf(c_path, sizeof(c_path), "out_%s.%s", package_name, flag_native ? "o" : "c");
+        }
+        if (flag_native) {
+            gen_x64_all();
+            if (num_errors) {
+                if (!flag_jsondiag) {
+                    fprintf(stderr, "error: Native code generation failed with %d error%s\n", num_errors, num_errors == 1 ? "" : "s");
+                }
+                return 1;
+            }
+        } else {
+            gen_output_path = c_path;
+            gen_all();
+            if (flag_verbose || flag_inlinereport) {
+                print_inline_stats();
+            }
         }
-        gen_all();
         const char *c_code = gen_buf;
         gen_buf = NULL;
         if (!write_file(c_path, c_code, buf_len(c_code))) {
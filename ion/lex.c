@@ -34,6 +34,16 @@ const char *foreign_name;
 const char *printf_name;
 const char *inline_name;
 const char *complete_name;
+const char *noinline_name;
+const char *restrict_name;
+const char *likely_name;
+const char *unlikely_name;
+const char *hot_name;
+const char *cold_name;
+const char *flatten_name;
+const char *pure_name;
+const char *align_name;
+const char *soa_name;
 const char *assert_name;
 const char *intrinsic_name;
 const char *declare_note_name;
@@ -83,6 +93,16 @@ void init_keywords(void) {
     printf_name = str_intern("printf");
     inline_name = str_intern("inline");
     complete_name = str_intern("complete");
+    noinline_name = str_intern("noinline");
+    restrict_name = str_intern("restrict");
+    likely_name = str_intern("likely");
+    unlikely_name = str_intern("unlikely");
+    hot_name = str_intern("hot");
+    cold_name = str_intern("cold");
+    flatten_name = str_intern("flatten");
+    pure_name = str_intern("pure");
+    align_name = str_intern("align");
+    soa_name = str_intern("soa");
     assert_name = str_intern("assert");
     intrinsic_name = str_intern("intrinsic");
     declare_note_name = str_intern("declare_note");
@@ -275,12 +295,73 @@ TokenKind assign_token_to_binary_token[NUM_TOKEN_KINDS] = {
     [TOKEN_MOD_ASSIGN] = TOKEN_MOD,
 };
 
+// Positions are a file index and a byte offset. Lines and columns are only computed
+// when a diagnostic or #line directive needs them, from a lazily built line table.
 typedef struct SrcPos {
+    uint32_t file;
+    uint32_t offset;
+} SrcPos;
+
+typedef struct SrcLoc {
     const char *name;
     int line;
-} SrcPos;
+    int col;
+} SrcLoc;
+
+typedef struct SrcFile {
+    const char *name;
+    const char *text;
+    uint32_t len;
+    uint32_t *line_offsets;
+} SrcFile;
+
+SrcFile *src_files;
 
-SrcPos pos_builtin = {.name = "<builtin>"};
+SrcPos pos_builtin = {0};
+
+uint32_t add_src_file(const char *name, const char *text) {
+    if (!src_files) {
+        buf_push(src_files, (SrcFile){.name = "<builtin>"});
+    }
+    size_t len = text ? strlen(text) : 0;
+    if (len > UINT32_MAX) {
+        fatal("Source file %s is larger than 4 GB", name);
+    }
+    buf_push(src_files, (SrcFile){.name = name, .text = text, .len = (uint32_t)len});
+    return (uint32_t)(buf_len(src_files) - 1);
+}
+
+void build_line_offsets(SrcFile *file) {
+    buf_push(file->line_offsets, 0);
+    const char *end = file->text + file->len;
+    for (const char *ptr = file->text; (ptr = memchr(ptr, '\n', end - ptr)) != NULL; ptr++) {
+        buf_push(file->line_offsets, (uint32_t)(ptr + 1 - file->text));
+    }
+}
+
+SrcLoc get_src_loc(SrcPos pos) {
+    if (pos.file == 0 || pos.file >= buf_len(src_files)) {
+        return (SrcLoc){.name = "<builtin>"};
+    }
+    SrcFile *file = &src_files[pos.file];
+    if (!file->text) {
+        return (SrcLoc){.name = file->name};
+    }
+    if (!file->line_offsets) {
+        build_line_offsets(file);
+    }
+    size_t lo = 0;
+    size_t hi = buf_len(file->line_offsets);
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (file->line_offsets[mid] <= pos.offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (SrcLoc){file->name, (int)lo + 1, (int)(pos.offset - file->line_offsets[lo]) + 1};
+}
 
 typedef struct Token {
     TokenKind kind;
@@ -299,36 +380,85 @@ typedef struct Token {
 
 Token token;
 const char *stream;
-const char *line_start;
+const char *stream_start;
 
-void warning(SrcPos pos, const char *fmt, ...) {
-    if (pos.name == NULL) {
-        pos = pos_builtin;
+int num_errors;
+
+// Innermost point that fatal errors unwind to, or NULL if they should exit.
+jmp_buf *error_recovery;
+
+void print_json_str(FILE *file, const char *str) {
+    fputc('"', file);
+    for (const char *ptr = str; *ptr; ptr++) {
+        if (*ptr == '"' || *ptr == '\\') {
+            fprintf(file, "\\%c", *ptr);
+        } else if ((unsigned char)*ptr < 0x20) {
+            fprintf(file, "\\u%04x", *ptr);
+        } else {
+            fputc(*ptr, file);
+        }
     }
+    fputc('"', file);
+}
+
+// The code identifies the kind of diagnostic independently of its arguments. See diag.c.
+void print_diagnostic(SrcPos pos, const char *severity, const char *fmt, va_list args) {
+    SrcLoc loc = get_src_loc(pos);
+    if (flag_jsondiag) {
+        char message[1024];
+        vsnprintf(message, sizeof(message), fmt, args);
+        char code[16];
+        snprintf(code, sizeof(code), "E%04d", get_diag_code(fmt));
+        fprintf(stderr, "{\"file\": ");
+        print_json_str(stderr, loc.name);
+        fprintf(stderr, ", \"line\": %d, \"column\": %d, \"severity\": \"%s\", \"code\": \"%s\", \"message\": ", loc.line, loc.col, severity, code);
+        print_json_str(stderr, message);
+        fprintf(stderr, "}\n");
+    } else {
+        fprintf(stderr, "%s(%d): %s: ", loc.name, loc.line, severity);
+        vfprintf(stderr, fmt, args);
+        fprintf(stderr, "\n");
+    }
+}
+
+void warning(SrcPos pos, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    fprintf(stderr, "%s(%d): warning: ", pos.name, pos.line);
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
+    print_diagnostic(pos, "warning", fmt, args);
     va_end(args);
 }
 
 void error(SrcPos pos, const char *fmt, ...) {
-    if (pos.name == NULL) {
-        pos = pos_builtin;
-    }
     va_list args;
     va_start(args, fmt);
-    fprintf(stderr, "%s(%d): error: ", pos.name, pos.line);
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
+    print_diagnostic(pos, "error", fmt, args);
     va_end(args);
+    num_errors++;
+    if (flag_maxerrors > 0 && num_errors >= flag_maxerrors) {
+        if (!flag_jsondiag) {
+            fprintf(stderr, "error: Too many errors, stopping\n");
+        }
+        exit(1);
+    }
+}
+
+// Unwinds to the innermost recovery point after an error has been reported.
+NORETURN void recover_from_error(void) {
+    assert(num_errors > 0);
+    if (!error_recovery) {
+        exit(1);
+    }
+    longjmp(*error_recovery, 1);
 }
 
-#define fatal_error(...) (error(__VA_ARGS__), exit(1))
+#define fatal_error(...) (error(__VA_ARGS__), recover_from_error())
 #define error_here(...) (error(token.pos, __VA_ARGS__))
-#define warning_here(...) (error(token.pos, __VA_ARGS__))
-#define fatal_error_here(...) (error_here(__VA_ARGS__), exit(1)) // should be abort()
+#define warning_here(...) (warning(token.pos, __VA_ARGS__))
+#define fatal_error_here(...) (error_here(__VA_ARGS__), recover_from_error())
+
+bool is_token_at_line_start(void) {
+    return token.start == stream_start || token.start[-1] == '\n';
+}
 
 const char *token_info(void) {
     if (token.kind == TOKEN_NAME || token.kind == TOKEN_KEYWORD) {
@@ -547,9 +677,6 @@ void scan_str(void) {
                 // TODO: Should probably just read files in text mode instead.
                 buf_push(str, *stream);
             }
-            if (*stream == '\n') {
-                token.pos.line++;
-            }
             stream++;
         }
         if (!*stream) {
@@ -621,15 +748,13 @@ void scan_str(void) {
 void next_token(void) {
 repeat:
     token.start = stream;
+    token.pos.offset = (uint32_t)(stream - stream_start);
     token.mod = 0;
     token.suffix = 0;
     switch (*stream) {
     case ' ': case '\n': case '\r': case '\t': case '\v':
         while (isspace(*stream)) {
-            if (*stream++ == '\n') {
-                line_start = stream;
-                token.pos.line++;
-            }
+            stream++;
         }
         goto repeat;
     case '\'':
@@ -728,9 +853,6 @@ repeat:
                     level--;
                     stream += 2;
                 } else {
-                    if (*stream == '\n') {
-                        token.pos.line++;
-                    }
                     stream++;
                 }
             }
@@ -774,9 +896,8 @@ repeat:
 
 void init_stream(const char *name, const char *buf) {
     stream = buf;
-    line_start = stream;
-    token.pos.name = name ? name : "<string>";
-    token.pos.line = 1;
+    stream_start = buf;
+    token.pos.file = add_src_file(name ? name : "<string>", buf);
     next_token();
 }
 
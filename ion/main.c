@@ -5,9 +5,16 @@ bool flag_lazy;
 bool flag_notypeinfo;
 bool flag_fullgen;
 bool flag_nolinesync;
+bool flag_compactlinesync;
+bool flag_jsondiag;
+int flag_maxerrors = 20;
+bool flag_inlinereport;
+int flag_inlinebudget = 32;
+bool flag_allocsites;
 
 #include "common.c"
 #include "os.c"
+#include "diag.c"
 #include "lex.c"
 #include "type.c"
 #include "ast.h"
@@ -16,7 +23,9 @@ bool flag_nolinesync;
 #include "parse.c"
 #include "targets.c"
 #include "resolve.c"
+#include "eval.c"
 #include "gen.c"
+#include "gen_x64.c"
 #include "ion.c"
 #include "test.c"
 
@@ -108,6 +108,7 @@ typedef enum FlagKind {
     FLAG_BOOL,
     FLAG_STR,
     FLAG_ENUM,
+    FLAG_INT,
 } FlagKind;
 
 typedef struct FlagDef {
@@ -138,6 +139,10 @@ void add_flag_enum(const char *name, int *ptr, const char *help, const char **op
     buf_push(flag_defs, (FlagDef){.kind = FLAG_ENUM, .name = name, .help = help, .ptr.i = ptr, .options = options, .num_options = num_options});
 }
 
+void add_flag_int(const char *name, int *ptr, const char *arg_name, const char *help) {
+    buf_push(flag_defs, (FlagDef){.kind = FLAG_INT, .name = name, .help = help, .arg_name = arg_name, .ptr.i = ptr});
+}
+
 FlagDef *get_flag_def(const char *name) {
     for (size_t i = 0; i < buf_len(flag_defs); i++) {
         if (strcmp(flag_defs[i].name, name) == 0) {
@@ -173,6 +178,10 @@ void print_flags_usage(void) {
             snprintf(ptr, end - ptr, ">");
             break;
         }
+        case FLAG_INT:
+            snprintf(format, sizeof(format), "%s <%s>", flag.name, flag.arg_name ? flag.arg_name : "value");
+            snprintf(note, sizeof(note), "(default: %d)", *flag.ptr.i);
+            break;
         case FLAG_BOOL:
         default:
             snprintf(format, sizeof(format), "%s", flag.name);
@@ -233,6 +242,21 @@ const char *parse_flags(int *argc_ptr, const char ***argv_ptr) {
                 }
                 break;
             }
+            case FLAG_INT: {
+                if (i + 1 < argc) {
+                    i++;
+                } else {
+                    fatal("No value after %s\n", arg);
+                    break;
+                }
+                char *end;
+                long value = strtol(argv[i], &end, 10);
+                if (end == argv[i] || *end || value < INT_MIN || value > INT_MAX) {
+                    fatal("Invalid value '%s' for %s", argv[i], arg);
+                }
+                *flag->ptr.i = (int)value;
+                break;
+            }
             default:
                 fatal("Unhandled flag kind\n");
                 break;
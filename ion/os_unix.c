@@ -1,4 +1,6 @@
 #include <dirent.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
 
 void path_absolute(char path[MAX_PATH]) {
     char rel_path[MAX_PATH];
@@ -42,3 +44,16 @@ void dir_list(DirListIter *iter, const char *path) {
     iter->valid = true;
     dir_list_next(iter);
 }
+
+void *jit_alloc(size_t size) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+bool jit_protect_exec(void *ptr, size_t size) {
+    return mprotect(ptr, size, PROT_READ | PROT_EXEC) == 0;
+}
+
+void *jit_lookup_sym(const char *name) {
+    return dlsym(RTLD_DEFAULT, name);
+}
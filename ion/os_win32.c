@@ -55,3 +55,16 @@ void dir_list(DirListIter *iter, const char *path) {
         dir_list_next(iter);
     }
 }
+
+// The JIT only targets the SysV x64 ABI for now.
+void *jit_alloc(size_t size) {
+    return NULL;
+}
+
+bool jit_protect_exec(void *ptr, size_t size) {
+    return false;
+}
+
+void *jit_lookup_sym(const char *name) {
+    return NULL;
+}
@@ -669,17 +669,20 @@ Decl *parse_decl_enum(SrcPos pos) {
 Aggregate *parse_aggregate(AggregateKind kind);
 
 AggregateItem parse_decl_aggregate_item(void) {
+    Notes notes = parse_notes();
     SrcPos pos = token.pos;
     if (match_keyword(struct_keyword)) {
         return (AggregateItem){
             .pos = pos,
             .kind = AGGREGATE_ITEM_SUBAGGREGATE,
+            .notes = notes,
             .subaggregate = parse_aggregate(AGGREGATE_STRUCT),
         };
     } else if (match_keyword(union_keyword)) {
         return (AggregateItem){
             .pos = pos,
             .kind = AGGREGATE_ITEM_SUBAGGREGATE,
+            .notes = notes,
             .subaggregate = parse_aggregate(AGGREGATE_UNION),
         };
     } else {
@@ -694,6 +697,7 @@ AggregateItem parse_decl_aggregate_item(void) {
         return (AggregateItem){
             .pos = pos,
             .kind = AGGREGATE_ITEM_FIELD,
+            .notes = notes,
             .names = names,
             .num_names = buf_len(names),
             .type = type,
@@ -766,11 +770,12 @@ Decl *parse_decl_typedef(SrcPos pos) {
 }
 
 FuncParam parse_decl_func_param(void) {
+    Notes notes = parse_notes();
     SrcPos pos = token.pos;
     const char *name = parse_name();
     expect_token(TOKEN_COLON);
     Typespec *type = parse_type();
-    return (FuncParam){pos, name, type};
+    return (FuncParam){pos, name, type, notes};
 }
 
 Decl *parse_decl_func(SrcPos pos) {
@@ -937,10 +942,45 @@ Decl *parse_decl(void) {
     return decl;
 }
 
+bool is_decl_start(void) {
+    if (!is_token_at_line_start()) {
+        return false;
+    }
+    if (is_token(TOKEN_AT) || is_token(TOKEN_POUND)) {
+        return true;
+    }
+    return is_keyword(typedef_keyword) || is_keyword(enum_keyword) || is_keyword(struct_keyword) || is_keyword(union_keyword) ||
+           is_keyword(var_keyword) || is_keyword(const_keyword) || is_keyword(func_keyword) || is_keyword(import_keyword);
+}
+
+// After a syntax error, skips to the next token that looks like the start of a top-level declaration.
+Decl *parse_decl_recover(void) {
+    const char *start = token.start;
+    jmp_buf recovery;
+    jmp_buf *old_recovery = error_recovery;
+    if (setjmp(recovery)) {
+        error_recovery = old_recovery;
+        if (token.start == start) {
+            next_token();
+        }
+        while (!is_token(TOKEN_EOF) && !is_decl_start()) {
+            next_token();
+        }
+        return NULL;
+    }
+    error_recovery = &recovery;
+    Decl *decl = parse_decl();
+    error_recovery = old_recovery;
+    return decl;
+}
+
 Decls *parse_decls(void) {
     Decl **decls = NULL;
     while (!is_token(TOKEN_EOF)) {
-        buf_push(decls, parse_decl());
+        Decl *decl = parse_decl_recover();
+        if (decl) {
+            buf_push(decls, decl);
+        }
     }
     return new_decls(decls, buf_len(decls));
 }
@@ -11,16 +11,77 @@ typedef enum SymState {
     SYM_UNRESOLVED,
     SYM_RESOLVING,
     SYM_RESOLVED,
+    SYM_FAILED,
 } SymState;
 
 struct Package;
 
+typedef enum IntrinsicKind {
+    INTRINSIC_NONE,
+    INTRINSIC_VA_START,
+    INTRINSIC_VA_END,
+    INTRINSIC_VA_COPY,
+    INTRINSIC_VA_ARG,
+    INTRINSIC_APUSH,
+    INTRINSIC_APUTV,
+    INTRINSIC_ADELV,
+    INTRINSIC_AGETVI,
+    INTRINSIC_AGETVP,
+    INTRINSIC_AGETV,
+    INTRINSIC_ASETCAP,
+    INTRINSIC_AFIT,
+    INTRINSIC_ACAT,
+    INTRINSIC_ADELI,
+    INTRINSIC_AINDEXV,
+    INTRINSIC_ASETLEN,
+    INTRINSIC_ADEFAULT,
+    INTRINSIC_AFILL,
+    INTRINSIC_ACATN,
+    INTRINSIC_ADELN,
+    INTRINSIC_AINDEX,
+    INTRINSIC_AGETI,
+    INTRINSIC_ADEL,
+    INTRINSIC_AGETP,
+    INTRINSIC_AGET,
+    INTRINSIC_APUT,
+    INTRINSIC_AHDRSIZE,
+    INTRINSIC_AHDRALIGN,
+    INTRINSIC_AHDR,
+    INTRINSIC_ALEN,
+    INTRINSIC_ACAP,
+    INTRINSIC_AFREE,
+    INTRINSIC_ACLEAR,
+    INTRINSIC_APOP,
+    INTRINSIC_ANEW,
+    INTRINSIC_QNEW,
+    INTRINSIC_QFREE,
+    INTRINSIC_QPUSH,
+    INTRINSIC_QPOP,
+    INTRINSIC_ATOMIC_LOAD,
+    INTRINSIC_ATOMIC_STORE,
+    INTRINSIC_ATOMIC_EXCHANGE,
+    INTRINSIC_ATOMIC_CAS,
+    INTRINSIC_ATOMIC_FETCH_ADD,
+    INTRINSIC_ATOMIC_FETCH_SUB,
+    INTRINSIC_ATOMIC_FETCH_AND,
+    INTRINSIC_ATOMIC_FETCH_OR,
+    INTRINSIC_ATOMIC_FETCH_XOR,
+    INTRINSIC_ATOMIC_THREAD_FENCE,
+    INTRINSIC_ATOMIC_SIGNAL_FENCE,
+    INTRINSIC_VLOAD,
+    INTRINSIC_VSTORE,
+    INTRINSIC_VSHUFFLE,
+    INTRINSIC_VCONVERT,
+    NUM_INTRINSICS,
+} IntrinsicKind;
+
 typedef struct Sym {
     const char *name;
     struct Package *home_package;
     SymKind kind;
     SymState state;
     uint8_t reachable;
+    IntrinsicKind intrinsic;
     Decl *decl;
     const char *external_name;
     union {
@@ -41,6 +102,9 @@ typedef struct Package {
     Sym **syms;
     const char *external_name;
     bool always_reachable;
+    bool is_system;
+    int num_new_exprs;
+    int num_stack_new_exprs;
 } Package;
 
 enum {
@@ -217,6 +281,7 @@ void sym_global_put(const char *name, Sym *sym) {
 }
 
 void resolve_sym(Sym *sym);
+IntrinsicKind get_intrinsic_kind(Decl *decl);
 
 Sym *sym_global_type(const char *name, Type *type) {
     name = str_intern(name);
@@ -296,6 +361,9 @@ void put_type_name(char **buf, Type *type) {
             put_type_name(buf, type->base);
             buf_printf(*buf, "[%zu]", type->num_elems);
             break;
+        case TYPE_VECTOR:
+            buf_printf(*buf, "%s", vector_type_name(type));
+            break;
         case TYPE_FUNC:
             buf_printf(*buf, "func(");
             for (size_t i = 0; i < type->func.num_params; i++) {
@@ -485,6 +553,8 @@ bool is_castable(Operand *operand, Type *dest) {
         return is_ptr_like_type(dest);
     } else if (is_ptr_like_type(dest) && is_ptr_like_type(src)) {
         return true;
+    } else if (is_vector_type(dest) && is_vector_type(src)) {
+        return type_sizeof(dest) == type_sizeof(src);
     } else {
         return false;
     }
@@ -635,6 +705,22 @@ void set_resolved_val(void *ptr, Val val) {
     map_put_uint64(&resolved_val_map, ptr, u64);
 }
 
+Map resolved_const_map;
+
+bool is_resolved_const(Expr *expr) {
+    return map_get(&resolved_const_map, expr) != NULL;
+}
+
+// Constant values are stored widened to long long so backends can read them without knowing
+// which Val member the expression's type uses.
+void set_resolved_const(Expr *expr, Operand operand) {
+    if (is_floating_type(operand.type) || !cast_operand(&operand, type_llong) || !operand.is_const) {
+        return;
+    }
+    set_resolved_val(expr, operand.val);
+    map_put(&resolved_const_map, expr, (void *)1);
+}
+
 Map reachable_map;
 
 void set_reachable(void *ptr) {
@@ -645,6 +731,14 @@ uint8_t get_reachable(void *ptr) {
     return (uint8_t)(intptr_t)map_get(&reachable_map, ptr);
 }
 
+// Only the vector types a program uses get typedefs in the generated code.
+void reach_vector_type(Type *type) {
+    type = unqualify_type(type);
+    if (is_vector_type(type) && !get_reachable(type)) {
+        set_reachable(type);
+    }
+}
+
 Map resolved_type_map;
 
 Type *get_resolved_type(void *ptr) {
@@ -725,12 +819,23 @@ Operand resolve_expr(Expr *expr) {
     return resolve_expected_expr(expr, NULL);
 }
 
+// Arrays of @soa structs have no element pointer to decay to.
+void check_soa_decay(SrcPos pos, Type *type) {
+    if (is_soa_array_type(unqualify_type(type))) {
+        fatal_error(pos, "Cannot use @soa array %s as a pointer", get_type_name(type));
+    }
+}
+
 Operand resolve_expr_rvalue(Expr *expr) {
-    return operand_decay(resolve_expr(expr));
+    Operand operand = resolve_expr(expr);
+    check_soa_decay(expr->pos, operand.type);
+    return operand_decay(operand);
 }
 
 Operand resolve_expected_expr_rvalue(Expr *expr, Type *expected_type) {
-    return operand_decay(resolve_expected_expr(expr, expected_type));
+    Operand operand = resolve_expected_expr(expr, expected_type);
+    check_soa_decay(expr->pos, operand.type);
+    return operand_decay(operand);
 }
 
 Type *resolve_typespec_strict(Typespec *typespec, bool with_const) {
@@ -765,6 +870,7 @@ Type *resolve_typespec_strict(Typespec *typespec, bool with_const) {
         resolve_sym(sym);
         set_resolved_sym(typespec, sym);
         result = sym->type;
+        reach_vector_type(result);
         break;
     }
     case TYPESPEC_CONST:
@@ -791,6 +897,9 @@ Type *resolve_typespec_strict(Typespec *typespec, bool with_const) {
             }
         }
         result = type_array(base, size, typespec->num_elems == NULL);
+        if (is_soa_array_type(result) && !get_reachable(result)) {
+            set_reachable(result);
+        }
         break;
     }
     case TYPESPEC_FUNC: {
@@ -841,11 +950,242 @@ Type *resolve_typespec(Typespec *typespec) {
     return resolve_typespec_strict(typespec, false);
 }
 
-Type *complete_aggregate_strict(Type *type, Aggregate *aggregate, bool with_const) {
-    TypeField *fields = NULL;
-    for (size_t i = 0; i < aggregate->num_items; i++) {
-        AggregateItem item = aggregate->items[i];
+// Aggregates are completed from an explicit stack instead of by recursion, so deeply
+// nested struct graphs can't exhaust the native stack. A frame suspends while a field's
+// type is being completed; anonymous subaggregates get a frame with a NULL type.
+typedef struct CompletionFrame {
+    Type *type;
+    Aggregate *aggregate;
+    bool with_const;
+    size_t next_item;
+    TypeField *fields;
+    Package *old_package;
+} CompletionFrame;
+
+CompletionFrame *completion_frames;
+
+void buf_print_sym_pos(char **buf, Sym *sym) {
+    buf_printf(*buf, "%s", sym->name);
+    if (sym->decl) {
+        SrcLoc loc = get_src_loc(sym->decl->pos);
+        buf_printf(*buf, " (%s:%d)", loc.name, loc.line);
+    }
+}
+
+NORETURN void fatal_type_completion_cycle(Type *type) {
+    size_t start = 0;
+    for (size_t i = buf_len(completion_frames); i > 0; i--) {
+        if (completion_frames[i - 1].type == type) {
+            start = i - 1;
+            break;
+        }
+    }
+    char *path = NULL;
+    for (size_t i = start; i < buf_len(completion_frames); i++) {
+        Type *frame_type = completion_frames[i].type;
+        if (frame_type && frame_type->sym) {
+            buf_print_sym_pos(&path, frame_type->sym);
+            buf_printf(path, " -> ");
+        }
+    }
+    buf_printf(path, "%s", type->sym->name);
+    fatal_error(type->sym->decl->pos, "Type completion cycle: %s", path);
+}
+
+void begin_type_completion(Type *type) {
+    Sym *sym = type->sym;
+    if (sym->state == SYM_FAILED) {
+        recover_from_error();
+    }
+    Package *old_package = enter_package(sym->home_package);
+    Decl *decl = sym->decl;
+    if (decl->is_incomplete) {
+        fatal_error(decl->pos, "Trying to use incomplete type as complete type");
+    }
+    type->kind = TYPE_COMPLETING;
+    assert(decl->kind == DECL_STRUCT || decl->kind == DECL_UNION);
+    buf_push(completion_frames, (CompletionFrame){
+        .type = type,
+        .aggregate = decl->aggregate,
+        .with_const = is_decl_foreign(decl),
+        .old_package = old_package,
+    });
+}
+
+// Returns the type whose layout a field needs before the field itself can be resolved,
+// looking through sized arrays and const since those embed their base by value.
+Type *field_dependency(Typespec *typespec, bool with_const) {
+    while (typespec->kind == TYPESPEC_ARRAY || typespec->kind == TYPESPEC_CONST) {
+        if (typespec->kind == TYPESPEC_ARRAY && !typespec->num_elems) {
+            return NULL;
+        }
+        typespec = typespec->base;
+    }
+    if (typespec->kind != TYPESPEC_NAME) {
+        return NULL;
+    }
+    return resolve_typespec_strict(typespec, with_const);
+}
+
+void check_soa_fields(SrcPos pos, TypeField *fields, size_t num_fields) {
+    for (size_t i = 0; i < num_fields; i++) {
+        if (!fields[i].name) {
+            fatal_error(pos, "@soa struct cannot have nested aggregates");
+        }
+        if (is_soa_struct_type(fields[i].type)) {
+            fatal_error(pos, "@soa struct field %s cannot have @soa struct type", fields[i].name);
+        }
+    }
+}
+
+void finish_type_completion(void) {
+    size_t index = buf_len(completion_frames) - 1;
+    CompletionFrame frame = completion_frames[index];
+    buf__hdr(completion_frames)->len--;
+    Type *type = frame.type;
+    if (!type) {
+        type = type_incomplete(NULL);
+        type->kind = TYPE_COMPLETING;
+    }
+    if (frame.aggregate->kind == AGGREGATE_STRUCT) {
+        if (frame.type && get_decl_note(type->sym->decl, soa_name)) {
+            check_soa_fields(frame.aggregate->pos, frame.fields, buf_len(frame.fields));
+            type->aggregate.soa = true;
+        }
+        type_complete_struct(type, frame.fields, buf_len(frame.fields));
+    } else {
+        assert(frame.aggregate->kind == AGGREGATE_UNION);
+        type_complete_union(type, frame.fields, buf_len(frame.fields));
+    }
+    buf_free(frame.fields);
+    if (type->aggregate.num_fields == 0) {
+        fatal_error(frame.aggregate->pos, "No fields");
+    }
+    if (has_duplicate_fields(type)) {
+        fatal_error(frame.aggregate->pos, "Duplicate fields");
+    }
+    if (frame.type) {
+        buf_push(sorted_syms, type->sym);
+        leave_package(frame.old_package);
+    } else {
+        assert(index > 0);
+        buf_push(completion_frames[index - 1].fields, (TypeField){NULL, type});
+    }
+}
+
+typedef enum NoteSite {
+    NOTE_SITE_FUNC = 1 << 0,
+    NOTE_SITE_PARAM = 1 << 1,
+    NOTE_SITE_FIELD = 1 << 2,
+    NOTE_SITE_VAR = 1 << 3,
+    NOTE_SITE_IF = 1 << 4,
+    NOTE_SITE_STRUCT = 1 << 5,
+} NoteSite;
+
+typedef struct HintNoteDef {
+    const char **name;
+    unsigned sites;
+    const char *sites_desc;
+    size_t num_args;
+} HintNoteDef;
+
+// Layout and optimization hint notes. Other notes aren't checked here.
+HintNoteDef hint_note_defs[] = {
+    {&restrict_name, NOTE_SITE_PARAM, "pointer parameters", 0},
+    {&likely_name, NOTE_SITE_IF, "if statements", 0},
+    {&unlikely_name, NOTE_SITE_IF, "if statements", 0},
+    {&hot_name, NOTE_SITE_FUNC, "functions", 0},
+    {&cold_name, NOTE_SITE_FUNC, "functions", 0},
+    {&noinline_name, NOTE_SITE_FUNC, "functions", 0},
+    {&flatten_name, NOTE_SITE_FUNC, "functions", 0},
+    {&pure_name, NOTE_SITE_FUNC, "functions", 0},
+    {&align_name, NOTE_SITE_FIELD | NOTE_SITE_VAR, "struct fields and variables", 1},
+    {&soa_name, NOTE_SITE_STRUCT, "structs", 0},
+};
+
+NoteSite decl_note_site(Decl *decl) {
+    switch (decl->kind) {
+    case DECL_FUNC:
+        return NOTE_SITE_FUNC;
+    case DECL_VAR:
+        return NOTE_SITE_VAR;
+    case DECL_STRUCT:
+        return NOTE_SITE_STRUCT;
+    default:
+        return 0;
+    }
+}
+
+void check_conflicting_notes(Notes notes, const char *name1, const char *name2) {
+    Note *note1 = get_note(notes, name1);
+    Note *note2 = get_note(notes, name2);
+    if (note1 && note2) {
+        error(note2->pos, "@%s cannot be combined with @%s", name2, name1);
+    }
+}
+
+void check_hint_notes(Notes notes, NoteSite site) {
+    for (size_t i = 0; i < notes.num_notes; i++) {
+        Note *note = &notes.notes[i];
+        for (HintNoteDef *def = hint_note_defs; def != hint_note_defs + sizeof(hint_note_defs)/sizeof(*hint_note_defs); def++) {
+            if (note->name == *def->name) {
+                if (!(def->sites & site)) {
+                    error(note->pos, "@%s can only be used on %s", note->name, def->sites_desc);
+                }
+                if (note->num_args != def->num_args) {
+                    error(note->pos, "@%s takes %zu argument%s", note->name, def->num_args, def->num_args == 1 ? "" : "s");
+                }
+            }
+        }
+    }
+    check_conflicting_notes(notes, inline_name, noinline_name);
+    check_conflicting_notes(notes, hot_name, cold_name);
+    check_conflicting_notes(notes, likely_name, unlikely_name);
+}
+
+// Returns the alignment requested by an @align note, or 0 if there is none. It can only
+// increase the alignment of the type.
+size_t resolve_align_note(Notes notes, Type *type) {
+    Note *note = get_note(notes, align_name);
+    if (!note || note->num_args != 1) {
+        return 0;
+    }
+    Operand operand = resolve_const_expr(note->args[0].expr);
+    if (!is_integer_type(operand.type)) {
+        fatal_error(note->pos, "@align argument must have integer type");
+    }
+    cast_operand(&operand, type_llong);
+    long long align = operand.val.ll;
+    if (align <= 0 || !IS_POW2(align)) {
+        fatal_error(note->pos, "@align argument must be a power of two");
+    }
+    complete_type(type);
+    if ((size_t)align < type_alignof(type)) {
+        fatal_error(note->pos, "@align(%lld) is less than the alignment %zu of %s", align, type_alignof(type), get_type_name(type));
+    }
+    return (size_t)align;
+}
+
+size_t get_align_note(Notes notes) {
+    Note *note = get_note(notes, align_name);
+    return note && note->num_args == 1 ? (size_t)get_resolved_val(note->args[0].expr).ll : 0;
+}
+
+void step_type_completion(void) {
+    size_t index = buf_len(completion_frames) - 1;
+    Aggregate *aggregate = completion_frames[index].aggregate;
+    bool with_const = completion_frames[index].with_const;
+    while (completion_frames[index].next_item < aggregate->num_items) {
+        AggregateItem item = aggregate->items[completion_frames[index].next_item];
         if (item.kind == AGGREGATE_ITEM_FIELD) {
+            Type *dependency = field_dependency(item.type, with_const);
+            if (dependency && dependency->kind == TYPE_COMPLETING) {
+                fatal_type_completion_cycle(dependency);
+            }
+            if (dependency && dependency->kind == TYPE_INCOMPLETE) {
+                begin_type_completion(dependency);
+                return;
+            }
             Type *item_type = resolve_typespec_strict(item.type, with_const);
             item_type = incomplete_decay(item_type);
             complete_type(item_type);
@@ -854,56 +1194,37 @@ Type *complete_aggregate_strict(Type *type, Aggregate *aggregate, bool with_cons
                     fatal_error(item.pos, "Field type of size 0 is not allowed");
                 }
             }
+            check_hint_notes(item.notes, NOTE_SITE_FIELD);
+            size_t align = resolve_align_note(item.notes, item_type);
+            CompletionFrame *frame = &completion_frames[index];
             for (size_t j = 0; j < item.num_names; j++) {
-                buf_push(fields, (TypeField){item.names[j], item_type});
+                buf_push(frame->fields, (TypeField){item.names[j], item_type, .align = align});
             }
+            frame->next_item++;
         } else {
             assert(item.kind == AGGREGATE_ITEM_SUBAGGREGATE);
-            Type *item_type = complete_aggregate_strict(NULL, item.subaggregate, with_const);
-            buf_push(fields, (TypeField){NULL, item_type});
+            check_hint_notes(item.notes, 0);
+            completion_frames[index].next_item++;
+            buf_push(completion_frames, (CompletionFrame){.aggregate = item.subaggregate, .with_const = with_const});
+            return;
         }
     }
-    if (!type) {
-        type = type_incomplete(NULL);
-        type->kind = TYPE_COMPLETING;
-    }
-    if (aggregate->kind == AGGREGATE_STRUCT) {
-        type_complete_struct(type, fields, buf_len(fields));
-    } else {
-        assert(aggregate->kind == AGGREGATE_UNION);
-        type_complete_union(type, fields, buf_len(fields));
-    }
-    if (type->aggregate.num_fields == 0) {
-        fatal_error(aggregate->pos, "No fields");
-    }
-    if (has_duplicate_fields(type)) {
-        fatal_error(aggregate->pos, "Duplicate fields");
-    }
-    return type;
-}
-
-Type *complete_aggregate(Type *type, Aggregate *aggregate) {
-    return complete_aggregate_strict(type, aggregate, type->sym && is_decl_foreign(type->sym->decl));
+    finish_type_completion();
 }
 
 void complete_type(Type *type) {
     if (type->kind == TYPE_COMPLETING) {
-        fatal_error(type->sym->decl->pos, "Type completion cycle");
+        fatal_type_completion_cycle(type);
         return;
     } else if (type->kind != TYPE_INCOMPLETE) {
         return;
     }
-    Sym *sym = type->sym;
-    Package *old_package = enter_package(sym->home_package);
-    Decl *decl = sym->decl;
-    if (decl->is_incomplete) {
-        fatal_error(decl->pos, "Trying to use incomplete type as complete type");
+    // Nested calls (e.g. sizeof in an array size) only drain the frames they pushed.
+    size_t base = buf_len(completion_frames);
+    begin_type_completion(type);
+    while (buf_len(completion_frames) > base) {
+        step_type_completion();
     }
-    type->kind = TYPE_COMPLETING;
-    assert(decl->kind == DECL_STRUCT || decl->kind == DECL_UNION);
-    complete_aggregate(type, decl->aggregate);
-    buf_push(sorted_syms, type->sym);
-    leave_package(old_package);
 }
 
 Type *resolve_typed_init(SrcPos pos, Type *type, Expr *expr) {
@@ -923,6 +1244,7 @@ Type *resolve_typed_init(SrcPos pos, Type *type, Expr *expr) {
         }
     }
     if (type && is_ptr_type(type)) {
+        check_soa_decay(expr->pos, operand.type);
         operand = operand_decay(operand);
     }
     if (!convert_operand(&operand, expected_type)) {
@@ -959,6 +1281,7 @@ Type *resolve_init(SrcPos pos, Typespec *typespec, Expr *expr, bool was_const, b
         assert(expr);
         inferred_type = type = unqualify_type(resolve_expr(expr).type);
         if (is_array_type(type) && expr->kind != EXPR_COMPOUND) {
+            check_soa_decay(expr->pos, type);
             type = type_decay(type);
             set_resolved_type(expr, type);
         }
@@ -991,9 +1314,19 @@ Type *resolve_decl_enum(Sym *sym, Decl *decl) {
     return type;
 }
 
+bool is_eval_call(Expr *expr);
+Operand eval_const_call(Expr *expr, Type *type);
+void eval_global_init(Expr *expr, Type *type);
+
 Type *resolve_decl_var(Decl *decl) {
     assert(decl->kind == DECL_VAR);
-    return resolve_init(decl->pos, decl->var.type, decl->var.expr, is_decl_foreign(decl), false);
+    Type *type = resolve_init(decl->pos, decl->var.type, decl->var.expr, is_decl_foreign(decl), false);
+    resolve_align_note(decl->notes, type);
+    Expr *expr = decl->var.expr;
+    if (expr && !is_decl_foreign(decl) && !is_resolved_const(expr) && is_eval_call(expr)) {
+        eval_global_init(expr, type);
+    }
+    return type;
 }
 
 Type *resolve_decl_const(Decl *decl, Val *val) {
@@ -1038,12 +1371,17 @@ Type *resolve_decl_func(Decl *decl) {
     bool with_const = foreign;
     Type **params = NULL;
     for (size_t i = 0; i < decl->func.num_params; i++) {
-        Type *param = resolve_typespec_strict(decl->func.params[i].type, with_const);
+        FuncParam func_param = decl->func.params[i];
+        Type *param = resolve_typespec_strict(func_param.type, with_const);
         param = incomplete_decay(param);
         complete_type(param);
         if (param == type_void && !foreign) {
             fatal_error(decl->pos, "Function parameter type cannot be void");
         }
+        check_hint_notes(func_param.notes, NOTE_SITE_PARAM);
+        if (get_note(func_param.notes, restrict_name) && !is_ptr_type(param)) {
+            fatal_error(func_param.pos, "@restrict parameter %s must have pointer type", func_param.name);
+        }
         if (i == index_of_printf_format_param) {
           bool is_format_type = param->kind == TYPE_PTR && (param->base->kind == TYPE_CHAR || (param->base->kind == TYPE_CONST && param->base->base->kind == TYPE_CHAR));
           if (!is_format_type) {
@@ -1060,6 +1398,9 @@ Type *resolve_decl_func(Decl *decl) {
     if (is_array_type(ret_type)) {
         fatal_error(decl->pos, "Function return type cannot be array");
     }
+    if (ret_type == type_void && get_decl_note(decl, pure_name)) {
+        fatal_error(decl->pos, "@pure function must return a value");
+    }
     Type *varargs_type = type_void;
     if (decl->func.varargs_type) {
         varargs_type = incomplete_decay(resolve_typespec_strict(decl->func.varargs_type, with_const));
@@ -1133,6 +1474,9 @@ void resolve_labels(void) {
 bool resolve_stmt(Stmt *stmt, Type *ret_type, StmtCtx ctx);
 
 bool is_cond_operand(Operand operand) {
+    if (is_soa_array_type(unqualify_type(operand.type))) {
+        return false;
+    }
     operand = operand_decay(operand);
     return is_scalar_type(operand.type);
 }
@@ -1183,7 +1527,7 @@ void resolve_stmt_assign(Stmt *stmt) {
                 set_pointer_promo_type(left_expr, type_ptr(qualify_type(type_char, left.type->base)));
             }
             result = operand_rvalue(left.type);
-        } else if (is_arithmetic_type(left.type) && is_arithmetic_type(right.type)) {
+        } else if ((is_arithmetic_type(left.type) && is_arithmetic_type(right.type)) || is_vector_type(unqualify_type(left.type))) {
             result = resolve_expr_binary_op(binary_op, assign_op_name, stmt->pos, left, right, left_expr, right_expr);
         } else {
             fatal_error(stmt->pos, "Invalid operand types for %s", assign_op_name);
@@ -1199,6 +1543,8 @@ void resolve_stmt_assign(Stmt *stmt) {
 void resolve_stmt_init(Stmt *stmt) {
     assert(stmt->kind == STMT_INIT);
     Type *type = resolve_init(stmt->pos, stmt->init.type, stmt->init.expr, false, stmt->init.is_undef);
+    resolve_align_note(stmt->notes, type);
+    set_resolved_type(stmt, type);
     if (!sym_push_var(stmt->init.name, type)) {
         fatal_error(stmt->pos, "Shadowed definition of local symbol");
     }
@@ -1214,7 +1560,59 @@ void resolve_static_assert(Note note) {
     }
 }
 
+typedef struct CaseRange {
+    long long start;
+    long long end;
+    SrcPos pos;
+    size_t order;
+} CaseRange;
+
+int case_range_cmp_signed(const void *a, const void *b) {
+    const CaseRange *x = a;
+    const CaseRange *y = b;
+    if (x->start != y->start) {
+        return x->start < y->start ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : 1;
+}
+
+int case_range_cmp_unsigned(const void *a, const void *b) {
+    const CaseRange *x = a;
+    const CaseRange *y = b;
+    if (x->start != y->start) {
+        return (unsigned long long)x->start < (unsigned long long)y->start ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : 1;
+}
+
+bool case_val_less(long long x, long long y, bool is_signed) {
+    return is_signed ? x < y : (unsigned long long)x < (unsigned long long)y;
+}
+
+const char *case_range_str(CaseRange range, bool is_signed) {
+    const char *fmt = is_signed ? "%lld" : "%llu";
+    const char *start = strf(fmt, range.start);
+    return range.start == range.end ? start : strf("%s ... %s", start, strf(fmt, range.end));
+}
+
+// Overlapping cases would make the C compiler reject duplicate labels, or silently pick one case in
+// the if-chain and binary search dispatch of wide ranges, so they're errors. After sorting by start,
+// a case overlaps an earlier one exactly when it starts at or before the furthest end seen so far.
+void check_case_overlaps(CaseRange *ranges, size_t num_ranges, bool is_signed) {
+    qsort(ranges, num_ranges, sizeof(*ranges), is_signed ? case_range_cmp_signed : case_range_cmp_unsigned);
+    for (size_t i = 1, furthest = 0; i < num_ranges; i++) {
+        if (!case_val_less(ranges[furthest].end, ranges[i].start, is_signed)) {
+            CaseRange later = ranges[i].order > ranges[furthest].order ? ranges[i] : ranges[furthest];
+            error(later.pos, "Switch case %s overlaps an earlier case", case_range_str(later, is_signed));
+        }
+        if (case_val_less(ranges[furthest].end, ranges[i].end, is_signed)) {
+            furthest = i;
+        }
+    }
+}
+
 bool resolve_stmt(Stmt *stmt, Type *ret_type, StmtCtx ctx) {
+    check_hint_notes(stmt->notes, stmt->kind == STMT_IF ? NOTE_SITE_IF : stmt->kind == STMT_INIT ? NOTE_SITE_VAR : 0);
     switch (stmt->kind) {
     case STMT_RETURN:
         if (stmt->expr) {
@@ -1308,6 +1706,9 @@ bool resolve_stmt(Stmt *stmt, Type *ret_type, StmtCtx ctx) {
         ctx.is_break_legal = true;
         bool returns = true;
         bool has_default = false;
+        Type *case_type = unqualify_type(operand.type);
+        bool is_signed = is_signed_type(case_type->kind == TYPE_ENUM ? case_type->base : case_type);
+        CaseRange *case_ranges = NULL;
         for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
             SwitchCase switch_case = stmt->switch_stmt.cases[i];
             for (size_t j = 0; j < switch_case.num_patterns; j++) {
@@ -1318,22 +1719,23 @@ bool resolve_stmt(Stmt *stmt, Type *ret_type, StmtCtx ctx) {
                     fatal_error(start_expr->pos, "Invalid type in switch case expression. Expected %s, got %s", get_type_name(operand.type), get_type_name(start_operand.type));
                 }
                 Expr *end_expr = pattern.end;
+                Operand end_operand = start_operand;
                 if (end_expr) {
-                    Operand end_operand = resolve_const_expr(end_expr);
+                    end_operand = resolve_const_expr(end_expr);
                     if (!convert_operand(&end_operand, operand.type)) {
                         fatal_error(end_expr->pos, "Invalid type in switch case expression. Expected %s, got %s", get_type_name(operand.type), get_type_name(end_operand.type));
                     }
-                    convert_operand(&start_operand, type_llong);
+                }
+                convert_operand(&start_operand, type_llong);
+                convert_operand(&end_operand, type_llong);
+                if (end_expr) {
                     set_resolved_val(start_expr, start_operand.val);
-                    convert_operand(&end_operand, type_llong);
                     set_resolved_val(end_expr, end_operand.val);
-                    if (end_operand.val.ll < start_operand.val.ll) {
+                    if (case_val_less(end_operand.val.ll, start_operand.val.ll, is_signed)) {
                         fatal_error(start_expr->pos, "Case range end value cannot be less thn start value");
                     }
-                    if (end_operand.val.ll - start_operand.val.ll >= 256) {
-                        fatal_error(start_expr->pos, "Case range cannot span more than 256 values");
-                    }
                 }
+                buf_push(case_ranges, (CaseRange){start_operand.val.ll, end_operand.val.ll, start_expr->pos, buf_len(case_ranges)});
             }
             if (switch_case.is_default) {
                 if (has_default) {
@@ -1349,6 +1751,8 @@ bool resolve_stmt(Stmt *stmt, Type *ret_type, StmtCtx ctx) {
             }
             returns = resolve_stmt_block(switch_case.block, ret_type, ctx) && returns;
         }
+        check_case_overlaps(case_ranges, buf_len(case_ranges), is_signed);
+        buf_free(case_ranges);
         return returns && has_default;
     }
     case STMT_ASSIGN:
@@ -1372,85 +1776,786 @@ bool resolve_stmt(Stmt *stmt, Type *ret_type, StmtCtx ctx) {
     }
 }
 
-void resolve_func_body(Sym *sym) {
-    Decl *decl = sym->decl;
-    assert(decl->kind == DECL_FUNC);
-    assert(sym->state == SYM_RESOLVED);
-    if (decl->is_incomplete) {
-        return;
+typedef enum FuncBodyState {
+    FUNC_BODY_UNRESOLVED,
+    FUNC_BODY_RESOLVING,
+    FUNC_BODY_RESOLVED,
+} FuncBodyState;
+
+// Escape analysis for new. A local initialized with a plain new (no allocator) whose pointer is
+// only ever dereferenced, compared or freed can't outlive its scope, so the C backend gives the
+// object stack storage next to the local instead, and drops the matching free calls. Anything
+// else done with the pointer (passing it, storing it, returning it, reassigning it, or taking
+// the address of the object or one of its parts) counts as an escape.
+enum {
+    MAX_STACK_NEW_SIZE = 4096,
+};
+
+typedef struct NewLocal {
+    const char *name;
+    Expr *new_expr;
+    Expr **frees;
+    bool escapes;
+} NewLocal;
+
+NewLocal *new_locals;
+Map stack_new_map;
+Map elided_free_map;
+
+bool is_stack_new(Expr *expr) {
+    return map_get(&stack_new_map, expr) != NULL;
+}
+
+bool is_elided_free(Expr *expr) {
+    return map_get(&elided_free_map, expr) != NULL;
+}
+
+NewLocal *get_new_local(Expr *expr) {
+    if (expr->kind != EXPR_NAME) {
+        return NULL;
     }
-    Package *old_package = enter_package(sym->home_package);
-    Sym *scope = sym_enter();
-    for (size_t i = 0; i < decl->func.num_params; i++) {
-        FuncParam param = decl->func.params[i];
-        Type *param_type = resolve_typespec(param.type);
-        param_type = incomplete_decay(param_type);
-        if (is_array_type(param_type)) {
-            param_type = type_ptr(param_type->base);
+    for (NewLocal *it = buf_end(new_locals); it != new_locals; it--) {
+        if (it[-1].name == expr->name) {
+            return &it[-1];
         }
-        sym_push_var(param.name, param_type);
     }
-    Type *ret_type = incomplete_decay(resolve_typespec(decl->func.ret_type));
-    assert(!is_array_type(ret_type));
-    bool returns = resolve_stmt_block(decl->func.block, ret_type, (StmtCtx){0});
-    resolve_labels();
-    sym_leave(scope);
-    if (ret_type != type_void && !returns) {
-        fatal_error(decl->pos, "Not all control paths return values");
+    return NULL;
+}
+
+void leave_new_locals(size_t scope) {
+    for (size_t i = scope; i < buf_len(new_locals); i++) {
+        NewLocal *local = &new_locals[i];
+        if (!local->escapes) {
+            map_put(&stack_new_map, local->new_expr, (void *)1);
+            for (size_t j = 0; j < buf_len(local->frees); j++) {
+                map_put(&elided_free_map, local->frees[j], (void *)1);
+            }
+            current_package->num_stack_new_exprs++;
+        }
+        buf_free(local->frees);
+    }
+    if (new_locals) {
+        buf__hdr(new_locals)->len = scope;
     }
-    leave_package(old_package);
 }
 
-void resolve_sym(Sym *sym) {
-    if (sym->state == SYM_RESOLVED) {
-        return;
-    } else if (sym->state == SYM_RESOLVING) {
-        fatal_error(sym->decl->pos, "Cyclic dependency");
-        return;
+bool is_stack_new_candidate(Stmt *stmt) {
+    Expr *expr = stmt->init.expr;
+    if (!expr || expr->kind != EXPR_NEW || expr->new_expr.alloc) {
+        return false;
     }
-    assert(sym->state == SYM_UNRESOLVED);
-    assert(!sym->reachable);
-    if (!is_local_sym(sym)) {
-        buf_push(reachable_syms, sym);
-        sym->reachable = reachable_phase;
+    Type *type = get_resolved_type(expr);
+    if (get_resolved_type(stmt) != type || is_implicit_any(expr)) {
+        return false;
     }
-    sym->state = SYM_RESOLVING;
-    Decl *decl = sym->decl;
-    Package *old_package = enter_package(sym->home_package);
-    switch (sym->kind) {
-    case SYM_TYPE:
-        if (decl && decl->kind == DECL_TYPEDEF) {
-            sym->type = resolve_typespec_strict(decl->typedef_decl.type, is_decl_foreign(decl));
-        } else if (decl->kind == DECL_ENUM) {
-            sym->type = resolve_decl_enum(sym, decl);
-        } else {
-            sym->type = type_incomplete(sym);
+    Type *base = type->base;
+    size_t size = type_sizeof(base);
+    if (expr->new_expr.len) {
+        if (expr->new_expr.arg || !is_resolved_const(expr->new_expr.len)) {
+            return false;
+        }
+        long long len = get_resolved_val(expr->new_expr.len).ll;
+        if (len <= 0 || (size_t)len > MAX_STACK_NEW_SIZE / CLAMP_MIN(size, 1)) {
+            return false;
         }
+        size *= (size_t)len;
+    } else if (is_array_type(unqualify_type(base))) {
+        return false;
+    }
+    return size <= MAX_STACK_NEW_SIZE;
+}
+
+void escape_expr(Expr *expr);
+void escape_addr(Expr *expr);
+
+// The pointer is dereferenced, which doesn't let it escape.
+void escape_deref(Expr *expr) {
+    if (!get_new_local(expr)) {
+        escape_expr(expr);
+    }
+}
+
+void escape_cond(Expr *expr) {
+    if (!get_new_local(expr)) {
+        escape_expr(expr);
+    }
+}
+
+// The expression names an object that is read or written in place.
+void escape_place(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        escape_place(expr->paren.expr);
         break;
-    case SYM_VAR:
-        sym->type = resolve_decl_var(decl);
+    case EXPR_FIELD:
+        if (get_resolved_sym(expr)) {
+            break;
+        }
+        if (is_ptr_type(unqualify_type(get_resolved_type(expr->field.expr)))) {
+            escape_deref(expr->field.expr);
+        } else {
+            escape_place(expr->field.expr);
+        }
         break;
-    case SYM_CONST:
-        sym->type = resolve_decl_const(decl, &sym->val);
+    case EXPR_INDEX:
+        if (is_ptr_type(unqualify_type(get_resolved_type(expr->index.expr)))) {
+            escape_deref(expr->index.expr);
+        } else {
+            escape_place(expr->index.expr);
+        }
+        escape_expr(expr->index.index);
         break;
-    case SYM_FUNC:
-        sym->type = resolve_decl_func(decl);
+    case EXPR_UNARY:
+        if (expr->unary.op == TOKEN_MUL) {
+            escape_deref(expr->unary.expr);
+        } else {
+            escape_expr(expr);
+        }
         break;
-    case SYM_PACKAGE:
-        // Do nothing
+    case EXPR_NAME: {
+        NewLocal *local = get_new_local(expr);
+        if (local) {
+            local->escapes = true;
+        }
         break;
+    }
     default:
-        assert(0);
+        escape_expr(expr);
         break;
     }
-    leave_package(old_package);
-    sym->state = SYM_RESOLVED;
+}
+
+// The address of the object or one of its parts is taken.
+void escape_addr(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        escape_addr(expr->paren.expr);
+        break;
+    case EXPR_FIELD:
+        if (get_resolved_sym(expr)) {
+            break;
+        }
+        if (is_ptr_type(unqualify_type(get_resolved_type(expr->field.expr)))) {
+            escape_expr(expr->field.expr);
+        } else {
+            escape_addr(expr->field.expr);
+        }
+        break;
+    case EXPR_INDEX:
+        if (is_ptr_type(unqualify_type(get_resolved_type(expr->index.expr)))) {
+            escape_expr(expr->index.expr);
+        } else {
+            escape_addr(expr->index.expr);
+        }
+        escape_expr(expr->index.index);
+        break;
+    case EXPR_UNARY:
+        if (expr->unary.op == TOKEN_MUL) {
+            escape_expr(expr->unary.expr);
+        } else {
+            escape_expr(expr);
+        }
+        break;
+    default:
+        escape_place(expr);
+        break;
+    }
+}
+
+bool is_builtin_free_call(Expr *expr) {
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    return sym && sym == get_package_sym(builtin_package, str_intern("free")) && expr->call.num_args == 1;
+}
+
+void escape_expr(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        escape_expr(expr->paren.expr);
+        break;
+    case EXPR_NAME: {
+        NewLocal *local = get_new_local(expr);
+        if (local) {
+            local->escapes = true;
+        }
+        break;
+    }
+    case EXPR_FIELD:
+    case EXPR_INDEX:
+        // Array values decay to a pointer into the object.
+        if (is_array_type(unqualify_type(get_resolved_type(expr)))) {
+            escape_addr(expr);
+        } else {
+            escape_place(expr);
+        }
+        break;
+    case EXPR_CAST:
+        escape_expr(expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        if (is_builtin_free_call(expr)) {
+            NewLocal *local = get_new_local(expr->call.args[0]);
+            if (local) {
+                buf_push(local->frees, expr);
+                break;
+            }
+        }
+        escape_expr(expr->call.expr);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            escape_expr(expr->call.args[i]);
+        }
+        break;
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            escape_expr(expr->compound.fields[i].init);
+        }
+        break;
+    case EXPR_UNARY:
+        if (expr->unary.op == TOKEN_AND) {
+            escape_addr(expr->unary.expr);
+        } else if (expr->unary.op == TOKEN_MUL) {
+            if (is_array_type(unqualify_type(get_resolved_type(expr)))) {
+                escape_expr(expr->unary.expr);
+            } else {
+                escape_deref(expr->unary.expr);
+            }
+        } else if (expr->unary.op == TOKEN_NOT) {
+            escape_cond(expr->unary.expr);
+        } else {
+            escape_expr(expr->unary.expr);
+        }
+        break;
+    case EXPR_BINARY:
+        switch (expr->binary.op) {
+        case TOKEN_EQ:
+        case TOKEN_NOTEQ:
+        case TOKEN_AND_AND:
+        case TOKEN_OR_OR:
+            escape_cond(expr->binary.left);
+            escape_cond(expr->binary.right);
+            break;
+        default:
+            escape_expr(expr->binary.left);
+            escape_expr(expr->binary.right);
+            break;
+        }
+        break;
+    case EXPR_TERNARY:
+        escape_cond(expr->ternary.cond);
+        escape_expr(expr->ternary.then_expr);
+        escape_expr(expr->ternary.else_expr);
+        break;
+    case EXPR_MODIFY:
+        escape_place(expr->modify.expr);
+        break;
+    case EXPR_NEW:
+        current_package->num_new_exprs++;
+        if (expr->new_expr.alloc) {
+            escape_expr(expr->new_expr.alloc);
+        }
+        if (expr->new_expr.len) {
+            escape_expr(expr->new_expr.len);
+        }
+        if (expr->new_expr.arg) {
+            if (expr->new_expr.len) {
+                escape_expr(expr->new_expr.arg);
+            } else {
+                escape_place(expr->new_expr.arg);
+            }
+        }
+        break;
+    default:
+        // Literals, and the operands of sizeof, typeof and alignof, which aren't evaluated.
+        break;
+    }
+}
+
+void escape_stmt(Stmt *stmt, bool allow_stack_new);
+
+void escape_stmt_block(StmtList block) {
+    size_t scope = buf_len(new_locals);
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        escape_stmt(block.stmts[i], true);
+    }
+    leave_new_locals(scope);
+}
+
+// For loop initializers can't declare the object and the pointer as separate C declarations.
+void escape_stmt(Stmt *stmt, bool allow_stack_new) {
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        if (stmt->expr) {
+            escape_expr(stmt->expr);
+        }
+        break;
+    case STMT_BLOCK:
+        escape_stmt_block(stmt->block);
+        break;
+    case STMT_NOTE:
+        if (stmt->note.name == assert_name && stmt->note.num_args == 1) {
+            escape_cond(stmt->note.args[0].expr);
+        }
+        break;
+    case STMT_IF: {
+        size_t scope = buf_len(new_locals);
+        if (stmt->if_stmt.init) {
+            escape_stmt(stmt->if_stmt.init, true);
+        }
+        if (stmt->if_stmt.cond) {
+            escape_cond(stmt->if_stmt.cond);
+        }
+        escape_stmt_block(stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            escape_cond(stmt->if_stmt.elseifs[i].cond);
+            escape_stmt_block(stmt->if_stmt.elseifs[i].block);
+        }
+        escape_stmt_block(stmt->if_stmt.else_block);
+        leave_new_locals(scope);
+        break;
+    }
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        escape_cond(stmt->while_stmt.cond);
+        escape_stmt_block(stmt->while_stmt.block);
+        break;
+    case STMT_FOR: {
+        size_t scope = buf_len(new_locals);
+        if (stmt->for_stmt.init) {
+            escape_stmt(stmt->for_stmt.init, false);
+        }
+        if (stmt->for_stmt.cond) {
+            escape_cond(stmt->for_stmt.cond);
+        }
+        if (stmt->for_stmt.next) {
+            escape_stmt(stmt->for_stmt.next, false);
+        }
+        escape_stmt_block(stmt->for_stmt.block);
+        leave_new_locals(scope);
+        break;
+    }
+    case STMT_SWITCH:
+        escape_expr(stmt->switch_stmt.expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            escape_stmt_block(stmt->switch_stmt.cases[i].block);
+        }
+        break;
+    case STMT_ASSIGN:
+        escape_place(stmt->assign.left);
+        escape_expr(stmt->assign.right);
+        break;
+    case STMT_INIT:
+        if (!stmt->init.expr) {
+            break;
+        }
+        escape_expr(stmt->init.expr);
+        if (allow_stack_new && is_stack_new_candidate(stmt)) {
+            buf_push(new_locals, (NewLocal){stmt->init.name, stmt->init.expr});
+        }
+        break;
+    case STMT_EXPR:
+        escape_expr(stmt->expr);
+        break;
+    default:
+        break;
+    }
+}
+
+void analyze_func_escapes(Decl *decl) {
+    assert(!new_locals || buf_len(new_locals) == 0);
+    escape_stmt_block(decl->func.block);
+}
+
+void print_escape_stats(void) {
+    for (size_t i = 0; i < buf_len(package_list); i++) {
+        Package *package = package_list[i];
+        if (package->num_new_exprs) {
+            printf("Moved %d of %d new allocations to the stack in %s\n", package->num_stack_new_exprs, package->num_new_exprs, package->path);
+        }
+    }
+}
+
+// Function bodies can be resolved early when compile-time evaluation calls them, so track which
+// ones are done to avoid resolving them twice.
+Map func_body_state_map;
+
+void resolve_func_body(Sym *sym) {
+    Decl *decl = sym->decl;
+    assert(decl->kind == DECL_FUNC);
+    assert(sym->state == SYM_RESOLVED);
+    if (decl->is_incomplete || map_get_uint64(&func_body_state_map, sym) != FUNC_BODY_UNRESOLVED) {
+        return;
+    }
+    map_put_uint64(&func_body_state_map, sym, FUNC_BODY_RESOLVING);
+    Package *old_package = enter_package(sym->home_package);
+    Sym *scope = sym_enter();
+    for (size_t i = 0; i < decl->func.num_params; i++) {
+        FuncParam param = decl->func.params[i];
+        Type *param_type = resolve_typespec(param.type);
+        param_type = incomplete_decay(param_type);
+        if (is_array_type(param_type)) {
+            param_type = type_ptr(param_type->base);
+        }
+        sym_push_var(param.name, param_type);
+    }
+    Type *ret_type = incomplete_decay(resolve_typespec(decl->func.ret_type));
+    assert(!is_array_type(ret_type));
+    bool returns = resolve_stmt_block(decl->func.block, ret_type, (StmtCtx){0});
+    resolve_labels();
+    sym_leave(scope);
+    if (ret_type != type_void && !returns) {
+        fatal_error(decl->pos, "Not all control paths return values");
+    }
+    analyze_func_escapes(decl);
+    leave_package(old_package);
+    map_put_uint64(&func_body_state_map, sym, FUNC_BODY_RESOLVED);
+}
+
+int resolving_const_expr;
+
+bool recover_sym(void (*func)(Sym *sym), Sym *sym);
+
+// Operands of sizeof, alignof and typeof are never evaluated, even inside constant expressions.
+Type *resolve_unevaluated_expr(Expr *expr) {
+    int old_resolving_const_expr = resolving_const_expr;
+    resolving_const_expr = 0;
+    Type *type = resolve_expr(expr).type;
+    resolving_const_expr = old_resolving_const_expr;
+    return type;
+}
+
+// Array variables decay when named in an expression, but sizeof and alignof see the array itself.
+Type *resolve_sizeof_operand(Expr *expr) {
+    Type *type = resolve_unevaluated_expr(expr);
+    if (expr->kind == EXPR_NAME) {
+        Sym *sym = resolve_name(expr->name);
+        if (sym && sym->kind == SYM_VAR && is_array_type(sym->type) && !is_incomplete_array_type(sym->type)) {
+            return sym->type;
+        }
+    }
+    return type;
+}
+
+// Resolves a function body from inside another function or declaration so it can be evaluated.
+// The caller's local scope and labels are set aside while the body is resolved.
+bool resolve_func_body_nested(Sym *sym) {
+    FuncBodyState state = (FuncBodyState)map_get_uint64(&func_body_state_map, sym);
+    if (state == FUNC_BODY_RESOLVED) {
+        return true;
+    }
+    if (state == FUNC_BODY_RESOLVING) {
+        return false;
+    }
+    size_t num_local_syms = local_syms_end - local_syms;
+    size_t num_labels = labels_end - labels;
+    Sym *old_local_syms = xmalloc(num_local_syms * sizeof(Sym) + 1);
+    Label *old_labels = xmalloc(num_labels * sizeof(Label) + 1);
+    memcpy(old_local_syms, local_syms, num_local_syms * sizeof(Sym));
+    memcpy(old_labels, labels, num_labels * sizeof(Label));
+    int old_resolving_const_expr = resolving_const_expr;
+    local_syms_end = local_syms;
+    labels_end = labels;
+    resolving_const_expr = 0;
+    bool ok = recover_sym(resolve_func_body, sym);
+    memcpy(local_syms, old_local_syms, num_local_syms * sizeof(Sym));
+    memcpy(labels, old_labels, num_labels * sizeof(Label));
+    local_syms_end = local_syms + num_local_syms;
+    labels_end = labels + num_labels;
+    resolving_const_expr = old_resolving_const_expr;
+    free(old_local_syms);
+    free(old_labels);
+    return ok && map_get_uint64(&func_body_state_map, sym) == FUNC_BODY_RESOLVED;
+}
+
+Sym **resolving_syms;
+
+NORETURN void fatal_cyclic_path(Sym **syms, size_t num_syms, Sym *sym) {
+    char *path = NULL;
+    for (size_t i = 0; i < num_syms; i++) {
+        buf_print_sym_pos(&path, syms[i]);
+        buf_printf(path, " -> ");
+    }
+    buf_printf(path, "%s", sym->name);
+    fatal_error(sym->decl->pos, "Cyclic dependency: %s", path);
+}
+
+NORETURN void fatal_cyclic_dependency(Sym *sym) {
+    size_t start = 0;
+    for (size_t i = buf_len(resolving_syms); i > 0; i--) {
+        if (resolving_syms[i - 1] == sym) {
+            start = i - 1;
+            break;
+        }
+    }
+    fatal_cyclic_path(resolving_syms + start, buf_len(resolving_syms) - start, sym);
+}
+
+// Typedefs, consts and vars can name each other in chains of any length, like typedef T0 = T1;
+// typedef T1 = T2; and so on, which would overflow the stack if resolve_sym followed them
+// recursively. So their unresolved typedef, const and var dependencies are walked from an explicit
+// stack and resolved deepest first, and each one finds what it names already resolved. Any other
+// dependencies are left to resolve_sym.
+typedef struct DependencyFrame {
+    Sym *sym;
+    Sym **deps;
+    size_t next_dep;
+} DependencyFrame;
+
+DependencyFrame *dependency_frames;
+// Maps each sym in dependency_frames to its index plus one.
+Map dependency_frame_map;
+
+bool is_chained_decl(Decl *decl) {
+    return decl && (decl->kind == DECL_TYPEDEF || decl->kind == DECL_CONST || decl->kind == DECL_VAR);
+}
+
+void push_dependency(Sym ***deps, Sym *sym) {
+    if (sym && sym->state == SYM_UNRESOLVED && is_chained_decl(sym->decl)) {
+        buf_push(*deps, sym);
+    }
+}
+
+void collect_expr_dependencies(Sym ***deps, Package *package, Expr *expr);
+
+void collect_typespec_dependencies(Sym ***deps, Package *package, Typespec *typespec) {
+    if (!typespec) {
+        return;
+    }
+    switch (typespec->kind) {
+    case TYPESPEC_NAME:
+        // Names qualified by a package are left to resolve_sym.
+        if (typespec->num_names == 1) {
+            push_dependency(deps, get_package_sym(package, typespec->names[0]));
+        }
+        break;
+    case TYPESPEC_FUNC:
+        for (size_t i = 0; i < typespec->func.num_args; i++) {
+            collect_typespec_dependencies(deps, package, typespec->func.args[i]);
+        }
+        collect_typespec_dependencies(deps, package, typespec->func.ret);
+        break;
+    case TYPESPEC_ARRAY:
+        collect_typespec_dependencies(deps, package, typespec->base);
+        collect_expr_dependencies(deps, package, typespec->num_elems);
+        break;
+    case TYPESPEC_PTR:
+    case TYPESPEC_CONST:
+        collect_typespec_dependencies(deps, package, typespec->base);
+        break;
+    case TYPESPEC_TUPLE:
+        for (size_t i = 0; i < typespec->tuple.num_fields; i++) {
+            collect_typespec_dependencies(deps, package, typespec->tuple.fields[i]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void collect_expr_dependencies(Sym ***deps, Package *package, Expr *expr) {
+    if (!expr) {
+        return;
+    }
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        collect_expr_dependencies(deps, package, expr->paren.expr);
+        break;
+    case EXPR_NAME:
+        push_dependency(deps, get_package_sym(package, expr->name));
+        break;
+    case EXPR_CAST:
+        collect_typespec_dependencies(deps, package, expr->cast.type);
+        collect_expr_dependencies(deps, package, expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        collect_expr_dependencies(deps, package, expr->call.expr);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            collect_expr_dependencies(deps, package, expr->call.args[i]);
+        }
+        break;
+    case EXPR_INDEX:
+        collect_expr_dependencies(deps, package, expr->index.expr);
+        collect_expr_dependencies(deps, package, expr->index.index);
+        break;
+    case EXPR_FIELD:
+        collect_expr_dependencies(deps, package, expr->field.expr);
+        break;
+    case EXPR_COMPOUND:
+        collect_typespec_dependencies(deps, package, expr->compound.type);
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_INDEX) {
+                collect_expr_dependencies(deps, package, field.index);
+            }
+            collect_expr_dependencies(deps, package, field.init);
+        }
+        break;
+    case EXPR_UNARY:
+        collect_expr_dependencies(deps, package, expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        collect_expr_dependencies(deps, package, expr->binary.left);
+        collect_expr_dependencies(deps, package, expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        collect_expr_dependencies(deps, package, expr->ternary.cond);
+        collect_expr_dependencies(deps, package, expr->ternary.then_expr);
+        collect_expr_dependencies(deps, package, expr->ternary.else_expr);
+        break;
+    case EXPR_MODIFY:
+        collect_expr_dependencies(deps, package, expr->modify.expr);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        collect_expr_dependencies(deps, package, expr->sizeof_expr);
+        break;
+    case EXPR_SIZEOF_TYPE:
+        collect_typespec_dependencies(deps, package, expr->sizeof_type);
+        break;
+    case EXPR_TYPEOF_EXPR:
+        collect_expr_dependencies(deps, package, expr->typeof_expr);
+        break;
+    case EXPR_TYPEOF_TYPE:
+        collect_typespec_dependencies(deps, package, expr->typeof_type);
+        break;
+    case EXPR_ALIGNOF_EXPR:
+        collect_expr_dependencies(deps, package, expr->alignof_expr);
+        break;
+    case EXPR_ALIGNOF_TYPE:
+        collect_typespec_dependencies(deps, package, expr->alignof_type);
+        break;
+    case EXPR_OFFSETOF:
+        collect_typespec_dependencies(deps, package, expr->offsetof_field.type);
+        break;
+    case EXPR_NEW:
+        collect_expr_dependencies(deps, package, expr->new_expr.alloc);
+        collect_expr_dependencies(deps, package, expr->new_expr.len);
+        collect_expr_dependencies(deps, package, expr->new_expr.arg);
+        break;
+    default:
+        break;
+    }
+}
+
+void push_dependency_frame(Sym *sym) {
+    Decl *decl = sym->decl;
+    Sym **deps = NULL;
+    if (decl->kind == DECL_TYPEDEF) {
+        collect_typespec_dependencies(&deps, sym->home_package, decl->typedef_decl.type);
+    } else if (decl->kind == DECL_CONST) {
+        collect_typespec_dependencies(&deps, sym->home_package, decl->const_decl.type);
+        collect_expr_dependencies(&deps, sym->home_package, decl->const_decl.expr);
+    } else {
+        assert(decl->kind == DECL_VAR);
+        collect_typespec_dependencies(&deps, sym->home_package, decl->var.type);
+        collect_expr_dependencies(&deps, sym->home_package, decl->var.expr);
+    }
+    buf_push(dependency_frames, (DependencyFrame){sym, deps});
+    map_put_uint64(&dependency_frame_map, sym, buf_len(dependency_frames));
+}
+
+void pop_dependency_frame(void) {
+    DependencyFrame *frame = &dependency_frames[buf_len(dependency_frames) - 1];
+    map_put_uint64(&dependency_frame_map, frame->sym, 0);
+    buf_free(frame->deps);
+    buf__hdr(dependency_frames)->len--;
+}
+
+void resolve_sym(Sym *sym);
+
+void resolve_sym_chain(Sym *sym) {
+    size_t base = buf_len(dependency_frames);
+    push_dependency_frame(sym);
+    while (buf_len(dependency_frames) > base) {
+        DependencyFrame *frame = &dependency_frames[buf_len(dependency_frames) - 1];
+        Sym *dep = NULL;
+        while (!dep && frame->next_dep < buf_len(frame->deps)) {
+            dep = frame->deps[frame->next_dep++];
+            if (dep->state != SYM_UNRESOLVED) {
+                dep = NULL;
+            }
+        }
+        if (!dep) {
+            // Still in dependency_frame_map, so resolve_sym resolves it directly.
+            resolve_sym(frame->sym);
+            pop_dependency_frame();
+            continue;
+        }
+        size_t index = map_get_uint64(&dependency_frame_map, dep);
+        if (index) {
+            Sym **path = NULL;
+            for (size_t i = index - 1; i < buf_len(dependency_frames); i++) {
+                buf_push(path, dependency_frames[i].sym);
+            }
+            fatal_cyclic_path(path, buf_len(path), dep);
+        }
+        push_dependency_frame(dep);
+    }
+}
+
+void resolve_sym(Sym *sym) {
+    if (sym->state == SYM_RESOLVED) {
+        return;
+    } else if (sym->state == SYM_RESOLVING) {
+        fatal_cyclic_dependency(sym);
+        return;
+    } else if (sym->state == SYM_FAILED) {
+        // Already reported, so just unwind without cascading errors.
+        recover_from_error();
+        return;
+    }
+    assert(sym->state == SYM_UNRESOLVED);
+    if (is_chained_decl(sym->decl) && !map_get_uint64(&dependency_frame_map, sym)) {
+        resolve_sym_chain(sym);
+        return;
+    }
+    assert(!sym->reachable);
+    if (!is_local_sym(sym)) {
+        buf_push(reachable_syms, sym);
+        sym->reachable = reachable_phase;
+    }
+    sym->state = SYM_RESOLVING;
+    buf_push(resolving_syms, sym);
+    Decl *decl = sym->decl;
+    Package *old_package = enter_package(sym->home_package);
+    switch (sym->kind) {
+    case SYM_TYPE:
+        if (decl && decl->kind == DECL_TYPEDEF) {
+            sym->type = resolve_typespec_strict(decl->typedef_decl.type, is_decl_foreign(decl));
+        } else if (decl->kind == DECL_ENUM) {
+            sym->type = resolve_decl_enum(sym, decl);
+        } else {
+            sym->type = type_incomplete(sym);
+        }
+        break;
+    case SYM_VAR:
+        sym->type = resolve_decl_var(decl);
+        break;
+    case SYM_CONST:
+        sym->type = resolve_decl_const(decl, &sym->val);
+        break;
+    case SYM_FUNC:
+        sym->type = resolve_decl_func(decl);
+        if (sym->type->func.intrinsic) {
+            sym->intrinsic = get_intrinsic_kind(decl);
+        }
+        break;
+    case SYM_PACKAGE:
+        // Do nothing
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    leave_package(old_package);
+    buf__hdr(resolving_syms)->len--;
+    sym->state = SYM_RESOLVED;
     if (decl->is_incomplete || (decl->kind != DECL_STRUCT && decl->kind != DECL_UNION)) {
         buf_push(sorted_syms, sym);
     }
 }
 
 void finalize_sym(Sym *sym) {
+    if (sym->state == SYM_FAILED) {
+        return;
+    }
     assert(sym->state == SYM_RESOLVED);
     if (sym->decl && !sym->decl->is_incomplete) {
         if (sym->kind == SYM_TYPE) {
@@ -1704,7 +2809,7 @@ Operand resolve_name_operand(SrcPos pos, const char *name) {
     }
     if (sym->kind == SYM_VAR) {
         Operand operand = operand_lvalue(sym->type);
-        if (is_array_type(operand.type) && !is_incomplete_array_type(operand.type)) {
+        if (is_array_type(operand.type) && !is_incomplete_array_type(operand.type) && !is_soa_array_type(operand.type)) {
             operand = operand_decay(operand);
         }
         return operand;
@@ -1735,6 +2840,13 @@ Operand resolve_unary_op(TokenKind op, Operand operand) {
 Operand resolve_expr_unary(Expr *expr) {
     Operand operand = resolve_expr_rvalue(expr->unary.expr);
     Type *type = operand.type;
+    if (is_vector_type(type)) {
+        TokenKind op = expr->unary.op;
+        if (op == TOKEN_MUL || op == TOKEN_NOT || (op == TOKEN_NEG && !is_integer_type(type->base))) {
+            fatal_error(expr->pos, "Cannot use unary %s with %s", token_kind_name(op), get_type_name(type));
+        }
+        return operand_rvalue(type);
+    }
     switch (expr->unary.op) {
     case TOKEN_MUL:
         if (!is_ptr_type(type)) {
@@ -1793,10 +2905,63 @@ bool compatible_pointer_arith(Type *left, Type *right, Expr *left_expr, Expr *ri
             return true;
         }
     }
-    return false;
+    return false;
+}
+
+// Vector operands must have the same type. A scalar operand is converted to the lane type and
+// broadcast to every lane.
+Operand resolve_expr_vector_binary_op(TokenKind op, const char *op_name, SrcPos pos, Operand left, Operand right, Expr *left_expr, Expr *right_expr) {
+    Type *left_type = unqualify_type(left.type);
+    Type *right_type = unqualify_type(right.type);
+    Type *type = is_vector_type(left_type) ? left_type : right_type;
+    if (is_vector_type(left_type) && is_vector_type(right_type)) {
+        if (left_type != right_type) {
+            fatal_error(pos, "Vector operands of %s must have the same type, got %s and %s", op_name, get_type_name(left_type), get_type_name(right_type));
+        }
+    } else {
+        Operand scalar = is_vector_type(left_type) ? right : left;
+        Expr *scalar_expr = is_vector_type(left_type) ? right_expr : left_expr;
+        if (!is_arithmetic_type(scalar.type)) {
+            fatal_error(pos, "Operands of %s must be vectors, or a vector and an arithmetic scalar", op_name);
+        }
+        if (unqualify_type(scalar.type) != type->base) {
+            set_type_conv(scalar_expr, type->base);
+        }
+    }
+    switch (op) {
+    case TOKEN_ADD:
+    case TOKEN_SUB:
+    case TOKEN_MUL:
+    case TOKEN_DIV:
+        break;
+    case TOKEN_MOD:
+    case TOKEN_AND:
+    case TOKEN_OR:
+    case TOKEN_XOR:
+    case TOKEN_LSHIFT:
+    case TOKEN_RSHIFT:
+        if (!is_integer_type(type->base)) {
+            fatal_error(pos, "Operands of %s must be integer vectors", op_name);
+        }
+        break;
+    case TOKEN_EQ:
+    case TOKEN_NOTEQ:
+    case TOKEN_LT:
+    case TOKEN_LTEQ:
+    case TOKEN_GT:
+    case TOKEN_GTEQ:
+        return operand_rvalue(vector_mask_type(type));
+    default:
+        fatal_error(pos, "Operator %s cannot be used with vector types", op_name);
+        break;
+    }
+    return operand_rvalue(type);
 }
 
 Operand resolve_expr_binary_op(TokenKind op, const char *op_name, SrcPos pos, Operand left, Operand right, Expr *left_expr, Expr *right_expr) {
+    if (is_vector_type(unqualify_type(left.type)) || is_vector_type(unqualify_type(right.type))) {
+        return resolve_expr_vector_binary_op(op, op_name, pos, left, right, left_expr, right_expr);
+    }
     switch (op) {
     case TOKEN_MUL:
     case TOKEN_DIV:
@@ -2012,6 +3177,17 @@ Operand resolve_expr_compound(Expr *expr, Type *expected_type) {
             index++;
         }
     } else if (type->kind == TYPE_ARRAY || type->kind == TYPE_PTR) {
+        if (type->kind == TYPE_ARRAY) {
+            complete_type(type->base);
+            if (is_soa_struct_type(type->base)) {
+                if (type->incomplete_elems) {
+                    fatal_error(expr->pos, "@soa array compound literal must have an explicit size");
+                }
+                if (expr->compound.num_fields) {
+                    fatal_error(expr->pos, "@soa array compound literal must be empty");
+                }
+            }
+        }
         int index = 0, max_index = 0;
         for (size_t i = 0; i < expr->compound.num_fields; i++) {
             CompoundField field = expr->compound.fields[i];
@@ -2042,6 +3218,19 @@ Operand resolve_expr_compound(Expr *expr, Type *expected_type) {
         if (type->incomplete_elems) {
             type = type_array(type->base, max_index + 1, false);
         }
+    } else if (type->kind == TYPE_VECTOR) {
+        if (expr->compound.num_fields > type->num_elems) {
+            fatal_error(expr->pos, "Too many initializers in vector compound literal");
+        }
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind != FIELD_DEFAULT) {
+                fatal_error(field.pos, "Designated initializers not allowed for vector compound literals");
+            }
+            if (!resolve_typed_init(field.pos, type->base, field.init)) {
+                fatal_error(field.pos, "Invalid type in compound literal initializer for vector type. Expected %s", get_type_name(type->base));
+            }
+        }
     } else {
         if (type == type_void) {
             fatal_error(expr->pos, "Anonymous compound literal in context expecting void type");
@@ -2081,273 +3270,524 @@ Operand resolve_expr_call_default(Operand func, Expr *expr) {
     return operand_rvalue(func.type->func.ret);
 }
 
-Operand resolve_expr_call_intrinsic(Operand func, Expr *expr, Type *expected_type) {
-    Sym *sym = get_resolved_sym(expr->call.expr);
-    assert(sym);
-    if (sym->name == str_intern("va_arg")) {
-        Operand args = resolve_expr(expr->call.args[0]);
-        if (!args.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of va_arg must be lvalue");
-        }
-        Operand arg = resolve_expr(expr->call.args[1]);
-        if (!arg.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 2 of va_arg must be lvalue");
-        }
-        return operand_rvalue(func.type->func.ret);
-    } else if (sym->name == str_intern("aput")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (!array.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
-        }
-        Type *base_type = unqualify_type(array.type->base);
-        if (base_type == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!is_aggregate_type(base_type) && base_type->aggregate.num_fields != 2) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have aggregate base type with 2 fields", sym->name);
-        }
-        Type *base_key_type = base_type->aggregate.fields[0].type;
-        if (type_padding(base_key_type)) {
-            fatal_error(expr->call.args[1]->pos, "Key type of %s must contain no padding", sym->name);
-        }
-        Operand key = resolve_expected_expr_rvalue(expr->call.args[1], base_key_type);
-        if (!convert_operand(&key, base_key_type)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1's key type", sym->name);
-        }
-        Type *base_value_type = base_type->aggregate.fields[1].type;
-        Operand value = resolve_expected_expr_rvalue(expr->call.args[2], base_value_type);
-        if (!is_convertible(&value, base_value_type)) {
-            fatal_error(expr->call.args[2]->pos, "Argument 3 of %s not convertible to argument 1's value type", sym->name);
-        }
-        return operand_rvalue(func.type->func.ret);
-    } else if (sym->name == str_intern("ageti") || sym->name == str_intern("adel")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(array.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        Type *base_type = unqualify_type(array.type->base);
-        if (base_type == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!is_aggregate_type(base_type) && base_type->aggregate.num_fields != 2) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have aggregate base type with 2 fields", sym->name);
-        }
-        Type *base_key_type = base_type->aggregate.fields[0].type;
-        if (type_padding(base_key_type)) {
-            fatal_error(expr->call.args[1]->pos, "Key type of %s must contain no padding", sym->name);
-        }
-        Operand key = resolve_expected_expr_rvalue(expr->call.args[1], base_key_type);
-        if (!convert_operand(&key, base_key_type)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1's key type", sym->name);
-        }
-        return operand_rvalue(func.type->func.ret);
-    } else if (sym->name == str_intern("agetp")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(array.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        Type *base_type = unqualify_type(array.type->base);
-        if (base_type == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!is_aggregate_type(base_type) && base_type->aggregate.num_fields != 2) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have aggregate base type with 2 fields", sym->name);
-        }
-        Type *base_key_type = base_type->aggregate.fields[0].type;
-        if (type_padding(base_key_type)) {
-            fatal_error(expr->call.args[1]->pos, "Key type of %s must contain no padding", sym->name);
-        }
-        Operand key = resolve_expected_expr_rvalue(expr->call.args[1], base_key_type);
-        if (!convert_operand(&key, base_key_type)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1's key type", sym->name);
-        }
-        return operand_rvalue(type_ptr(array.type->base->aggregate.fields[1].type));
-    } else if (sym->name == str_intern("aget")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(array.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        Type *base_type = unqualify_type(array.type->base);
-        if (base_type == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!is_aggregate_type(base_type) && base_type->aggregate.num_fields != 2) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have aggregate base type with 2 fields", sym->name);
-        }
-        Type *base_key_type = base_type->aggregate.fields[0].type;
-        if (type_padding(base_key_type)) {
-            fatal_error(expr->call.args[1]->pos, "Key type of %s must contain no padding", sym->name);
-        }
-        Operand key = resolve_expected_expr_rvalue(expr->call.args[1], base_key_type);
-        if (!convert_operand(&key, base_key_type)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1's key type", sym->name);
-        }
-        return operand_rvalue(array.type->base->aggregate.fields[1].type);
-    } else if (sym->name == str_intern("apush") || sym->name == str_intern("aputv") || sym->name == str_intern("agetvi") || sym->name == str_intern("adelv")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(array.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!array.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
-        }
-        if (sym->name != str_intern("apush") && type_padding(array.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Base type of %s must contain no padding", sym->name);
-        }
-        Operand elem = resolve_expected_expr_rvalue(expr->call.args[1], array.type->base);
-        if (!convert_operand(&elem, array.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1 base type", sym->name);
-        }
-        return operand_rvalue(func.type->func.ret);
-    } else if (sym->name == str_intern("agetvp")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(array.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!array.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
-        }
-        if (type_padding(array.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Base type of %s must contain no padding", sym->name);
-        }
-        Operand elem = resolve_expected_expr_rvalue(expr->call.args[1], array.type->base);
-        if (!convert_operand(&elem, array.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1 base type", sym->name);
-        }
-        return operand_rvalue(array.type);
-    } else if (sym->name == str_intern("agetv")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(array.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!array.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
-        }
-        if (type_padding(array.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Base type of %s must contain no padding", sym->name);
-        }
-        Operand elem = resolve_expected_expr_rvalue(expr->call.args[1], array.type->base);
-        if (!convert_operand(&elem, array.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1 base type", sym->name);
-        }
-        return operand_rvalue(array.type->base);
-    } else if (sym->name == str_intern("adefault")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(array.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!array.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
-        }
-        Type *base_type = unqualify_type(array.type->base);
-        if (base_type == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!is_aggregate_type(base_type) && base_type->aggregate.num_fields != 2) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have aggregate base type with 2 fields", sym->name);
-        }
-        Type *base_val_type = base_type->aggregate.fields[1].type;
-        Operand key = resolve_expected_expr_rvalue(expr->call.args[1], base_val_type);
-        if (!convert_operand(&key, base_val_type)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1's value type", sym->name);
-        }
-        return operand_rvalue(type_void);
-    } else if (sym->name == str_intern("afill")) {
-        Operand array = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(array.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(array.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!array.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
-        }
-        Operand elem = resolve_expected_expr_rvalue(expr->call.args[1], array.type->base);
-        if (!convert_operand(&elem, array.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1 base type", sym->name);
-        }
-        Operand count = resolve_expected_expr_rvalue(expr->call.args[2], type_usize);
-        if (!convert_operand(&count, type_usize)) {
-            fatal_error(expr->call.args[2]->pos, "Argument 3 of %s not convertible to usize", sym->name);
-        }
-        return operand_rvalue(func.type->func.ret);
-    } else if (sym->name == str_intern("acat")) {
-        assert(expr->call.num_args == 2);
-        Operand dest = resolve_expr(expr->call.args[0]);
-        if (!is_ptr_type(dest.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(dest.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
-        }
-        if (!dest.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of acat must be lvalue");
-        }
-        Operand src = resolve_expr_rvalue(expr->call.args[1]);
-        if (!is_ptr_type(src.type)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 2 of %s must have pointer type", sym->name);
-        }
-        if (unqualify_type(src.type->base) == type_void) {
-            fatal_error(expr->call.args[0]->pos, "Argument 2 of %s must have non-void base type", sym->name);
-        }
-        if (dest.type->base != unqualify_type(src.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 1 and 2 of acat don't have identical base types");
-        }
-        return operand_rvalue(func.type->func.ret);
-    } else if (sym->name == str_intern("acatn")) {
-        assert(expr->call.num_args == 3);
-        Operand dest = resolve_expr(expr->call.args[0]);
-        Operand src = resolve_expr_rvalue(expr->call.args[1]);
-        if (!dest.is_lvalue) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of acat must be lvalue");
+Operand resolve_intrinsic_va_arg(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand args = resolve_expr(expr->call.args[0]);
+    if (!args.is_lvalue) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of va_arg must be lvalue");
+    }
+    Operand arg = resolve_expr(expr->call.args[1]);
+    if (!arg.is_lvalue) {
+        fatal_error(expr->call.args[0]->pos, "Argument 2 of va_arg must be lvalue");
+    }
+    return operand_rvalue(func.type->func.ret);
+}
+
+Operand resolve_intrinsic_aput(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand array = resolve_expr(expr->call.args[0]);
+    if (!is_ptr_type(array.type)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
+    }
+    if (!array.is_lvalue) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
+    }
+    Type *base_type = unqualify_type(array.type->base);
+    if (base_type == type_void) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
+    }
+    complete_type(base_type);
+    if (!is_aggregate_type(base_type) || base_type->aggregate.num_fields != 2) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have aggregate base type with 2 fields", sym->name);
+    }
+    Type *base_key_type = base_type->aggregate.fields[0].type;
+    if (type_padding(base_key_type)) {
+        fatal_error(expr->call.args[1]->pos, "Key type of %s must contain no padding", sym->name);
+    }
+    Operand key = resolve_expected_expr_rvalue(expr->call.args[1], base_key_type);
+    if (!convert_operand(&key, base_key_type)) {
+        fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1's key type", sym->name);
+    }
+    Type *base_value_type = base_type->aggregate.fields[1].type;
+    Operand value = resolve_expected_expr_rvalue(expr->call.args[2], base_value_type);
+    if (!is_convertible(&value, base_value_type)) {
+        fatal_error(expr->call.args[2]->pos, "Argument 3 of %s not convertible to argument 1's value type", sym->name);
+    }
+    return operand_rvalue(func.type->func.ret);
+}
+
+// Checks the (array, key) arguments shared by the key lookup intrinsics and returns the array.
+Operand resolve_intrinsic_key_args(Sym *sym, Expr *expr) {
+    Operand array = resolve_expr(expr->call.args[0]);
+    if (!is_ptr_type(array.type)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
+    }
+    if (unqualify_type(array.type->base) == type_void) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
+    }
+    Type *base_type = unqualify_type(array.type->base);
+    complete_type(base_type);
+    if (!is_aggregate_type(base_type) || base_type->aggregate.num_fields != 2) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have aggregate base type with 2 fields", sym->name);
+    }
+    Type *base_key_type = base_type->aggregate.fields[0].type;
+    if (type_padding(base_key_type)) {
+        fatal_error(expr->call.args[1]->pos, "Key type of %s must contain no padding", sym->name);
+    }
+    Operand key = resolve_expected_expr_rvalue(expr->call.args[1], base_key_type);
+    if (!convert_operand(&key, base_key_type)) {
+        fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1's key type", sym->name);
+    }
+    return array;
+}
+
+Operand resolve_intrinsic_key(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    resolve_intrinsic_key_args(sym, expr);
+    return operand_rvalue(func.type->func.ret);
+}
+
+Operand resolve_intrinsic_agetp(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand array = resolve_intrinsic_key_args(sym, expr);
+    return operand_rvalue(type_ptr(array.type->base->aggregate.fields[1].type));
+}
+
+Operand resolve_intrinsic_aget(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand array = resolve_intrinsic_key_args(sym, expr);
+    return operand_rvalue(array.type->base->aggregate.fields[1].type);
+}
+
+// Checks the (array, elem) arguments shared by the element intrinsics and returns the array.
+Operand resolve_intrinsic_elem_args(Sym *sym, Expr *expr) {
+    Operand array = resolve_expr(expr->call.args[0]);
+    if (!is_ptr_type(array.type)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
+    }
+    if (unqualify_type(array.type->base) == type_void) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
+    }
+    if (!array.is_lvalue) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
+    }
+    if (sym->intrinsic != INTRINSIC_APUSH && sym->intrinsic != INTRINSIC_QPUSH && type_padding(array.type->base)) {
+        fatal_error(expr->call.args[1]->pos, "Base type of %s must contain no padding", sym->name);
+    }
+    Operand elem = resolve_expected_expr_rvalue(expr->call.args[1], array.type->base);
+    if (!convert_operand(&elem, array.type->base)) {
+        fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1 base type", sym->name);
+    }
+    return array;
+}
+
+Operand resolve_intrinsic_elem(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    resolve_intrinsic_elem_args(sym, expr);
+    return operand_rvalue(func.type->func.ret);
+}
+
+Operand resolve_intrinsic_agetvp(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand array = resolve_intrinsic_elem_args(sym, expr);
+    return operand_rvalue(array.type);
+}
+
+Operand resolve_intrinsic_agetv(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand array = resolve_intrinsic_elem_args(sym, expr);
+    return operand_rvalue(array.type->base);
+}
+
+Operand resolve_intrinsic_adefault(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand array = resolve_expr(expr->call.args[0]);
+    if (!is_ptr_type(array.type)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
+    }
+    if (unqualify_type(array.type->base) == type_void) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
+    }
+    if (!array.is_lvalue) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
+    }
+    Type *base_type = unqualify_type(array.type->base);
+    complete_type(base_type);
+    if (!is_aggregate_type(base_type) || base_type->aggregate.num_fields != 2) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have aggregate base type with 2 fields", sym->name);
+    }
+    Type *base_val_type = base_type->aggregate.fields[1].type;
+    Operand key = resolve_expected_expr_rvalue(expr->call.args[1], base_val_type);
+    if (!convert_operand(&key, base_val_type)) {
+        fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1's value type", sym->name);
+    }
+    return operand_rvalue(type_void);
+}
+
+Operand resolve_intrinsic_afill(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand array = resolve_expr(expr->call.args[0]);
+    if (!is_ptr_type(array.type)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
+    }
+    if (unqualify_type(array.type->base) == type_void) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
+    }
+    if (!array.is_lvalue) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be lvalue", sym->name);
+    }
+    Operand elem = resolve_expected_expr_rvalue(expr->call.args[1], array.type->base);
+    if (!convert_operand(&elem, array.type->base)) {
+        fatal_error(expr->call.args[1]->pos, "Argument 2 of %s not convertible to argument 1 base type", sym->name);
+    }
+    Operand count = resolve_expected_expr_rvalue(expr->call.args[2], type_usize);
+    if (!convert_operand(&count, type_usize)) {
+        fatal_error(expr->call.args[2]->pos, "Argument 3 of %s not convertible to usize", sym->name);
+    }
+    return operand_rvalue(func.type->func.ret);
+}
+
+Operand resolve_intrinsic_acat(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    assert(expr->call.num_args == 2);
+    Operand dest = resolve_expr(expr->call.args[0]);
+    if (!is_ptr_type(dest.type)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
+    }
+    if (unqualify_type(dest.type->base) == type_void) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
+    }
+    if (!dest.is_lvalue) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of acat must be lvalue");
+    }
+    Operand src = resolve_expr_rvalue(expr->call.args[1]);
+    if (!is_ptr_type(src.type)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 2 of %s must have pointer type", sym->name);
+    }
+    if (unqualify_type(src.type->base) == type_void) {
+        fatal_error(expr->call.args[0]->pos, "Argument 2 of %s must have non-void base type", sym->name);
+    }
+    if (dest.type->base != unqualify_type(src.type->base)) {
+        fatal_error(expr->call.args[1]->pos, "Argument 1 and 2 of acat don't have identical base types");
+    }
+    return operand_rvalue(func.type->func.ret);
+}
+
+Operand resolve_intrinsic_acatn(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    assert(expr->call.num_args == 3);
+    Operand dest = resolve_expr(expr->call.args[0]);
+    Operand src = resolve_expr_rvalue(expr->call.args[1]);
+    if (!dest.is_lvalue) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of acat must be lvalue");
+    }
+    if (dest.type->base != unqualify_type(src.type->base)) {
+        fatal_error(expr->call.args[1]->pos, "Argument 1 and 2 of acatn don't have identical base types");
+    }
+    Operand len = resolve_expr_rvalue(expr->call.args[2]);
+    if (!convert_operand(&len, type_usize)) {
+        fatal_error(expr->call.args[2]->pos, "Argument 3 of acatn not convertible to usize");
+    }
+    return operand_rvalue(func.type->func.ret);
+}
+
+Operand resolve_intrinsic_anew(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    assert(expr->call.num_args == 1);
+    Operand allocator = resolve_expr_rvalue(expr->call.args[0]);
+    if (!convert_operand(&allocator, type_allocator_ptr)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have type Allocator*", sym->name);
+    }
+    if (!expected_type || (!is_ptr_type(expected_type) && !is_array_type(expected_type))) {
+        fatal_error(expr->pos, "anew can only be used when its inferred type is array or pointer type");
+    }
+    complete_type(expected_type->base);
+    if (type_sizeof(expected_type->base) == 0) {
+        fatal_error(expr->pos, "anew base type cannot be incomplete or have size 0");
+    }
+    return operand_rvalue(type_ptr(expected_type->base));
+}
+
+Operand resolve_intrinsic_qpop(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    assert(expr->call.num_args == 2);
+    Operand queue = resolve_expr_rvalue(expr->call.args[0]);
+    if (!is_ptr_type(queue.type)) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have pointer type", sym->name);
+    }
+    if (unqualify_type(queue.type->base) == type_void) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have non-void base type", sym->name);
+    }
+    Operand dest = resolve_expr_rvalue(expr->call.args[1]);
+    if (!is_ptr_type(dest.type) || dest.type->base != queue.type->base) {
+        fatal_error(expr->call.args[1]->pos, "Argument 2 of %s must point to argument 1 base type", sym->name);
+    }
+    return operand_rvalue(func.type->func.ret);
+}
+
+// Values of the builtin MemoryOrder enum.
+typedef enum MemoryOrder {
+    MEMORY_ORDER_RELAXED,
+    MEMORY_ORDER_CONSUME,
+    MEMORY_ORDER_ACQUIRE,
+    MEMORY_ORDER_RELEASE,
+    MEMORY_ORDER_ACQ_REL,
+    MEMORY_ORDER_SEQ_CST,
+} MemoryOrder;
+
+#define MEMORY_ORDER_BIT(order) (1u << (order))
+
+// Checks the pointer argument shared by the atomic intrinsics and returns its base type.
+Type *resolve_intrinsic_atomic_ptr(Sym *sym, Expr *expr, int index, bool modifies) {
+    Expr *arg = expr->call.args[index];
+    Operand ptr = resolve_expr_rvalue(arg);
+    if (!is_ptr_type(ptr.type)) {
+        fatal_error(arg->pos, "Argument %d of %s must have pointer type", index + 1, sym->name);
+    }
+    if (modifies && (is_const_type(ptr.type->base) || ptr.type->base->nonmodifiable)) {
+        fatal_error(arg->pos, "Argument %d of %s must point to non-const type", index + 1, sym->name);
+    }
+    Type *base = unqualify_type(ptr.type->base);
+    if (!is_integer_type(base) && !is_ptr_type(base)) {
+        fatal_error(arg->pos, "Argument %d of %s must point to integer or pointer type", index + 1, sym->name);
+    }
+    return base;
+}
+
+void resolve_intrinsic_atomic_value(Sym *sym, Expr *expr, int index, Type *type) {
+    Operand value = resolve_expected_expr_rvalue(expr->call.args[index], type);
+    if (!convert_operand(&value, type)) {
+        fatal_error(expr->call.args[index]->pos, "Argument %d of %s not convertible to argument 1 base type", index + 1, sym->name);
+    }
+}
+
+// Constant orders are checked against the ones C11 forbids for the operation. Returns the order,
+// or -1 if it isn't constant.
+int resolve_intrinsic_atomic_order(Sym *sym, Operand func, Expr *expr, int index, unsigned invalid_orders) {
+    Expr *arg = expr->call.args[index];
+    Type *order_type = func.type->func.params[index];
+    Operand order = resolve_expected_expr_rvalue(arg, order_type);
+    if (!convert_operand(&order, order_type)) {
+        fatal_error(arg->pos, "Argument %d of %s must be a MemoryOrder", index + 1, sym->name);
+    }
+    if (order.is_const) {
+        cast_operand(&order, type_int);
+        if (order.val.i < MEMORY_ORDER_RELAXED || order.val.i > MEMORY_ORDER_SEQ_CST) {
+            fatal_error(arg->pos, "Invalid memory order for %s", sym->name);
         }
-        if (dest.type->base != unqualify_type(src.type->base)) {
-            fatal_error(expr->call.args[1]->pos, "Argument 1 and 2 of acatn don't have identical base types");
-        }
-        Operand len = resolve_expr_rvalue(expr->call.args[2]);
-        if (!convert_operand(&len, type_usize)) {
-            fatal_error(expr->call.args[2]->pos, "Argument 3 of acatn not convertible to usize");
-        }
-        return operand_rvalue(func.type->func.ret);
-    } else if (sym->name == str_intern("anew")) {
-        assert(expr->call.num_args == 1);
-        Operand allocator = resolve_expr_rvalue(expr->call.args[0]);
-        if (!convert_operand(&allocator, type_allocator_ptr)) {
-            fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must have type Allocator*", sym->name);
+        if (invalid_orders & MEMORY_ORDER_BIT(order.val.i)) {
+            fatal_error(arg->pos, "Memory order not allowed for %s", sym->name);
         }
-        if (!expected_type || (!is_ptr_type(expected_type) && !is_array_type(expected_type))) {
-            fatal_error(expr->pos, "anew can only be used when its inferred type is array or pointer type");
+        return order.val.i;
+    }
+    return -1;
+}
+
+// How strongly an order synchronizes the load part of a read-modify-write.
+int atomic_load_order_strength(int order) {
+    switch (order) {
+    case MEMORY_ORDER_CONSUME:
+        return 1;
+    case MEMORY_ORDER_ACQUIRE:
+    case MEMORY_ORDER_ACQ_REL:
+        return 2;
+    case MEMORY_ORDER_SEQ_CST:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+Operand resolve_intrinsic_atomic_load(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Type *type = resolve_intrinsic_atomic_ptr(sym, expr, 0, false);
+    resolve_intrinsic_atomic_order(sym, func, expr, 1, MEMORY_ORDER_BIT(MEMORY_ORDER_RELEASE) | MEMORY_ORDER_BIT(MEMORY_ORDER_ACQ_REL));
+    return operand_rvalue(type);
+}
+
+Operand resolve_intrinsic_atomic_store(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Type *type = resolve_intrinsic_atomic_ptr(sym, expr, 0, true);
+    resolve_intrinsic_atomic_value(sym, expr, 1, type);
+    resolve_intrinsic_atomic_order(sym, func, expr, 2, MEMORY_ORDER_BIT(MEMORY_ORDER_CONSUME) | MEMORY_ORDER_BIT(MEMORY_ORDER_ACQUIRE) | MEMORY_ORDER_BIT(MEMORY_ORDER_ACQ_REL));
+    return operand_rvalue(type_void);
+}
+
+Operand resolve_intrinsic_atomic_exchange(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Type *type = resolve_intrinsic_atomic_ptr(sym, expr, 0, true);
+    resolve_intrinsic_atomic_value(sym, expr, 1, type);
+    resolve_intrinsic_atomic_order(sym, func, expr, 2, 0);
+    return operand_rvalue(type);
+}
+
+Operand resolve_intrinsic_atomic_cas(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Type *type = resolve_intrinsic_atomic_ptr(sym, expr, 0, true);
+    Type *expected = resolve_intrinsic_atomic_ptr(sym, expr, 1, true);
+    if (expected != type) {
+        fatal_error(expr->call.args[1]->pos, "Argument 2 of %s must have the same type as argument 1", sym->name);
+    }
+    resolve_intrinsic_atomic_value(sym, expr, 2, type);
+    int success = resolve_intrinsic_atomic_order(sym, func, expr, 3, 0);
+    int failure = resolve_intrinsic_atomic_order(sym, func, expr, 4, MEMORY_ORDER_BIT(MEMORY_ORDER_RELEASE) | MEMORY_ORDER_BIT(MEMORY_ORDER_ACQ_REL));
+    if (success >= 0 && failure >= 0 && atomic_load_order_strength(failure) > atomic_load_order_strength(success)) {
+        fatal_error(expr->call.args[4]->pos, "Failure memory order of %s can't be stronger than its success order", sym->name);
+    }
+    return operand_rvalue(type_bool);
+}
+
+Operand resolve_intrinsic_atomic_fetch(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Type *type = resolve_intrinsic_atomic_ptr(sym, expr, 0, true);
+    if (!is_integer_type(type) || type == type_bool) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must point to non-bool integer type", sym->name);
+    }
+    resolve_intrinsic_atomic_value(sym, expr, 1, type);
+    resolve_intrinsic_atomic_order(sym, func, expr, 2, 0);
+    return operand_rvalue(type);
+}
+
+Operand resolve_intrinsic_atomic_fence(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    resolve_intrinsic_atomic_order(sym, func, expr, 0, 0);
+    return operand_rvalue(type_void);
+}
+
+Type *resolve_intrinsic_vector_expected(Sym *sym, Expr *expr, Type *expected_type) {
+    Type *type = expected_type ? unqualify_type(expected_type) : NULL;
+    if (!is_vector_type(type)) {
+        fatal_error(expr->pos, "%s can only be used when its inferred type is a vector type", sym->name);
+    }
+    return type;
+}
+
+Type *resolve_intrinsic_vector_arg(Sym *sym, Expr *expr, int index, Type *expected_type) {
+    Expr *arg = expr->call.args[index];
+    Operand operand = resolve_expected_expr_rvalue(arg, expected_type);
+    if (!is_vector_type(operand.type)) {
+        fatal_error(arg->pos, "Argument %d of %s must have vector type", index + 1, sym->name);
+    }
+    if (expected_type && operand.type != expected_type) {
+        fatal_error(arg->pos, "Argument %d of %s must have type %s", index + 1, sym->name, get_type_name(expected_type));
+    }
+    return operand.type;
+}
+
+Operand resolve_intrinsic_vload(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Type *type = resolve_intrinsic_vector_expected(sym, expr, expected_type);
+    resolve_expr_call_default(func, expr);
+    return operand_rvalue(type);
+}
+
+Operand resolve_intrinsic_vstore(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Operand ptr = resolve_expr_rvalue(expr->call.args[0]);
+    if (!convert_operand(&ptr, func.type->func.params[0])) {
+        fatal_error(expr->call.args[0]->pos, "Argument 1 of %s must be a non-const pointer", sym->name);
+    }
+    resolve_intrinsic_vector_arg(sym, expr, 1, NULL);
+    return operand_rvalue(type_void);
+}
+
+// The lane indices select from the concatenation of both operands and must be constants.
+Operand resolve_intrinsic_vshuffle(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Type *type = resolve_intrinsic_vector_arg(sym, expr, 0, NULL);
+    resolve_intrinsic_vector_arg(sym, expr, 1, type);
+    if (expr->call.num_args - 2 != type->num_elems) {
+        fatal_error(expr->pos, "%s with %s operands takes %zu lane indices", sym->name, get_type_name(type), type->num_elems);
+    }
+    for (size_t i = 2; i < expr->call.num_args; i++) {
+        Operand index = resolve_const_expr(expr->call.args[i]);
+        if (!is_integer_type(index.type)) {
+            fatal_error(expr->call.args[i]->pos, "Lane index of %s must have integer type", sym->name);
         }
-        complete_type(expected_type->base);
-        if (type_sizeof(expected_type->base) == 0) {
-            fatal_error(expr->pos, "anew base type cannot be incomplete or have size 0");
+        cast_operand(&index, type_llong);
+        if (!(0 <= index.val.ll && index.val.ll < 2 * (long long)type->num_elems)) {
+            fatal_error(expr->call.args[i]->pos, "Lane index of %s out of range", sym->name);
         }
-        return operand_rvalue(type_ptr(expected_type->base));
+    }
+    reach_vector_type(vector_mask_type(type));
+    return operand_rvalue(type);
+}
+
+// Converts each lane, unlike a cast between vector types, which reinterprets the bits.
+Operand resolve_intrinsic_vconvert(Sym *sym, Operand func, Expr *expr, Type *expected_type) {
+    Type *type = resolve_intrinsic_vector_expected(sym, expr, expected_type);
+    Type *src = resolve_intrinsic_vector_arg(sym, expr, 0, NULL);
+    if (src->num_elems != type->num_elems) {
+        fatal_error(expr->pos, "Cannot convert %s to %s with a different number of lanes", get_type_name(src), get_type_name(type));
+    }
+    return operand_rvalue(type);
+}
+
+typedef Operand (*ResolveIntrinsicFunc)(Sym *sym, Operand func, Expr *expr, Type *expected_type);
+
+typedef struct IntrinsicDef {
+    const char *name;
+    // NULL means the call is checked like an ordinary call to the declared signature.
+    ResolveIntrinsicFunc resolve;
+} IntrinsicDef;
+
+IntrinsicDef intrinsic_defs[NUM_INTRINSICS] = {
+    [INTRINSIC_VA_START] = {"va_start"},
+    [INTRINSIC_VA_END] = {"va_end"},
+    [INTRINSIC_VA_COPY] = {"va_copy"},
+    [INTRINSIC_VA_ARG] = {"va_arg", resolve_intrinsic_va_arg},
+    [INTRINSIC_APUSH] = {"apush", resolve_intrinsic_elem},
+    [INTRINSIC_APUTV] = {"aputv", resolve_intrinsic_elem},
+    [INTRINSIC_ADELV] = {"adelv", resolve_intrinsic_elem},
+    [INTRINSIC_AGETVI] = {"agetvi", resolve_intrinsic_elem},
+    [INTRINSIC_AGETVP] = {"agetvp", resolve_intrinsic_agetvp},
+    [INTRINSIC_AGETV] = {"agetv", resolve_intrinsic_agetv},
+    [INTRINSIC_ASETCAP] = {"asetcap"},
+    [INTRINSIC_AFIT] = {"afit"},
+    [INTRINSIC_ACAT] = {"acat", resolve_intrinsic_acat},
+    [INTRINSIC_ADELI] = {"adeli"},
+    [INTRINSIC_AINDEXV] = {"aindexv"},
+    [INTRINSIC_ASETLEN] = {"asetlen"},
+    [INTRINSIC_ADEFAULT] = {"adefault", resolve_intrinsic_adefault},
+    [INTRINSIC_AFILL] = {"afill", resolve_intrinsic_afill},
+    [INTRINSIC_ACATN] = {"acatn", resolve_intrinsic_acatn},
+    [INTRINSIC_ADELN] = {"adeln"},
+    [INTRINSIC_AINDEX] = {"aindex"},
+    [INTRINSIC_AGETI] = {"ageti", resolve_intrinsic_key},
+    [INTRINSIC_ADEL] = {"adel", resolve_intrinsic_key},
+    [INTRINSIC_AGETP] = {"agetp", resolve_intrinsic_agetp},
+    [INTRINSIC_AGET] = {"aget", resolve_intrinsic_aget},
+    [INTRINSIC_APUT] = {"aput", resolve_intrinsic_aput},
+    [INTRINSIC_AHDRSIZE] = {"ahdrsize"},
+    [INTRINSIC_AHDRALIGN] = {"ahdralign"},
+    [INTRINSIC_AHDR] = {"ahdr"},
+    [INTRINSIC_ALEN] = {"alen"},
+    [INTRINSIC_ACAP] = {"acap"},
+    [INTRINSIC_AFREE] = {"afree"},
+    [INTRINSIC_ACLEAR] = {"aclear"},
+    [INTRINSIC_APOP] = {"apop"},
+    [INTRINSIC_ANEW] = {"anew", resolve_intrinsic_anew},
+    [INTRINSIC_QNEW] = {"qnew"},
+    [INTRINSIC_QFREE] = {"qfree"},
+    [INTRINSIC_QPUSH] = {"qpush", resolve_intrinsic_elem},
+    [INTRINSIC_QPOP] = {"qpop", resolve_intrinsic_qpop},
+    [INTRINSIC_ATOMIC_LOAD] = {"atomic_load", resolve_intrinsic_atomic_load},
+    [INTRINSIC_ATOMIC_STORE] = {"atomic_store", resolve_intrinsic_atomic_store},
+    [INTRINSIC_ATOMIC_EXCHANGE] = {"atomic_exchange", resolve_intrinsic_atomic_exchange},
+    [INTRINSIC_ATOMIC_CAS] = {"atomic_cas", resolve_intrinsic_atomic_cas},
+    [INTRINSIC_ATOMIC_FETCH_ADD] = {"atomic_fetch_add", resolve_intrinsic_atomic_fetch},
+    [INTRINSIC_ATOMIC_FETCH_SUB] = {"atomic_fetch_sub", resolve_intrinsic_atomic_fetch},
+    [INTRINSIC_ATOMIC_FETCH_AND] = {"atomic_fetch_and", resolve_intrinsic_atomic_fetch},
+    [INTRINSIC_ATOMIC_FETCH_OR] = {"atomic_fetch_or", resolve_intrinsic_atomic_fetch},
+    [INTRINSIC_ATOMIC_FETCH_XOR] = {"atomic_fetch_xor", resolve_intrinsic_atomic_fetch},
+    [INTRINSIC_ATOMIC_THREAD_FENCE] = {"atomic_thread_fence", resolve_intrinsic_atomic_fence},
+    [INTRINSIC_ATOMIC_SIGNAL_FENCE] = {"atomic_signal_fence", resolve_intrinsic_atomic_fence},
+    [INTRINSIC_VLOAD] = {"vload", resolve_intrinsic_vload},
+    [INTRINSIC_VSTORE] = {"vstore", resolve_intrinsic_vstore},
+    [INTRINSIC_VSHUFFLE] = {"vshuffle", resolve_intrinsic_vshuffle},
+    [INTRINSIC_VCONVERT] = {"vconvert", resolve_intrinsic_vconvert},
+};
+
+Map intrinsic_kinds;
+
+void init_intrinsics(void) {
+    for (int i = INTRINSIC_NONE + 1; i < NUM_INTRINSICS; i++) {
+        assert(intrinsic_defs[i].name);
+        map_put(&intrinsic_kinds, str_intern(intrinsic_defs[i].name), (void *)(intptr_t)i);
+    }
+}
+
+IntrinsicKind get_intrinsic_kind(Decl *decl) {
+    IntrinsicKind kind = (IntrinsicKind)(intptr_t)map_get(&intrinsic_kinds, decl->name);
+    if (!kind) {
+        fatal_error(decl->pos, "Unknown intrinsic '%s'", decl->name);
+    }
+    return kind;
+}
+
+Operand resolve_expr_call_intrinsic(Operand func, Expr *expr, Type *expected_type) {
+    Sym *sym = get_resolved_sym(expr->call.expr);
+    assert(sym && sym->intrinsic);
+    ResolveIntrinsicFunc resolve = intrinsic_defs[sym->intrinsic].resolve;
+    if (resolve) {
+        return resolve(sym, func, expr, expected_type);
     } else {
         return resolve_expr_call_default(func, expr);
     }
@@ -2382,9 +3822,12 @@ Operand resolve_expr_call(Expr *expr, Type *expected_type) {
     }
     if (func.type->func.intrinsic) {
         return resolve_expr_call_intrinsic(func, expr, expected_type);
-    } else {
-        return resolve_expr_call_default(func, expr);
     }
+    Operand result = resolve_expr_call_default(func, expr);
+    if (resolving_const_expr && is_integer_type(unqualify_type(result.type)) && is_eval_call(expr)) {
+        result = eval_const_call(expr, result.type);
+    }
+    return result;
 }
 
 Operand resolve_expr_ternary(Expr *expr, Type *expected_type) {
@@ -2420,6 +3863,10 @@ Operand resolve_expr_ternary(Expr *expr, Type *expected_type) {
     }
 }
 
+bool is_soa_index_expr(Expr *expr) {
+    return expr->kind == EXPR_INDEX && is_soa_array_type(unqualify_type(get_resolved_type(expr->index.expr)));
+}
+
 Operand resolve_expr_index(Expr *expr) {
     assert(expr->kind == EXPR_INDEX);
     Operand index = resolve_expr_rvalue(expr->index.index);
@@ -2440,6 +3887,30 @@ Operand resolve_expr_index(Expr *expr) {
         operand.type = operand.type->aggregate.fields[i].type;
         return operand;
     }
+    Type *vector_type = unqualify_type(operand.type);
+    if (is_vector_type(vector_type)) {
+        if (index.is_const) {
+            cast_operand(&index, type_llong);
+            if (!(0 <= index.val.ll && index.val.ll < (long long)vector_type->num_elems)) {
+                fatal_error(expr->pos, "Vector lane index out of range");
+            }
+        }
+        if (operand.is_lvalue) {
+            return operand_lvalue(qualify_type(vector_type->base, operand.type));
+        } else {
+            return operand_rvalue(vector_type->base);
+        }
+    }
+    Type *soa_type = unqualify_type(operand.type);
+    if (is_soa_array_type(soa_type)) {
+        if (index.is_const) {
+            cast_operand(&index, type_llong);
+            if (!(0 <= index.val.ll && index.val.ll < (long long)soa_type->num_elems)) {
+                fatal_error(expr->pos, "@soa array index out of range");
+            }
+        }
+        return operand_lvalue(qualify_type(soa_type->base, operand.type));
+    }
     operand = operand_decay(operand);
     if (!is_ptr_type(operand.type)) {
         fatal_error(expr->pos, "Can only index aggregates, arrays and pointers");
@@ -2693,6 +4164,9 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
             if (!operand.is_lvalue) {
                 fatal_error(expr->pos, "Cannot take address of non-lvalue");
             }
+            if (is_soa_index_expr(expr->unary.expr)) {
+                fatal_error(expr->pos, "Cannot take address of @soa array element");
+            }
             result = operand_rvalue(type_ptr(operand.type));
         } else {
             result = resolve_expr_unary(expr);
@@ -2715,7 +4189,7 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
                 break;
             }
         }
-        Type *type = resolve_expr(expr->sizeof_expr).type;
+        Type *type = resolve_sizeof_operand(expr->sizeof_expr);
         complete_type(type);
         result = operand_const(type_usize, (Val){.ull = type_sizeof(type)});
         break;
@@ -2737,7 +4211,7 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
                 break;
             }
         }
-        Type *type = resolve_expr(expr->alignof_expr).type;
+        Type *type = resolve_sizeof_operand(expr->alignof_expr);
         complete_type(type);
         result = operand_const(type_usize, (Val){.ull = type_alignof(type)});
         break;
@@ -2763,7 +4237,7 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
                 break;
             }
         }
-        Type *type = resolve_expr(expr->typeof_expr).type;
+        Type *type = resolve_unevaluated_expr(expr->typeof_expr);
         result = operand_const(type_ullong, (Val){.ull = type->typeid});
         break;
     }
@@ -2792,6 +4266,10 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
         break;
     }
     try_const_cast(&result, expr);
+    if (result.is_const) {
+        set_resolved_const(expr, result);
+    }
+    reach_vector_type(result.type);
     if (expected_type && unqualify_type(expected_type) == type_any && unqualify_type(result.type) != type_any) {
         set_implicit_any(expr);
         set_resolved_type(expr, type_decay(result.type));
@@ -2802,7 +4280,9 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
 }
 
 Operand resolve_const_expr(Expr *expr) {
+    resolving_const_expr++;
     Operand operand = resolve_expr(expr);
+    resolving_const_expr--;
     if (!operand.is_const) {
         fatal_error(expr->pos, "Expected constant expression");
     }
@@ -2813,6 +4293,7 @@ Map decl_note_names;
 
 void init_builtin_syms() {
     assert(current_package);
+    init_intrinsics();
     sym_global_type("void", type_void);
     sym_global_type("bool", type_bool);
     sym_global_type("char", type_char);
@@ -2828,6 +4309,13 @@ void init_builtin_syms() {
     sym_global_type("ullong", type_ullong);
     sym_global_type("float", type_float);
     sym_global_type("double", type_double);
+    Type *vector_elems[] = {type_schar, type_uchar, type_short, type_ushort, type_int, type_uint, type_llong, type_ullong, type_float, type_double};
+    for (Type **it = vector_elems; it != vector_elems + sizeof(vector_elems)/sizeof(*vector_elems); it++) {
+        for (size_t size = 16; size <= type_metrics[TYPE_VECTOR].size; size *= 2) {
+            Type *type = type_vector(*it, size / type_sizeof(*it));
+            sym_global_type(vector_type_name(type), type);
+        }
+    }
 }
 
 void postinit_builtin(void) {
@@ -2879,6 +4367,7 @@ void add_package_decls(Package *package) {
         } else if (decl->kind == DECL_IMPORT) {
             // Add to list of imports
         } else {
+            check_hint_notes(decl->notes, decl_note_site(decl));
             sym_global_decl(decl);
         }
     }
@@ -2929,6 +4418,8 @@ Package *import_package(const char *package_path) {
             return NULL;
         }
         strcpy(package->full_path, full_path);
+        // The first search path is system_packages in IONHOME.
+        package->is_system = is_package_dir(package_search_paths[0], package_path);
         add_package(package);
         compile_package(package);
     }
@@ -3016,7 +4507,7 @@ bool parse_package(Package *package) {
         path_absolute(path);
         const char *code = read_file(path);
         if (!code) {
-            fatal_error((SrcPos){.name = path}, "Failed to read source file");
+            fatal_error((SrcPos){.file = add_src_file(str_intern(path), NULL)}, "Failed to read source file");
         }
         source_memory_usage += strlen(code);
         init_stream(str_intern(path), code);
@@ -3047,24 +4538,75 @@ bool compile_package(Package *package) {
     return true;
 }
 
+// Runs func on sym with error recovery. On an error, every symbol and type that was
+// mid-resolution is marked as failed so later uses don't report the same problem again.
+bool recover_sym(void (*func)(Sym *sym), Sym *sym) {
+    jmp_buf recovery;
+    jmp_buf *old_recovery = error_recovery;
+    Package *old_package = current_package;
+    Sym *old_local_syms_end = local_syms_end;
+    int old_resolving_const_expr = resolving_const_expr;
+    size_t num_resolving_syms = buf_len(resolving_syms);
+    size_t num_completion_frames = buf_len(completion_frames);
+    size_t num_dependency_frames = buf_len(dependency_frames);
+    if (setjmp(recovery)) {
+        error_recovery = old_recovery;
+        for (size_t i = num_resolving_syms; i < buf_len(resolving_syms); i++) {
+            resolving_syms[i]->state = SYM_FAILED;
+        }
+        while (buf_len(dependency_frames) > num_dependency_frames) {
+            Sym *sym = dependency_frames[buf_len(dependency_frames) - 1].sym;
+            if (sym->state != SYM_RESOLVED) {
+                sym->state = SYM_FAILED;
+            }
+            pop_dependency_frame();
+        }
+        for (size_t i = num_completion_frames; i < buf_len(completion_frames); i++) {
+            Type *type = completion_frames[i].type;
+            if (type) {
+                type->kind = TYPE_INCOMPLETE;
+                type->sym->state = SYM_FAILED;
+            }
+            buf_free(completion_frames[i].fields);
+        }
+        if (resolving_syms) {
+            buf__hdr(resolving_syms)->len = num_resolving_syms;
+        }
+        if (completion_frames) {
+            buf__hdr(completion_frames)->len = num_completion_frames;
+        }
+        current_package = old_package;
+        local_syms_end = old_local_syms_end;
+        labels_end = labels;
+        resolving_const_expr = old_resolving_const_expr;
+        return false;
+    }
+    error_recovery = &recovery;
+    func(sym);
+    error_recovery = old_recovery;
+    return true;
+}
+
 void resolve_package_syms(Package *package) {
     Package *old_package = enter_package(package);
     for (size_t i = 0; i < buf_len(package->syms); i++) {
         if (package->syms[i]->home_package == package) {
-            resolve_sym(package->syms[i]);
+            recover_sym(resolve_sym, package->syms[i]);
         }
     }
     leave_package(old_package);
 }
 
+size_t num_finalized_syms;
+
 void finalize_reachable_syms(void) {
     if (flag_verbose) {
         printf("Finalizing reachable symbols\n");
     }
-    size_t prev_num_reachable = 0;
+    size_t prev_num_reachable = num_finalized_syms;
     size_t num_reachable = buf_len(reachable_syms);
-    for (size_t i = 0; i < num_reachable; i++) {
-        finalize_sym(reachable_syms[i]);
+    for (size_t i = num_finalized_syms; i < num_reachable; i++) {
+        recover_sym(finalize_sym, reachable_syms[i]);
         if (i == num_reachable - 1) {
             if (flag_verbose) {
                 printf("New reachable symbols:");
@@ -3077,6 +4619,7 @@ void finalize_reachable_syms(void) {
             num_reachable = buf_len(reachable_syms);
         }
     }
+    num_finalized_syms = num_reachable;
 }
 
 bool is_intrinsic(Sym *sym) {
@@ -23,4 +23,6 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <assert.h>
+#include <setjmp.h>
+#include <time.h>
 #include <stdlib.h>
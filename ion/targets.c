@@ -55,7 +55,8 @@ int get_arch(const char *name) {
     [TYPE_LLONG] = {.size = 8, .align = 8, .max = 0x7fffffffffffffff, .sign = true}, \
     [TYPE_ULLONG] = {.size = 8, .align = 8, .max = 0xffffffffffffffff}, \
     [TYPE_FLOAT] = {.size = 4, .align = 4}, \
-    [TYPE_DOUBLE] = {.size = 8, .align = 8}
+    [TYPE_DOUBLE] = {.size = 8, .align = 8}, \
+    [TYPE_VECTOR] = {.size = 32, .align = 32}
 
 TypeMetrics win32_x86_metrics[NUM_TYPE_KINDS] = {
     DEFAULT_TYPE_METRICS,
@@ -21,6 +21,7 @@ typedef enum TypeKind {
     TYPE_PTR,
     TYPE_FUNC,
     TYPE_ARRAY,
+    TYPE_VECTOR,
     TYPE_STRUCT,
     TYPE_UNION,
     TYPE_TUPLE,
@@ -35,6 +36,8 @@ typedef struct TypeField {
     const char *name;
     Type *type;
     size_t offset;
+    // Overrides the type's alignment when larger, from an @align note on the field.
+    size_t align;
 } TypeField;
 
 typedef struct TypeEnumItem {
@@ -58,6 +61,8 @@ struct Type {
         struct {
             TypeField *fields;
             size_t num_fields;
+            // Set for @soa structs, whose sized arrays store each field in its own array.
+            bool soa;
         } aggregate;
         struct {
           TypeEnumItem *enum_items;
@@ -154,6 +159,10 @@ bool is_array_type(Type *type) {
     return type && type->kind == TYPE_ARRAY;
 }
 
+bool is_vector_type(Type *type) {
+    return type && type->kind == TYPE_VECTOR;
+}
+
 bool is_incomplete_array_type(Type *type) {
     return type && is_array_type(type) && type->incomplete_elems;
 }
@@ -329,6 +338,42 @@ typedef struct CachedArrayType {
 } CachedArrayType;
 
 Map cached_array_types;
+Type **soa_array_types;
+
+bool is_soa_struct_type(Type *type) {
+    type = unqualify_type(type);
+    return type->kind == TYPE_STRUCT && type->aggregate.soa;
+}
+
+bool is_soa_array_type(Type *type) {
+    return type && type->kind == TYPE_ARRAY && !type->incomplete_elems && is_soa_struct_type(type->base);
+}
+
+// An array of an @soa struct is laid out like a struct with one array per field, so
+// a[i].x lives at soa_field_offset(a, x) + i*sizeof(x).
+size_t soa_field_offset(Type *type, size_t index) {
+    assert(is_soa_array_type(type));
+    Type *base = unqualify_type(type->base);
+    size_t offset = 0;
+    for (size_t i = 0; i <= index; i++) {
+        TypeField field = base->aggregate.fields[i];
+        offset = ALIGN_UP(offset, MAX(type_alignof(field.type), field.align));
+        if (i < index) {
+            offset += type->num_elems * type_sizeof(field.type);
+        }
+    }
+    return offset;
+}
+
+void type_complete_soa_array(Type *type) {
+    Type *base = unqualify_type(type->base);
+    size_t num_fields = base->aggregate.num_fields;
+    TypeField last = base->aggregate.fields[num_fields - 1];
+    type->size = soa_field_offset(type, num_fields - 1) + type->num_elems * type_sizeof(last.type);
+    type->align = type_alignof(base);
+    type->size = ALIGN_UP(type->size, type->align);
+    buf_push(soa_array_types, type);
+}
 
 Type *type_array(Type *base, size_t num_elems, bool incomplete_elems) {
     uint64_t hash = hash_mix(hash_ptr(base), hash_uint64(num_elems));
@@ -352,8 +397,12 @@ Type *type_array(Type *base, size_t num_elems, bool incomplete_elems) {
         type->align = 0;
     } else {
         complete_type(base);
-        type->size = num_elems * type_sizeof(base);
-        type->align = type_alignof(base);
+        if (is_soa_array_type(type)) {
+            type_complete_soa_array(type);
+        } else {
+            type->size = num_elems * type_sizeof(base);
+            type->align = type_alignof(base);
+        }
 
         CachedArrayType *new_cached = xmalloc(sizeof(CachedArrayType));
         new_cached->type = type;
@@ -363,6 +412,80 @@ Type *type_array(Type *base, size_t num_elems, bool incomplete_elems) {
     return type;
 }
 
+const char *vector_elem_names[NUM_TYPE_KINDS] = {
+    [TYPE_SCHAR] = "int8",
+    [TYPE_UCHAR] = "uint8",
+    [TYPE_SHORT] = "int16",
+    [TYPE_USHORT] = "uint16",
+    [TYPE_INT] = "int32",
+    [TYPE_UINT] = "uint32",
+    [TYPE_LLONG] = "int64",
+    [TYPE_ULLONG] = "uint64",
+    [TYPE_FLOAT] = "float32",
+    [TYPE_DOUBLE] = "float64",
+};
+
+bool is_vector_elem_type(Type *type) {
+    return vector_elem_names[type->kind] != NULL;
+}
+
+Map cached_vector_types;
+Type **vector_types;
+
+// Vector types are only created for the builtin element types and for widths up to the target's
+// TYPE_VECTOR size. They are aligned to their size, capped by the TYPE_VECTOR alignment.
+Type *type_vector(Type *base, size_t num_elems) {
+    assert(is_vector_elem_type(base));
+    uint64_t key = hash_mix(hash_ptr(base), hash_uint64(num_elems));
+    key = key ? key : 1;
+    CachedArrayType *cached = map_get_from_uint64(&cached_vector_types, key);
+    for (CachedArrayType *it = cached; it; it = it->next) {
+        Type *type = it->type;
+        if (type->base == base && type->num_elems == num_elems) {
+            return type;
+        }
+    }
+    Type *type = type_alloc(TYPE_VECTOR);
+    type->base = base;
+    type->num_elems = num_elems;
+    type->size = num_elems * type_sizeof(base);
+    type->align = MIN(type->size, type_metrics[TYPE_VECTOR].align);
+    assert(IS_POW2(type->size) && type->size <= type_metrics[TYPE_VECTOR].size);
+    CachedArrayType *new_cached = xmalloc(sizeof(CachedArrayType));
+    new_cached->type = type;
+    new_cached->next = cached;
+    map_put_from_uint64(&cached_vector_types, key, new_cached);
+    buf_push(vector_types, type);
+    return type;
+}
+
+const char *vector_type_name(Type *type) {
+    assert(type->kind == TYPE_VECTOR);
+    return strf("%sx%zu", vector_elem_names[type->base->kind], type->num_elems);
+}
+
+// The comparison operators on vectors yield lanes of all ones or all zeros in a signed vector with
+// the same lane size and count.
+Type *vector_mask_type(Type *type) {
+    assert(type->kind == TYPE_VECTOR);
+    Type *base = NULL;
+    switch (type_sizeof(type->base)) {
+    case 1:
+        base = type_schar;
+        break;
+    case 2:
+        base = type_short;
+        break;
+    case 4:
+        base = type_int;
+        break;
+    default:
+        base = type_llong;
+        break;
+    }
+    return type_vector(base, type->num_elems);
+}
+
 typedef struct TypeLink {
     Type *type;
     struct TypeLink *next;
@@ -428,6 +551,8 @@ void type_complete_struct(Type *type, TypeField *fields, size_t num_fields) {
     TypeField *new_fields = NULL;
     for (TypeField *it = fields; it != fields + num_fields; it++) {
         assert(IS_POW2(type_alignof(it->type)));
+        size_t align = MAX(type_alignof(it->type), it->align);
+        type->size = ALIGN_UP(type->size, align);
         if (it->name) {
             it->offset = type->size;
             buf_push(new_fields, *it);
@@ -435,8 +560,8 @@ void type_complete_struct(Type *type, TypeField *fields, size_t num_fields) {
             add_type_fields(&new_fields, it->type, type->size);
         }
         field_sizes += type_sizeof(it->type);
-        type->align = MAX(type->align, type_alignof(it->type));
-        type->size = type_sizeof(it->type) + ALIGN_UP(type->size, type_alignof(it->type));
+        type->align = MAX(type->align, align);
+        type->size += type_sizeof(it->type);
         nonmodifiable = it->type->nonmodifiable || nonmodifiable;
     }
     type->size = ALIGN_UP(type->size, type->align);
@@ -462,7 +587,7 @@ void type_complete_union(Type *type, TypeField *fields, size_t num_fields) {
             add_type_fields(&new_fields, it->type, 0);
         }
         type->size = MAX(type->size, type_sizeof(it->type));
-        type->align = MAX(type->align, type_alignof(it->type));
+        type->align = MAX(type->align, MAX(type_alignof(it->type), it->align));
         nonmodifiable = it->type->nonmodifiable || nonmodifiable;
     }
     type->size = ALIGN_UP(type->size, type->align);
@@ -484,6 +609,7 @@ void type_complete_tuple(Type *type, Type **fields, size_t num_fields) {
         assert(IS_POW2(type_alignof(field)));
         char name[64];
         snprintf(name, sizeof(name), "_%d", (int)i);
+        type->size = ALIGN_UP(type->size, type_alignof(field));
         TypeField new_field = {
             .name = str_intern(name),
             .type = fields[i],
@@ -492,7 +618,7 @@ void type_complete_tuple(Type *type, Type **fields, size_t num_fields) {
         buf_push(new_fields, new_field);
         elem_sizes += type_sizeof(field);
         type->align = MAX(type->align, type_alignof(field));
-        type->size = type_sizeof(field) + ALIGN_UP(type->size, type_alignof(field));
+        type->size += type_sizeof(field);
         nonmodifiable = field->nonmodifiable || nonmodifiable;
     }
     type->size = ALIGN_UP(type->size, type->align);